@@ -22,9 +22,11 @@ Experimental script for automatic sorting of errors, basing on failed optimizati
 """
 ###############################################################################
 
+import concurrent.futures
 import logging
 import os
 import re
+import shutil
 
 
 import common
@@ -60,20 +62,24 @@ compilers_opt_name_cutter = {"icc": [icc_opt_name_prefix, icc_opt_name_suffix],
                              "dpcpp": [dpcpp_gpu_opt_name_prefix, dpcpp_gpu_opt_name_suffix]}
 
 blame_test_makefile_name = "Blame_Makefile"
+blame_probe_dir = "blame_probe_"
+
+# Number of opt-bisect points that are checked in parallel during each round of bisection.
+# Every round narrows the search range by a factor of (probe_num + 1).
+probe_num = 1
 
 ###############################################################################
 
 
-def get_next_step(start, end, current, fail_flag):
-    if fail_flag:
-        next_start = start
-        next_current = (current - start) // 2 + start
-        next_end = current
-    else:
-        next_start = current
-        next_current = (end - current) // 2 + current
-        next_end = end
-    return next_start, next_end, next_current
+# Points that split (start, end) range into (num + 1) nearly equal parts.
+# If the range is small enough, all of its inner points are returned.
+def get_probe_points(start, end, num):
+    points = set()
+    for i in range(1, num + 1):
+        point = start + (end - start) * i // (num + 1)
+        if start < point < end:
+            points.add(point)
+    return sorted(points)
 
 
 def dump_exec_output(msg, ret_code, output, err_output, time_expired, num):
@@ -84,6 +90,42 @@ def dump_exec_output(msg, ret_code, output, err_output, time_expired, num):
     common.log_msg(logging.DEBUG, "Err output: " + str(err_output, "utf-8") + " | process " + str(num))
 
 
+def gen_blame_makefile(out_file_name, fail_target, inject_str):
+    gen_test_makefile.gen_makefile(
+            out_file_name = out_file_name,
+            force = True,
+            config_file = None,
+            only_target = fail_target,
+            inject_blame_opt = inject_str if fail_target.specs.name != "dpcpp" else None,
+            inject_blame_env = inject_str if fail_target.specs.name == "dpcpp" else None)
+
+
+# Build and run the test in probe_dir, which contains Blame_Makefile for the probe point.
+# Returns True if the test fails at this point.
+def run_blame_probe(valid_res, fail_target, num, probe_dir, driver_obj):
+    build_params_list = ["make", "-f", blame_test_makefile_name, fail_target.name]
+    # Driver doesn't depend on the probe point, so it is reused.
+    if driver_obj is not None:
+        build_params_list[3:3] = ["-o", driver_obj]
+    ret_code, output, err_output, time_expired, elapsed_time = \
+        common.run_cmd(build_params_list, run_gen.compiler_timeout, num, cwd=probe_dir)
+    if time_expired or ret_code != 0:
+        dump_exec_output("Compilation failed", ret_code, output, err_output, time_expired, num)
+        return True
+
+    ret_code, output, err_output, time_expired, elapsed_time = \
+        common.run_cmd(["make", "-f", blame_test_makefile_name, "run_" + fail_target.name], run_gen.run_timeout, num,
+                       cwd=probe_dir)
+    if time_expired or ret_code != 0:
+        dump_exec_output("Execution failed", ret_code, output, err_output, time_expired, num)
+        return True
+
+    if str(output, "utf-8") != valid_res:
+        common.log_msg(logging.DEBUG, "Output differs (process " + str(num) + "): " + str(output, "utf-8") + " vs " + valid_res + " (expected)")
+        return True
+    return False
+
+
 def execute_blame_phase(valid_res, fail_target, inject_str, num, phase_num):
     gen_test_makefile.gen_makefile(
             out_file_name = blame_test_makefile_name,
@@ -118,59 +160,45 @@ def execute_blame_phase(valid_res, fail_target, inject_str, num, phase_num):
                        + " (process " + str(num) + "): ")
         raise
 
+    # We search for the earliest failing opt number. The test is assumed to pass at start_opt
+    # and to fail at end_opt. Each round checks several points of the range in parallel,
+    # every point is built and run in its own directory.
+    driver_obj = fail_target.name + "_driver.o"
+    if not os.path.isfile(driver_obj):
+        driver_obj = None
+    test_files = gen_test_makefile.sources.value.split() + gen_test_makefile.headers.value.split()
+    probe_dirs = []
+    for i in range(probe_num):
+        probe_dir = blame_probe_dir + str(i)
+        common.check_dir_and_create(probe_dir)
+        for f in test_files + ([driver_obj] if driver_obj is not None else []):
+            common.check_and_copy(f, probe_dir)
+        probe_dirs.append(probe_dir)
+
     start_opt = 0
     end_opt = max_opt_num
-    cur_opt = max_opt_num
-    failed_flag = True
-    time_to_finish = False
-    while not time_to_finish:
-        start_opt, end_opt, cur_opt = get_next_step(start_opt, end_opt, cur_opt, failed_flag)
-        common.log_msg(logging.DEBUG, "Previous failed (process " + str(num) + "): " + str(failed_flag))
-        failed_flag = False
-        eff = ((start_opt + 1) >= cur_opt)  # Earliest fail was found
-
-        common.log_msg(logging.DEBUG, "Trying opt (process " + str(num) + "): " + str(start_opt) + "/" + str(cur_opt) + "/" + str(end_opt))
-        gen_test_makefile.gen_makefile(
-                out_file_name = blame_test_makefile_name,
-                force = True,
-                config_file = None,
-                only_target = fail_target,
-                inject_blame_opt = inject_str + str(cur_opt) if fail_target.specs.name != "dpcpp" else None,
-                inject_blame_env = inject_str + str(cur_opt) if fail_target.specs.name == "dpcpp" else None)
-        ret_code, output, err_output, time_expired, elapsed_time = \
-            common.run_cmd(["make", "-f", blame_test_makefile_name, fail_target.name], run_gen.compiler_timeout, num)
-        if time_expired or ret_code != 0:
-            dump_exec_output("Compilation failed", ret_code, output, err_output, time_expired, num)
-            failed_flag = True
-            if not eff:
-                continue
-            else:
-                break
-
-        ret_code, output, err_output, time_expired, elapsed_time = \
-            common.run_cmd(["make", "-f", blame_test_makefile_name, "run_" + fail_target.name], run_gen.run_timeout, num)
-        if time_expired or ret_code != 0:
-            dump_exec_output("Execution failed", ret_code, output, err_output, time_expired, num)
-            failed_flag = True
-            if not eff:
-                continue
-            else:
-                break
-
-        if str(output, "utf-8") != valid_res:
-            common.log_msg(logging.DEBUG, "Output differs (process " + str(num) + "): " + str(output, "utf-8") + " vs " + valid_res + " (expected)")
-            failed_flag = True
-            if not eff:
-                continue
-            else:
-                break
-
-        time_to_finish = (eff and failed_flag) or (eff and not failed_flag and (cur_opt == (end_opt - 1)))
-        common.log_msg(logging.DEBUG, "Time to finish (process " + str(num) + "): " + str(time_to_finish))
-
-    if not failed_flag:
-        common.log_msg(logging.DEBUG, "Swapping current and end opt (process " + str(num) + ")")
-        cur_opt = end_opt
+    try:
+        with concurrent.futures.ThreadPoolExecutor(max_workers=probe_num) as probe_runner:
+            while end_opt - start_opt > 1:
+                points = get_probe_points(start_opt, end_opt, probe_num)
+                common.log_msg(logging.DEBUG, "Trying opts (process " + str(num) + "): " + str(start_opt) + "/" +
+                               str(points) + "/" + str(end_opt))
+                for point, probe_dir in zip(points, probe_dirs):
+                    gen_blame_makefile(os.path.join(probe_dir, blame_test_makefile_name), fail_target,
+                                       inject_str + str(point))
+                results = [probe_runner.submit(run_blame_probe, valid_res, fail_target, num, probe_dir, driver_obj)
+                           for probe_dir in probe_dirs[:len(points)]]
+                # Wait for every probe of the round, as the next round reuses their directories
+                verdicts = [result.result() for result in results]
+                for point, verdict in zip(points, verdicts):
+                    if verdict:
+                        end_opt = point
+                        break
+                    start_opt = point
+    finally:
+        for probe_dir in probe_dirs:
+            shutil.rmtree(probe_dir, ignore_errors=True)
+    cur_opt = end_opt
 
     common.log_msg(logging.DEBUG, "Finished blame phase, result: " + str(inject_str) + str(cur_opt) + " (process " + str(num) + ")")
 
@@ -201,13 +229,7 @@ def blame(fail_dir, valid_res, fail_target, out_dir, lock, num, inplace):
             return False
 
         # Wrap up results
-        gen_test_makefile.gen_makefile(
-                out_file_name = blame_test_makefile_name,
-                force = True,
-                config_file = None,
-                only_target = fail_target,
-                inject_blame_opt = blame_str if fail_target.specs.name != "dpcpp" else None,
-                inject_blame_env = blame_str if fail_target.specs.name == "dpcpp" else None)
+        gen_blame_makefile(blame_test_makefile_name, fail_target, blame_str)
         ret_code, stdout, stderr, time_expired, elapsed_time = \
             common.run_cmd(["make", "-f", blame_test_makefile_name, fail_target.name], run_gen.compiler_timeout, num)
         if fail_target.specs.name == "dpcpp":
@@ -27,10 +27,13 @@ import enum
 import errno
 import logging
 import os
+import resource
+import selectors
 import shutil
 import signal
 import subprocess
 import sys
+import threading
 
 scripts_dir_name = "scripts"
 # $YARPGEN_HOME environment variable should be set to YARPGen directory
@@ -231,18 +234,71 @@ def check_dir_and_create(directory):
         print_and_exit("Can't use '" + norm_dir + "' directory")
 
 
-def run_cmd(cmd, time_out=None, num=-1, memory_limit=None):
-    is_time_expired = False
-    shell = False
+# prlimit sets the limits of the process and execs the command, so it doesn't add a process
+prlimit_bin = shutil.which("prlimit")
+
+
+# Reads stdout and stderr of the process until both of them are closed. Unlike communicate(),
+# it doesn't reap the process, so run_cmd can reap it with os.wait4() and get its resource usage.
+def read_pipes(process):
+    outputs = {process.stdout: [], process.stderr: []}
+    with selectors.DefaultSelector() as selector:
+        for pipe in outputs:
+            selector.register(pipe, selectors.EVENT_READ)
+        while selector.get_map():
+            for key, events in selector.select():
+                data = os.read(key.fd, 32768)
+                if data:
+                    outputs[key.fileobj].append(data)
+                else:
+                    selector.unregister(key.fileobj)
+                    key.fileobj.close()
+    return b"".join(outputs[process.stdout]), b"".join(outputs[process.stderr])
+
+
+# The process is a leader of its own group (start_new_session), so the group id is its pid.
+# The pid can't be reused until run_cmd reaps the process, and it waits for the timer before that.
+def kill_process_group(process, time_expired):
+    log_msg(logging.DEBUG, "Timeout triggered for proc num " + str(process.pid) + " sending kill signal to group")
+    # Sigterm is good enough here and compared to sigkill gives a chance to the processes
+    # to clean up after themselves.
+    # The leader may have exited just before the timer fired. Its descendants are still killed,
+    # but the run has finished in time. os.waitid() isn't available everywhere (e.g. on macOS
+    # before Python 3.13), and then only the outcome of killpg is known.
+    exited = False
+    if hasattr(os, "waitid"):
+        exited = os.waitid(os.P_PID, process.pid, os.WEXITED | os.WNOHANG | os.WNOWAIT) is not None
+    try:
+        os.killpg(process.pid, signal.SIGTERM)
+    except ProcessLookupError:
+        # The whole group has already exited, so the time isn't expired
+        return
+    if not exited:
+        time_expired.set()
+
+
+def run_cmd(cmd, time_out=None, num=-1, memory_limit=None, cwd=None):
+    # Memory limit is given in kbytes, as for "ulimit -v". It has to be set before exec, so that
+    # all descendants of the process inherit it. prlimit does it without running any code in
+    # the forked child. Otherwise preexec_fn is used: it is called in the child between fork()
+    # and exec(), which may deadlock if another thread holds a lock at the moment of fork().
+    # setrlimit() doesn't take any locks, but run_gen spawns processes from several threads,
+    # so prlimit should be preferred. Processes without the limit are spawned without any
+    # of them, so Popen can use the cheapest way to start them.
+    preexec_fn = None
+    cmd_with_limit = cmd
     if memory_limit is not None:
-        shell = True
-        new_cmd = "ulimit -v " + str(memory_limit) + " ; "
-        new_cmd += " ".join(i for i in cmd)
-        cmd = new_cmd
-    start_time = os.times()
-    with subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, start_new_session=True, shell=shell) as process:
-        try:
+        limit = memory_limit * 1024
+        if prlimit_bin is not None:
+            cmd_with_limit = [prlimit_bin, "--as=" + str(limit), "--"] + list(cmd)
+        else:
+            preexec_fn = lambda: resource.setrlimit(resource.RLIMIT_AS, (limit, limit))
+    with subprocess.Popen(cmd_with_limit, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          start_new_session=True, cwd=cwd, preexec_fn=preexec_fn) as process:
+        if main_logger.isEnabledFor(logging.DEBUG):
             log_msg_str = "Running " + str(cmd)
+            if memory_limit is not None:
+                log_msg_str += " with " + str(memory_limit) + " kb memory limit"
             if num != -1:
                 log_msg_str += " in process " + str(num)
             if time_out is None:
@@ -250,22 +306,31 @@ def run_cmd(cmd, time_out=None, num=-1, memory_limit=None):
             else:
                 log_msg_str += " with " + str(time_out) + " timeout"
             log_msg(logging.DEBUG, log_msg_str)
-            output, err_output = process.communicate(timeout=time_out)
-            ret_code = process.poll()
-        except subprocess.TimeoutExpired:
-            log_msg(logging.DEBUG, "Timeout triggered for proc num " + str(process.pid) + " sending kill signal to group")
-            # Sigterm is good enough here and compared to sigkill gives a chance to the processes
-            # to clean up after themselves.
-            os.killpg(os.getpgid(process.pid), signal.SIGTERM)
-            # once in a while stdout/stderr may not exist when the process is killed, so using try.
-            try:
-                output, err_output = process.communicate()
-            except ValueError:
-                output = b''
-                err_output = b''
-            log_msg(logging.DEBUG, "Procces " + str(process.pid) + " has finally died")
-            is_time_expired = True
-            ret_code = None
+
+        # The timer kills the process group when the time is out, so the process can be
+        # waited for without polling.
+        time_expired = threading.Event()
+        timer = None
+        if time_out is not None:
+            timer = threading.Timer(time_out, kill_process_group, (process, time_expired))
+            timer.start()
+        try:
+            output, err_output = read_pipes(process)
+            # Wait for the exit without reaping, so the timer can't kill a group with a reused id.
+            # Without os.waitid() the timer is stopped as soon as the pipes are closed.
+            if hasattr(os, "waitid"):
+                os.waitid(os.P_PID, process.pid, os.WEXITED | os.WNOWAIT)
+            if timer is not None:
+                timer.cancel()
+                timer.join()
+            # Reaping with os.wait4() gives the resource usage of this process only
+            pid, status, rusage = os.wait4(process.pid, 0)
+            if os.WIFSIGNALED(status):
+                ret_code = -os.WTERMSIG(status)
+            else:
+                ret_code = os.WEXITSTATUS(status)
+            # Popen won't try to reap the process once it knows the return code
+            process.returncode = ret_code
         except:
             log_msg(logging.ERROR, str(cmd) + " failed: unknown exception (proc num "+ str(process.pid) + ")")
             # Something really bad is going on, so better to send sigkill
@@ -273,9 +338,15 @@ def run_cmd(cmd, time_out=None, num=-1, memory_limit=None):
             process.wait()
             log_msg(logging.DEBUG, "Procces " + str(process.pid) + " has finally died")
             raise
-    end_time = os.times()
-    elapsed_time = end_time.children_user - start_time.children_user + \
-                   end_time.children_system - start_time.children_system
+        finally:
+            if timer is not None:
+                timer.cancel()
+
+    is_time_expired = time_expired.is_set()
+    if is_time_expired:
+        log_msg(logging.DEBUG, "Procces " + str(process.pid) + " has finally died")
+        ret_code = None
+    elapsed_time = rusage.ru_utime + rusage.ru_stime
     return ret_code, output, err_output, is_time_expired, elapsed_time
 
 
@@ -264,6 +264,41 @@ def parse_config(file_name):
 ###############################################################################
 
 
+def get_compiler_name(target):
+    if common.selected_standard.is_c():
+        return target.specs.comp_c_name
+    if common.selected_standard.is_cxx():
+        return target.specs.comp_cxx_name
+    return None
+
+
+def get_optflags(target):
+    optflags = target.args
+    if target.arch.comp_name != "":
+        optflags += " " + target.specs.arch_prefix + target.arch.comp_name
+    return optflags
+
+
+def get_driver_optflags(target):
+    # For performance reasons driver should always be compiled with -O0
+    return re.sub("-O\d", "-O0", get_optflags(target))
+
+
+# Command that Test_Makefile uses to compile the source for the target (without the stat
+# options). Targets with equal commands produce equal objects.
+def get_compile_cmd(target, source):
+    optflags = get_driver_optflags(target) if source.split(".")[0] == "driver" else get_optflags(target)
+    return " ".join([get_compiler_name(target), cxx_flags.value, std_flags.value, optflags])
+
+
+# Command that Test_Makefile uses to link the objects for the target
+def get_link_cmd(target):
+    return " ".join([get_compiler_name(target), ld_flags.value, std_flags.value, get_optflags(target)])
+
+
+###############################################################################
+
+
 def detect_native_arch():
     check_isa_file = os.path.abspath(common.yarpgen_scripts + os.sep + check_isa_file_name)
     check_isa_binary = os.path.abspath(common.yarpgen_scripts + os.sep + check_isa_file_name.replace(".cpp", ""))
@@ -327,20 +362,9 @@ def gen_makefile(out_file_name, force, config_file, only_target=None, inject_bla
     for target in CompilerTarget.all_targets:
         if only_target is not None and only_target.name != target.name:
             continue
-        compiler_name = None
-        if common.selected_standard.is_c():
-            compiler_name = target.specs.comp_c_name
-        if common.selected_standard.is_cxx():
-            compiler_name = target.specs.comp_cxx_name
-        output += target.name + ": " + "COMPILER=" + compiler_name + "\n"
-
-        optflags_str = target.name + ": " + "OPTFLAGS=" + target.args
-        if target.arch.comp_name != "":
-            optflags_str += " " + target.specs.arch_prefix + target.arch.comp_name
-        optflags_str += "\n"
-        output += optflags_str
-        # For performance reasons driver should always be compiled with -O0
-        output += re.sub("-O\d", "-O0", (optflags_str.replace("OPTFLAGS", "DRIVER_OPTFLAGS")))
+        output += target.name + ": " + "COMPILER=" + get_compiler_name(target) + "\n"
+        output += target.name + ": " + "OPTFLAGS=" + get_optflags(target) + "\n"
+        output += target.name + ": " + "DRIVER_OPTFLAGS=" + get_driver_optflags(target) + "\n"
 
         if inject_blame_opt is not None:
             output += target.name + ": " + "BLAMEOPTS=" + inject_blame_opt + "\n"
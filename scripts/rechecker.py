@@ -23,11 +23,14 @@ Script for rechecking of previously found errors
 ###############################################################################
 
 import argparse
+import hashlib
+import json
 import logging
 import multiprocessing
+import multiprocessing.connection
 import os
 import sys
-import queue
+import time
 
 import common
 import gen_test_makefile
@@ -37,6 +40,12 @@ import blame_opt
 
 ###############################################################################
 
+# The result store is saved while the tests are rechecked, so that an interrupted run keeps
+# most of its verdicts. It happens after this number of tests or this number of seconds.
+store_save_tests = 100
+store_save_interval = 60
+
+
 def process_dir(directory, task_queue):
     common.log_msg(logging.DEBUG, "Searching for test directories in " + str(directory))
     for root, dirs, files in os.walk(directory):
@@ -49,7 +58,68 @@ def process_dir(directory, task_queue):
     return task_queue
 
 
-def prepare_env_and_recheck(input_dir, out_dir, target, num_jobs, config_file):
+# Result store keeps the outcome of every rechecked test, so that the next invocation
+# rechecks only what could have changed. For each test it records a key of every target
+# (a hash of test sources, compiler --version output and compile and link commands),
+# outputs of the targets that passed and the final verdict.
+def load_result_store(store_file):
+    if store_file is None or not os.path.isfile(store_file):
+        return {}
+    with open(store_file, "r") as inp:
+        return json.load(inp)
+
+
+def save_result_store(store_file, store):
+    tmp_file = store_file + ".tmp"
+    with open(tmp_file, "w") as out:
+        json.dump(store, out, indent=1, sort_keys=True)
+    os.replace(tmp_file, store_file)
+
+
+def get_sources_hash():
+    sources_hash = hashlib.sha256()
+    for f in gen_test_makefile.sources.value.split() + gen_test_makefile.headers.value.split():
+        if os.path.isfile(f):
+            with open(f, "rb") as source:
+                sources_hash.update(source.read())
+    return sources_hash.hexdigest()
+
+
+def get_target_key(sources_hash, target):
+    key = [sources_hash, str(target.specs.version)]
+    key += [gen_test_makefile.get_compile_cmd(target, source) for source in gen_test_makefile.sources.value.split()]
+    key.append(gen_test_makefile.get_link_cmd(target))
+    return hashlib.sha256("|".join(key).encode("utf-8")).hexdigest()
+
+
+# Builds the target. Objects that were already compiled with the same sources and
+# command are taken from the cache.
+def build_target(target, obj_cache, num):
+    build_params_list = ["make", "-f", gen_test_makefile.Test_Makefile_name, target.name]
+    obj_files = {source: target.name + "_" + source.split(".")[0] + ".o"
+                 for source in gen_test_makefile.sources.value.split()}
+    for source, obj_file in obj_files.items():
+        if obj_cache.fetch(target, source, obj_file):
+            build_params_list[3:3] = ["-o", obj_file]
+    ret_code, output, err_output, time_expired, elapsed_time = \
+        common.run_cmd(build_params_list, run_gen.compiler_timeout, num)
+    if time_expired or ret_code != 0:
+        return False
+    for source, obj_file in obj_files.items():
+        obj_cache.store(target, source, obj_file)
+    return True
+
+
+# Reports tests of a unity build that differ between the outputs or report an error
+def log_miscompared_seeds(outputs, num):
+    seeds = run_gen.get_miscompared_seeds(outputs)
+    if seeds:
+        common.log_msg(logging.DEBUG, "#" + str(num) + " Miscompared tests of the unity build: " +
+                       " ".join("S_" + s for s in seeds))
+    return seeds
+
+
+def prepare_env_and_recheck(input_dir, out_dir, target, num_jobs, config_file, store_file, obj_cache_dir):
     if not common.check_if_dir_exists(input_dir):
         common.print_and_exit("Can't use input directory")
     common.check_dir_and_create(out_dir)
@@ -57,11 +127,20 @@ def prepare_env_and_recheck(input_dir, out_dir, target, num_jobs, config_file):
     run_gen.gen_test_makefile_and_copy(out_dir, config_file)
     run_gen.dump_testing_sets(target)
     run_gen.print_compilers_version(target)
+    if obj_cache_dir is not None:
+        common.check_dir_and_create(obj_cache_dir)
 
     lock = multiprocessing.Lock()
+    store = None
+    if store_file is not None:
+        store_manager = multiprocessing.Manager()
+        store = store_manager.dict(load_result_store(store_file))
 
     task_queue = multiprocessing.JoinableQueue()
     process_dir(input_dir, task_queue)
+    # Workers live until all the tests are rechecked and stop when they get None
+    for num in range(num_jobs):
+        task_queue.put(None)
     failed_queue = multiprocessing.SimpleQueue()
     passed_queue = multiprocessing.SimpleQueue()
 
@@ -69,46 +148,108 @@ def prepare_env_and_recheck(input_dir, out_dir, target, num_jobs, config_file):
     for num in range(num_jobs):
         task_threads[num] = \
             multiprocessing.Process(target=recheck,
-                                    args=(num, lock, task_queue, failed_queue, passed_queue, target, out_dir))
+                                    args=(num, lock, task_queue, failed_queue, passed_queue, target, out_dir,
+                                          input_dir, store, obj_cache_dir))
         task_threads[num].start()
 
-    task_queue.join()
-    task_queue.close()
+    # Every worker reports each test it has finished to passed_queue and the failed ones to
+    # failed_queue as well. Both of them are pipes, so they are drained while the workers run,
+    # otherwise the workers block once a pipe is full.
+    all_tests = 0
+    failed_tests = set()
 
-    for num in range(num_jobs):
-        task_threads[num].join()
+    def drain_queues():
+        nonlocal all_tests
+        new_tests = 0
+        while not failed_queue.empty():
+            failed_tests.add(failed_queue.get())
+        while not passed_queue.empty():
+            passed_queue.get()
+            new_tests += 1
+        all_tests += new_tests
+        return new_tests
 
+    try:
+        unsaved_tests = 0
+        last_save_time = time.monotonic()
+        sentinels = [task_thread.sentinel for task_thread in task_threads]
+        while any(task_thread.is_alive() for task_thread in task_threads):
+            multiprocessing.connection.wait(sentinels, timeout=1)
+            unsaved_tests += drain_queues()
+            if store is not None and unsaved_tests != 0 and \
+               (unsaved_tests >= store_save_tests or time.monotonic() - last_save_time >= store_save_interval):
+                save_result_store(store_file, dict(store))
+                unsaved_tests = 0
+                last_save_time = time.monotonic()
 
-def recheck(num, lock, task_queue, failed_queue, passed_queue, target, out_dir):
+        task_queue.join()
+        task_queue.close()
+
+        for num in range(num_jobs):
+            task_threads[num].join()
+        drain_queues()
+        common.log_msg(logging.INFO, "Rechecked " + str(all_tests) + " tests, " + str(len(failed_tests)) +
+                       " of them failed")
+    finally:
+        if store is not None:
+            try:
+                save_result_store(store_file, dict(store))
+            except (EOFError, OSError):
+                common.log_msg(logging.ERROR, "Can't save the result store, it keeps the last saved verdicts")
+
+
+def recheck(num, lock, task_queue, failed_queue, passed_queue, target, out_dir, input_dir, store, obj_cache_dir):
     common.log_msg(logging.DEBUG, "Started recheck. Process #" + str(num))
     cwd_save = os.getcwd()
     abs_out_dir = os.path.join(cwd_save, out_dir)
-    job_finished = False
-    while not job_finished:
-        try:
-            test_dir = task_queue.get_nowait()
-            task_queue.task_done()
-            common.log_msg(logging.DEBUG, "#" + str(num) + " test directory: " + str(test_dir))
-            abs_test_dir = os.path.join(cwd_save, test_dir)
-            common.check_and_copy(os.path.join(os.path.join(cwd_save, out_dir), gen_test_makefile.Test_Makefile_name),
-                                  os.path.join(abs_test_dir,               gen_test_makefile.Test_Makefile_name))
-            os.chdir(os.path.join(cwd_save, abs_test_dir))
-
-            valid_res = None
-            out_res = set()
-            prev_out_res_len = 1  # We can't check first result
-            for i in gen_test_makefile.CompilerTarget.all_targets:
-                if i.specs.name not in target.split():
-                    continue
+    targets = [i for i in gen_test_makefile.CompilerTarget.all_targets if i.specs.name in target.split()]
+    # The cache lives as long as the worker, so objects in obj_cache_dir are reused across tests
+    obj_cache = run_gen.ObjectCache(obj_cache_dir)
+    while True:
+        test_dir = task_queue.get()
+        task_queue.task_done()
+        if test_dir is None:
+            break
+        common.log_msg(logging.DEBUG, "#" + str(num) + " test directory: " + str(test_dir))
+        abs_test_dir = os.path.join(cwd_save, test_dir)
+        common.check_and_copy(os.path.join(os.path.join(cwd_save, out_dir), gen_test_makefile.Test_Makefile_name),
+                              os.path.join(abs_test_dir,               gen_test_makefile.Test_Makefile_name))
+        os.chdir(os.path.join(cwd_save, abs_test_dir))
+
+        store_name = os.path.relpath(abs_test_dir, os.path.join(cwd_save, input_dir))
+        old_record = store.get(store_name) if store is not None else None
+        sources_hash = get_sources_hash()
+        record = {"keys": {i.name: get_target_key(sources_hash, i) for i in targets}, "results": {},
+                  "passed": False}
 
+        # Nothing has changed since the last recheck, so the verdict is the same
+        if old_record is not None and old_record["keys"] == record["keys"]:
+            common.log_msg(logging.DEBUG, "#" + str(num) + " Reusing stored verdict")
+            if not old_record["passed"]:
+                failed_queue.put(test_dir)
+                common.copy_test_to_out(abs_test_dir, os.path.join(abs_out_dir, test_dir), lock)
+            passed_queue.put(test_dir)
+            os.chdir(cwd_save)
+            continue
+
+        obj_cache.reset()
+        valid_res = None
+        out_res = set()
+        prev_out_res_len = 1  # We can't check first result
+        test_passed = True
+        for i in targets:
+            # Output of the target can be reused if neither the test nor the target has changed
+            if old_record is not None and i.name in old_record["results"] and \
+               old_record["keys"].get(i.name) == record["keys"][i.name]:
+                common.log_msg(logging.DEBUG, "Reusing stored result for target " + i.name)
+                output = old_record["results"][i.name]
+            else:
                 common.log_msg(logging.DEBUG, "Re-checking target " + i.name)
-                ret_code, output, err_output, time_expired, elapsed_time = \
-                    common.run_cmd(["make", "-f", gen_test_makefile.Test_Makefile_name, i.name],
-                                   run_gen.compiler_timeout, num)
-                if time_expired or ret_code != 0:
+                if not build_target(i, obj_cache, num):
                     failed_queue.put(test_dir)
                     common.log_msg(logging.DEBUG, "#" + str(num) + " Compilation failed")
                     common.copy_test_to_out(abs_test_dir, os.path.join(abs_out_dir, test_dir), lock)
+                    test_passed = False
                     break
 
                 ret_code, output, err_output, time_expired, elapsed_time = \
@@ -118,23 +259,37 @@ def recheck(num, lock, task_queue, failed_queue, passed_queue, target, out_dir):
                     failed_queue.put(test_dir)
                     common.log_msg(logging.DEBUG, "#" + str(num) + " Execution failed")
                     common.copy_test_to_out(abs_test_dir, os.path.join(abs_out_dir, test_dir), lock)
+                    test_passed = False
                     break
+                output = str(output, "utf-8")
+                # Unity build reports every test on its own line, so the whole output is compared
+                if not run_gen.is_unity_output(output):
+                    output = output.split()[-1]
 
-                out_res.add(str(output, "utf-8").split()[-1])
-                if len(out_res) > prev_out_res_len:
-                    prev_out_res_len = len(out_res)
-                    failed_queue.put(test_dir)
-                    common.log_msg(logging.DEBUG, "#" + str(num) + " Out differs")
-                    if not blame_opt.prepare_env_and_blame(abs_test_dir, valid_res, i, abs_out_dir, lock, num):
-                        common.copy_test_to_out(abs_test_dir, os.path.join(abs_out_dir, test_dir), lock)
-                    break
-                valid_res = str(output, "utf-8").split()[-1]
-
-            passed_queue.put(test_dir)
-            os.chdir(cwd_save)
+            record["results"][i.name] = output
+            out_res.add(output)
+            if len(out_res) > prev_out_res_len:
+                prev_out_res_len = len(out_res)
+                failed_queue.put(test_dir)
+                common.log_msg(logging.DEBUG, "#" + str(num) + " Out differs")
+                log_miscompared_seeds(out_res, num)
+                if not blame_opt.prepare_env_and_blame(abs_test_dir, valid_res, i, abs_out_dir, lock, num):
+                    common.copy_test_to_out(abs_test_dir, os.path.join(abs_out_dir, test_dir), lock)
+                test_passed = False
+                break
+            # Tests of a unity build may report errors even if all the targets agree
+            if log_miscompared_seeds([output], num):
+                failed_queue.put(test_dir)
+                common.copy_test_to_out(abs_test_dir, os.path.join(abs_out_dir, test_dir), lock)
+                test_passed = False
+                break
+            valid_res = output
 
-        except queue.Empty:
-            job_finished = True
+        if store is not None:
+            record["passed"] = test_passed
+            store[store_name] = record
+        passed_queue.put(test_dir)
+        os.chdir(cwd_save)
 
 
 ###############################################################################
@@ -151,8 +306,8 @@ if __name__ == '__main__':
     requiredNamed.add_argument("-i", "--input-dir", dest="input_dir", type=str, required=True,
                                help="Input directory for re-checking")
 
-    parser.add_argument('--std', dest="std_str", default="c++11", type=str,
-                        help='Language standard. Possible variants are ' + str(list(gen_test_makefile.StrToStdId))[1:-1])
+    parser.add_argument('--std', dest="std_str", default="c++", type=str,
+                        help='Language standard. Possible variants are ' + str(list(common.StrToStdID))[1:-1])
     parser.add_argument("-o", "--output-dir", dest="out_dir", default="re-checked", type=str,
                         help="Output directory with relevant fails")
     parser.add_argument("--config-file", dest="config_file",
@@ -168,6 +323,12 @@ if __name__ == '__main__':
                         help="Increase output verbosity")
     parser.add_argument("--log-file", dest="log_file", type=str,
                         help="Logfile")
+    parser.add_argument("--store", dest="store_file", default=None, type=str,
+                        help="File with results of previous rechecks. Only tests and targets that have changed "
+                             "since then are rechecked. The file is updated with new results")
+    parser.add_argument("--obj-cache", dest="obj_cache_dir", default=None, type=str,
+                        help="Directory for compiled objects. Objects are reused by all tests and later "
+                             "invocations that compile the same sources with the same compiler and command")
     args = parser.parse_args()
 
     log_level = logging.DEBUG if args.verbose else logging.INFO
@@ -176,4 +337,6 @@ if __name__ == '__main__':
     common.check_python_version()
     common.set_standard(args.std_str)
     gen_test_makefile.set_standard()
-    prepare_env_and_recheck(args.input_dir, args.out_dir, args.target, args.num_jobs, args.config_file)
+    prepare_env_and_recheck(args.input_dir, args.out_dir, args.target, args.num_jobs, args.config_file,
+                            os.path.abspath(args.store_file) if args.store_file is not None else None,
+                            os.path.abspath(args.obj_cache_dir) if args.obj_cache_dir is not None else None)
@@ -24,8 +24,10 @@ Script for autonomous testing with YARP Generator
 
 import argparse
 import collections
+import concurrent.futures
 import datetime
 import enum
+import hashlib
 import logging
 import math
 import multiprocessing
@@ -35,6 +37,7 @@ import re
 import shutil
 import stat
 import sys
+import threading
 import time
 import queue
 
@@ -46,6 +49,8 @@ res_dir = "result"
 process_dir = "process_"
 creduce_bin = "creduce"
 creduce_n = 0
+# Number of tests that the generator bundles into a single unity build
+unity_size = 1
 
 clang_total_stmt_str = "stmts/expr"
 
@@ -178,6 +183,41 @@ class StatsParser(object):
         return result
 
 
+# Driver of a unity build prints "<seed>: <result>" lines for each of its tests.
+unity_line_regex = re.compile(r"^\d+: ", re.MULTILINE)
+
+
+def is_unity_output(output):
+    return unity_line_regex.search(output) is not None
+
+
+# Returns seeds of the unity build tests that have different results in the outputs of
+# different runs or report an error.
+def get_miscompared_seeds(outputs):
+    seeds = []
+    run_results = []
+    for output in outputs:
+        results = {}
+        for line in output.splitlines():
+            seed, sep, result = line.partition(": ")
+            if not sep:
+                continue
+            if seed not in results:
+                results[seed] = []
+                if seed not in seeds:
+                    seeds.append(seed)
+            results[seed].append(result)
+        run_results.append(results)
+
+    miscompared_seeds = []
+    for seed in seeds:
+        seed_results = [results.get(seed) for results in run_results]
+        if any(r != seed_results[0] for r in seed_results) or \
+           any(r is None or "ERROR" in " ".join(r) for r in seed_results):
+            miscompared_seeds.append(seed)
+    return miscompared_seeds
+
+
 # class representing the test
 class Test(object):
     # list of files
@@ -203,17 +243,21 @@ class Test(object):
 
     # Generate new test
     # stat is statistics object
+    # path is the directory of the test inside of the worker's directory. Tests are generated
+    # in the background, so the current directory can belong to another test.
     # seed is optional, if we want to generate some particular seed.
     # proc_num is optinal debug info to track in what process we are running this activity.
-    def __init__(self, stat, seed="", proc_num=-1, blame=False, creduce_makefile=None):
+    def __init__(self, stat, path, seed="", proc_num=-1, blame=False, creduce_makefile=None):
         # Run generator
-        yarpgen_run_list = [".." + os.sep + "yarpgen",
+        yarpgen_run_list = [".." + os.sep + ".." + os.sep + "yarpgen",
                             "--std=" + common.StdID.get_pretty_std_name(common.selected_standard)]
         if seed:
             yarpgen_run_list += ["-s", seed]
+        if unity_size > 1:
+            yarpgen_run_list += ["--unity-size=" + str(unity_size)]
         self.yarpgen_cmd = " ".join(str(p) for p in yarpgen_run_list)
         self.ret_code, self.stdout, self.stderr, self.is_time_expired, self.elapsed_time = \
-            common.run_cmd(yarpgen_run_list, yarpgen_timeout, proc_num, yarpgen_mem_limit)
+            common.run_cmd(yarpgen_run_list, yarpgen_timeout, proc_num, yarpgen_mem_limit, cwd=path)
 
         # Files that belongs to generate test. They are hardcoded for now.
         # Generator may report them in output later and we may need to parse it.
@@ -228,12 +272,13 @@ class Test(object):
                 seed = str(proc_num) + "_" + datetime.datetime.now().strftime('%Y_%m_%d_%H_%M_%S')
         self.seed = seed
 
-        self.path = os.getcwd()
+        self.path = path
         self.proc_num = proc_num
         self.stat = stat
         self.blame = blame
         self.blame_phase = ""
         self.blame_result = "was not run"
+        self.miscompared_seeds = []
         self.creduce = bool(creduce_makefile)
         self.creduce_makefile = creduce_makefile
 
@@ -257,7 +302,7 @@ class Test(object):
         self.successful_test_runs = []
         self.fail_test_runs = []
 
-        seed_file = open("seed", "w")
+        seed_file = open(os.path.join(self.path, "seed"), "w")
         seed_file.write(self.seed + "\n")
         seed_file.close()
         common.log_msg(logging.DEBUG, "Process " + str(proc_num) + " has generated seed " + str(seed))
@@ -389,6 +434,10 @@ class Test(object):
             for run in results.values():
                 bad_runs += run
 
+        # Driver of a unity build reports every test separately
+        if unity_size > 1:
+            self.miscompared_seeds = get_miscompared_seeds([run.checksum for run in self.successful_test_runs])
+
         # Run blame triagging for one of failing optsets
         if self.blame and good_runs:
             do_blame(self, self.files, good_runs[0].checksum, bad_runs[0].target)
@@ -435,6 +484,9 @@ class Test(object):
         log.write("Time: " + datetime.datetime.now().strftime('%Y/%m/%d %H:%M:%S') + "\n")
         log.write("Language standard: " + common.get_standard() + "\n")
         log.write("Type: " + self.status_string() + "\n")
+        if self.miscompared_seeds:
+            log.write("Miscompared tests of the unity build: " +
+                      " ".join("S_" + s for s in self.miscompared_seeds) + "\n")
         if self.blame:
             log.write("Blaming " + self.blame_result + "\n")
             log.write("Optimization to blame: " + self.blame_phase + "\n")
@@ -820,6 +872,72 @@ class Test(object):
 # 4. rerun test from the dir?
 # End of Test class
 
+# Objects that were already compiled for the current test.
+# The driver is compiled with -O0 for every opt-set, so opt-sets that differ
+# only in optimization level share the same driver object. Opt-sets with equal
+# compile commands share func objects as well. Objects are keyed by the hash of
+# the source with the headers, by the compiler version and by the compile command.
+# If cache_dir is set, objects are also kept there, so they can be reused by
+# other tests and processes with the same sources.
+class ObjectCache(object):
+    def __init__(self, cache_dir=None):
+        self.cache_dir = cache_dir
+        self.sources_hashes = {}
+        self.objects = {}
+
+    # Should be called for every new test in the directory of the test
+    def reset(self):
+        headers = b""
+        for f in gen_test_makefile.headers.value.split():
+            if os.path.isfile(f):
+                with open(f, "rb") as header:
+                    headers += header.read()
+        self.sources_hashes = {}
+        for f in gen_test_makefile.sources.value.split():
+            if os.path.isfile(f):
+                with open(f, "rb") as source:
+                    self.sources_hashes[f] = hashlib.sha256(source.read() + headers).hexdigest()
+        self.objects = {}
+
+    def get_key(self, target, source):
+        key = "|".join([self.sources_hashes.get(source, ""), str(target.specs.version),
+                        gen_test_makefile.get_compile_cmd(target, source)])
+        return hashlib.sha256(key.encode("utf-8")).hexdigest()
+
+    def get_cached_obj(self, key):
+        cached_obj = self.objects.get(key)
+        if cached_obj is None and self.cache_dir is not None:
+            cached_obj = os.path.join(self.cache_dir, key + ".o")
+        if cached_obj is None or not os.path.isfile(cached_obj):
+            return None
+        return cached_obj
+
+    # Copy cached object to obj_file. Returns True on success.
+    def fetch(self, target, source, obj_file):
+        if source not in self.sources_hashes:
+            return False
+        cached_obj = self.get_cached_obj(self.get_key(target, source))
+        if cached_obj is None:
+            return False
+        if os.path.abspath(cached_obj) != os.path.abspath(obj_file):
+            shutil.copy(cached_obj, obj_file)
+        common.log_msg(logging.DEBUG, "Reusing " + cached_obj + " as " + obj_file)
+        return True
+
+    def store(self, target, source, obj_file):
+        key = self.get_key(target, source)
+        if source not in self.sources_hashes or key in self.objects or not os.path.isfile(obj_file):
+            return
+        self.objects[key] = os.path.abspath(obj_file)
+        if self.cache_dir is not None:
+            # Other processes may read the cache, so the object is written atomically
+            cached_obj = os.path.join(self.cache_dir, key + ".o")
+            tmp_obj = cached_obj + "." + str(os.getpid())
+            shutil.copy(obj_file, tmp_obj)
+            os.replace(tmp_obj, cached_obj)
+            self.objects[key] = cached_obj
+# End of ObjectCache class
+
 # class representing the result of running a single opt-set for the test
 class TestRun(object):
     # opt-set
@@ -850,10 +968,27 @@ class TestRun(object):
         self.blame_result = "was not run"
         self.parse_stats = parse_stats
 
+    # Object file that Test_Makefile builds from the source for the opt-set
+    def get_obj_file(self, source):
+        return self.optset + "_" + source.split(".")[0] + ".o"
+
+    # Sources whose objects can be taken from the cache. Statistics are dumped while
+    # func is compiled, so it has to be compiled for the targets that collect them.
+    def get_cacheable_sources(self):
+        return [source for source in gen_test_makefile.sources.value.split()
+                if not (self.parse_stats and source.split(".")[0] == "func")]
+
     # Build test
-    def build(self):
+    def build(self, obj_cache=None):
         # build
         build_params_list = ["make", "-f", gen_test_makefile.Test_Makefile_name, self.optset]
+        # Reuse the objects that were already compiled with the same command.
+        # "-o" tells make to treat the file as up to date.
+        if obj_cache is not None:
+            for source in self.get_cacheable_sources():
+                obj_file = self.get_obj_file(source)
+                if obj_cache.fetch(self.target, source, obj_file):
+                    build_params_list[3:3] = ["-o", obj_file]
         self.build_cmd = " ".join(str(p) for p in build_params_list)
         self.build_ret_code, self.build_stdout, self.build_stderr, self.is_build_time_expired, self.build_elapsed_time = \
             common.run_cmd(build_params_list, compiler_timeout, self.proc_num, compiler_mem_limit)
@@ -866,6 +1001,9 @@ class TestRun(object):
             self.status = self.STATUS_compfail
         else:
             self.status = self.STATUS_not_run
+            if obj_cache is not None:
+                for source in self.get_cacheable_sources():
+                    obj_cache.store(self.target, source, self.get_obj_file(source))
 
         # parse stats if needed
         if self.parse_stats and os.path.isfile("func.stats"):
@@ -1595,66 +1733,108 @@ def prepare_env_and_start_testing(out_dir, timeout, targets, num_jobs, config_fi
     sys.stdout.flush()
 
 
+# Number of test directories of a worker. One test is built and run, the next one waits
+# in the queue and one more is being generated.
+pipeline_depth = 3
+
+
+# Generation stage of the worker. Tests are generated in the background, so generation
+# overlaps with the builds and runs of the previous test. None marks the end of the tests.
+def generate_tests(num, makefile, end_time, task_queue, stat, blame, creduce_makefile, work_dir, test_queue):
+    inf = (end_time == -1) or not (task_queue is None)
+    test_num = 0
+    try:
+        while inf or end_time > time.time():
+            # Fetch next seed if seeds were specified
+            seed = ""
+            if task_queue is not None:
+                # Python multiprocessing queue may raise empty exception
+                # even for non empty queue, so do several attempts to not loos workers.
+                for i in range(3):
+                    try:
+                        seed = task_queue.get_nowait()
+                    except queue.Empty:
+                        time.sleep(1/(num+1))
+                        seed = "done"
+                    else:
+                        break
+                if seed == "done":
+                    break
+
+            # Cleanup before start
+            test_dir = os.path.join(work_dir, "test_" + str(test_num % pipeline_depth))
+            test_num += 1
+            common.check_dir_and_create(test_dir)
+            common.clean_dir(test_dir)
+            common.check_and_copy(makefile, test_dir)
+
+            # Generate the test.
+            # TODO: maybe, it is better to call generator through Makefile?
+            test_queue.put(Test(stat=stat, path=test_dir, seed=seed, proc_num=num, blame=blame,
+                                creduce_makefile=creduce_makefile))
+    finally:
+        test_queue.put(None)
+
+
 def gen_and_test(num, makefile, lock, end_time, task_queue, stat, targets, blame, creduce_makefile, stat_targets):
     common.log_msg(logging.DEBUG, "Job #" + str(num))
+    # Tests are saved from their own directories, which are nested in the worker's directory
+    global res_dir
+    res_dir = os.path.abspath(res_dir)
     os.chdir(process_dir + str(num))
     work_dir = os.getcwd()
-    inf = (end_time == -1) or not (task_queue is None)
-
-    while inf or end_time > time.time():
-        # Fetch next seed if seeds were specified
-        seed = ""
-        if task_queue is not None:
-            # Python multiprocessing queue may raise empty exception
-            # even for non empty queue, so do several attempts to not loos workers.
-            for i in range(3):
-                try:
-                    seed = task_queue.get_nowait()
-                except queue.Empty:
-                    time.sleep(1/(num+1))
-                    seed = "done"
-                else:
-                    break
-            if seed == "done":
+    obj_cache = ObjectCache()
+
+    # The queue holds at most one test, so the generator doesn't reuse the directory
+    # of a test that is still being processed
+    test_queue = queue.Queue(maxsize=1)
+    generator = threading.Thread(target=generate_tests,
+                                 args=(num, makefile, end_time, task_queue, stat, blame, creduce_makefile,
+                                       work_dir, test_queue),
+                                 daemon=True)
+    generator.start()
+
+    # Opt-sets are built one by one, while the built ones are executed in the background,
+    # so compilation of the next opt-set overlaps with the run of the previous one.
+    with concurrent.futures.ThreadPoolExecutor(max_workers=1) as runner:
+        while True:
+            test = test_queue.get()
+            if test is None:
                 break
+            os.chdir(test.path)
+            if not test.is_ok():
+                test.save(lock)
+                continue
 
-        # Cleanup before start
-        if os.getcwd() != work_dir:
-            raise
-        common.clean_dir(".")
-        common.check_and_copy(makefile, work_dir)
-
-        # Generate the test.
-        # TODO: maybe, it is better to call generator through Makefile?
-        test = Test(stat=stat, seed=seed, proc_num=num, blame=blame,
-                    creduce_makefile=creduce_makefile)
-        if not test.is_ok():
-            test.save(lock)
-            continue
+            # Run all required opt-sets.
+            obj_cache.reset()
+            built_runs = []
+            for t in gen_test_makefile.CompilerTarget.all_targets:
+                # Skip the target we are not supposed to run.
+                if t.specs.name not in targets.split():
+                    continue
 
-        # Run all required opt-sets.
-        out_res = set()
-        prev_out_res_len = 1  # We can't check first result
-        for t in gen_test_makefile.CompilerTarget.all_targets:
-            # Skip the target we are not supposed to run.
-            if t.specs.name not in targets.split():
-                continue
-            target_elapsed_time = 0.0
+                test_run = TestRun(test=test, stat=stat, target=t, proc_num=num,
+                                   parse_stats= True if (t.name in stat_targets) else False)
+                if not test_run.build(obj_cache):
+                    test.add_fail_run(test_run)
+                    continue
 
-            test_run = TestRun(test=test, stat=stat, target=t, proc_num=num,
-                               parse_stats= True if (t.name in stat_targets) else False)
-            if not test_run.build():
-                test.add_fail_run(test_run)
-                continue
+                built_runs.append((test_run, runner.submit(test_run.run)))
 
-            if not test_run.run():
-                test.add_fail_run(test_run)
-                continue
+            # Collect results in the order of opt-sets
+            for test_run, is_run_ok in built_runs:
+                if not is_run_ok.result():
+                    test.add_fail_run(test_run)
+                    continue
+
+                test.add_success_run(test_run)
 
-            test.add_success_run(test_run)
+            # Done with running tests, now verify the results.
+            test.handle_results(lock)
 
-        # Done with running tests, now verify the results.
-        test.handle_results(lock)
+    generator.join()
+    os.chdir(work_dir)
 
     # Here we are done with this worker. Make a log entry and leave a marker in work dir.
     common.log_msg(logging.DEBUG, "Process " + str(num) + " is done working.")
@@ -1672,7 +1852,7 @@ def gen_and_test(num, makefile, lock, end_time, task_queue, stat, targets, blame
 # - gen_fail/S_20161230_22_30
 # return dir name
 def save_test(lock, file_list, compiler_name=None, fail_type=None, classification=None, test_name=None):
-    dest = ".." + os.sep + res_dir + \
+    dest = res_dir + \
                   ((os.sep + compiler_name) if (compiler_name is not None) else "") + \
                   ((os.sep + fail_type) if (fail_type is not None) else os.sep + "script_problem") + \
                   ((os.sep + classification) if (classification is not None) else "") + \
@@ -1748,6 +1928,9 @@ Use specified folder for testing
                              "File comments may start with #")
     parser.add_argument("--blame", dest="blame", default=False, action="store_true",
                         help="Enable optimization triagging for failing tests for supported compilers")
+    parser.add_argument("--blame-jobs", dest="blame_jobs", default=0, type=int,
+                        help="Number of opt-bisect points checked in parallel during triagging. "
+                             "By default cores are evenly split between jobs")
     parser.add_argument("--creduce", dest="creduce", nargs='?', const=4, type=int, default=False,
                         help="Enable test reduction using CReduce tool. When given a number, "
                              "it's used as a number of creduce processes run for a single reduction (default is 4)")
@@ -1755,6 +1938,9 @@ Use specified folder for testing
                         help="Do not run tmp_cleaner.sh script during the run")
     parser.add_argument("--collect-stat", dest="collect_stat", default="", type=str,
                         help="List of testing sets for statistics collection")
+    parser.add_argument("--unity-size", dest="unity_size", default=1, type=int,
+                        help="Number of tests that are bundled into a single unity build to save "
+                             "compiler start-up time. Miscompares are still reported for each test")
     parser.add_argument("--ignore-comp-time-exp", dest="ignore_comp_time_exp", default=True, action="store_true",
                         help="Don't save files (except log-file) when compile time expires")
     args = parser.parse_args()
@@ -1780,6 +1966,11 @@ Use specified folder for testing
     gen_test_makefile.set_standard()
 
     Test.ignore_comp_time_exp = args.ignore_comp_time_exp
+    if args.unity_size < 1:
+        common.print_and_exit("Unity size should be positive")
+    unity_size = args.unity_size
+    blame_opt.probe_num = args.blame_jobs if args.blame_jobs > 0 else \
+                          max(1, multiprocessing.cpu_count() // max(1, args.num_jobs))
     prepare_env_and_start_testing(os.path.abspath(args.out_dir), args.timeout, args.target, args.num_jobs,
                                   args.config_file, args.seeds_option_value, args.blame, args.creduce,
                                   args.no_tmp_cleaner, args.collect_stat)
@@ -0,0 +1,150 @@
+/*
+Copyright (c) 2020, Intel Corporation
+Copyright (c) 2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "options.h"
+#include "program.h"
+#include "yarpgen.h"
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace yarpgen;
+
+#define CHECK(cond, msg)                                                       \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            std::cerr << "ERROR at " << __FILE__ << ":" << __LINE__            \
+                      << ", function " << __func__ << "():\n    " << (msg)     \
+                      << std::endl;                                            \
+            abort();                                                           \
+        }                                                                      \
+    } while (false)
+
+// The invocation is a part of the options dump, and it is known only to the
+// command line interface
+static std::string dropInvocation(const std::string &text) {
+    std::istringstream in(text);
+    std::string ret;
+    std::string line;
+    while (std::getline(in, line))
+        if (line.compare(0, 11, "Invocation:") != 0)
+            ret += line + "\n";
+    return ret;
+}
+
+using Files = std::map<std::string, std::string>;
+
+// Generates the test the same way as main() does for a single seed. The test
+// goes to stdout as a bundle, which is captured and split into files.
+static Files generateWithCLI(std::vector<std::string> args) {
+    args.insert(args.begin(), "yarpgen");
+    args.emplace_back("--out-mode=stdout");
+    std::vector<char *> argv;
+    for (auto &arg : args)
+        argv.push_back(&arg[0]);
+    OptionParser::initOptions();
+    OptionParser::parse(argv.size(), argv.data());
+    CHECK(Options::getInstance().getConflict().empty(), "CLI conflict");
+    initRandGen(Options::getInstance().getSeed());
+
+    std::ostringstream bundle;
+    std::streambuf *cout_buf = std::cout.rdbuf(bundle.rdbuf());
+    ProgramGenerator new_program;
+    new_program.emit();
+    std::cout.rdbuf(cout_buf);
+
+    // Every file starts with a "/*FILE <name> <size>*/" line
+    Files ret;
+    std::string text = bundle.str();
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t line_end = text.find('\n', pos);
+        CHECK(text.compare(pos, 7, "/*FILE ") == 0 &&
+                  line_end != std::string::npos,
+              "Bundle header");
+        std::istringstream header(text.substr(pos + 7, line_end - pos - 7));
+        std::string file_name;
+        size_t size = 0;
+        header >> file_name >> size;
+        CHECK(line_end + 1 + size <= text.size(), "Bundle file size");
+        ret[file_name] = dropInvocation(text.substr(line_end + 1, size));
+        pos = line_end + 1 + size;
+    }
+    return ret;
+}
+
+void cliMatchTest() {
+    for (uint64_t seed = 1; seed <= 3; ++seed) {
+        Files files = generateWithCLI({"--seed=" + std::to_string(seed)});
+        GeneratedProgram program = generate(GenConfig(), seed);
+        CHECK(program.error.empty(), "Default config");
+        CHECK(program.seed == seed, "Seed");
+        CHECK(!program.has_expected_hash, "Expected hash for hash check");
+        CHECK(dropInvocation(program.init_h) == files["init.h"], "init.h");
+        CHECK(dropInvocation(program.func) == files[program.func_file_name],
+              "Func file");
+        CHECK(dropInvocation(program.driver) ==
+                  files[program.driver_file_name],
+              "Driver file");
+    }
+
+    GenConfig config;
+    config.std = LangStd::C;
+    config.check_algo = CheckAlgo::PRECOMPUTE;
+    for (uint64_t seed = 1; seed <= 3; ++seed) {
+        Files files = generateWithCLI({"--seed=" + std::to_string(seed),
+                                       "--std=c", "--check-algo=precompute"});
+        GeneratedProgram program = generate(config, seed);
+        CHECK(program.error.empty(), "Precompute config");
+        CHECK(program.func_file_name == "func.c", "C func file name");
+        CHECK(dropInvocation(program.func) == files[program.func_file_name],
+              "Precompute func file");
+        const std::string &driver = files[program.driver_file_name];
+        CHECK(dropInvocation(program.driver) == driver,
+              "Precompute driver file");
+        CHECK(program.has_expected_hash, "No expected hash for precompute");
+        CHECK(driver.find("if (seed != " +
+                          std::to_string(program.expected_hash) + "ULL)") !=
+                  std::string::npos,
+              "Expected hash isn't checked in the driver");
+    }
+}
+
+void conflictTest() {
+    GenConfig config;
+    config.std = LangStd::SYCL;
+    config.fork_server = true;
+    GeneratedProgram program = generate(config, 1);
+    CHECK(!program.error.empty(), "Fork server for SYCL");
+    CHECK(program.func.empty() && program.driver.empty(),
+          "Test with conflicting options");
+
+    config.fork_server = false;
+    program = generate(config, 1);
+    CHECK(program.error.empty(), "SYCL config");
+    CHECK(!program.driver.empty(), "SYCL driver");
+}
+
+int main() {
+    cliMatchTest();
+    conflictTest();
+}
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2019-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "arena.h"
+#include "utils.h"
+#include <cassert>
+
+using namespace yarpgen;
+
+const size_t Arena::CHUNK_SIZE;
+
+Arena::~Arena() {
+    assert(live_allocs == 0 && "IR nodes can't outlive the arena");
+}
+
+void *Arena::allocate(size_t size, size_t align) {
+    if (align > ALIGNMENT)
+        ERROR("Over-aligned objects can't be allocated in the arena");
+
+    size_t size_class = getSizeClass(size);
+    size = size_class * ALIGNMENT;
+    if (size_class <= MAX_FREE_LIST_CLASS && free_lists[size_class]) {
+        FreeBlock *block = free_lists[size_class];
+        free_lists[size_class] = block->next;
+        return countAlloc(block);
+    }
+
+    while (cur_chunk < chunks.size()) {
+        if (cur_offset + size <= chunks[cur_chunk].size) {
+            void *ret = chunks[cur_chunk].mem.get() + cur_offset;
+            cur_offset += size;
+            return countAlloc(ret);
+        }
+        cur_chunk++;
+        cur_offset = 0;
+    }
+
+    // Chunks are allocated with new[], so they are aligned well enough for
+    // any IR node. Large objects get a chunk of their own.
+    size_t chunk_size = std::max(CHUNK_SIZE, size);
+    chunks.push_back(
+        {std::unique_ptr<char[]>(new char[chunk_size]), chunk_size});
+    cur_chunk = chunks.size() - 1;
+    cur_offset = size;
+    return countAlloc(chunks.back().mem.get());
+}
+
+void Arena::deallocate(void *ptr, size_t size) {
+    if (--live_allocs == 0) {
+        rewind();
+        return;
+    }
+
+    size_t size_class = getSizeClass(size);
+    if (size_class <= MAX_FREE_LIST_CLASS) {
+        auto block = static_cast<FreeBlock *>(ptr);
+        block->next = free_lists[size_class];
+        free_lists[size_class] = block;
+    }
+}
+
+void Arena::rewind() {
+    cur_chunk = 0;
+    cur_offset = 0;
+    std::fill(free_lists.begin(), free_lists.end(), nullptr);
+}
+
+size_t Arena::getReservedBytes() {
+    size_t ret = 0;
+    for (const auto &chunk : chunks)
+        ret += chunk.size;
+    return ret;
+}
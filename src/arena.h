@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2019-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "statistics.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace yarpgen {
+
+// Bump-pointer allocator that owns IR nodes of a test program.
+// Each node goes into a shared memory chunk instead of a separate malloc call.
+// Small blocks that die during the generation (e.g. temporary values and
+// rejected expressions) are put into per-size free lists and reused. When the
+// last node dies (i.e. the program is destroyed), the whole arena is rewound
+// in one step and its chunks are reused for the next test.
+// Every generation thread has its own arena, so IR nodes have to be destroyed
+// by the same thread that created them.
+// The arena only replaces the backing memory: edges between the nodes are
+// still std::shared_ptr. Most of the nodes are temporaries of evaluate() and
+// rebuild() (up to 10x of the final IR on large tests), so they have to be
+// freed one by one to keep the peak memory low.
+class Arena {
+  public:
+    static Arena &getInstance() {
+        static thread_local Arena instance;
+        return instance;
+    }
+    Arena(const Arena &arena) = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena();
+
+    void *allocate(size_t size, size_t align);
+    void deallocate(void *ptr, size_t size);
+
+    size_t getLiveAllocs() { return live_allocs; }
+    size_t getPeakLiveAllocs() { return peak_live_allocs; }
+    void resetPeakLiveAllocs() { peak_live_allocs = live_allocs; }
+    // Number of allocations since the thread has started
+    size_t getTotalAllocs() { return total_allocs; }
+    size_t getReservedBytes();
+
+  private:
+    Arena()
+        : cur_chunk(0), cur_offset(0), live_allocs(0), peak_live_allocs(0),
+          total_allocs(0), free_lists(MAX_FREE_LIST_CLASS + 1, nullptr) {}
+    void *countAlloc(void *ptr) {
+        live_allocs++;
+        peak_live_allocs = std::max(peak_live_allocs, live_allocs);
+        total_allocs++;
+        return ptr;
+    }
+    void rewind();
+
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    // All blocks have the same alignment, so they can be reused for any node
+    static const size_t ALIGNMENT = alignof(std::max_align_t);
+    // Blocks larger than that are not recycled until the arena is rewound
+    static const size_t MAX_FREE_LIST_CLASS = 64;
+    static size_t getSizeClass(size_t size) {
+        return (size + ALIGNMENT - 1) / ALIGNMENT;
+    }
+
+    struct Chunk {
+        std::unique_ptr<char[]> mem;
+        size_t size;
+    };
+    std::vector<Chunk> chunks;
+    size_t cur_chunk;
+    size_t cur_offset;
+    size_t live_allocs;
+    size_t peak_live_allocs;
+    size_t total_allocs;
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+    std::vector<FreeBlock *> free_lists;
+};
+
+// Allocator adaptor that is used to put IR nodes (together with their
+// reference counters) into the arena
+template <typename T> class ArenaAllocator {
+  public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena &_arena) : arena(&_arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T *ptr, size_t n) { arena->deallocate(ptr, n * sizeof(T)); }
+
+    template <typename U> bool operator==(const ArenaAllocator<U> &other) {
+        return arena == other.arena;
+    }
+    template <typename U> bool operator!=(const ArenaAllocator<U> &other) {
+        return arena != other.arena;
+    }
+
+  private:
+    template <typename U> friend class ArenaAllocator;
+    Arena *arena;
+};
+
+// Replacement for std::make_shared that should be used for all IR nodes
+template <typename T, typename... Args>
+std::shared_ptr<T> makeIRNode(Args &&... args) {
+    using NodeType = Statistics::IRNodeType<T>;
+    auto ret = std::allocate_shared<NodeType>(
+        ArenaAllocator<NodeType>(Arena::getInstance()),
+        std::forward<Args>(args)...);
+    Statistics::getInstance().addIRNode(ret.get());
+    return ret;
+}
+
+} // namespace yarpgen
@@ -24,18 +24,22 @@ using namespace yarpgen;
 
 PopulateCtx::PopulateCtx(std::shared_ptr<PopulateCtx> _par_ctx)
     : par_ctx(std::move(_par_ctx)), ext_inp_sym_tbl(par_ctx->ext_inp_sym_tbl),
-      ext_out_sym_tbl(par_ctx->ext_out_sym_tbl), arith_depth(0), taken(true),
-      inside_omp_simd(false) {
-    local_sym_tbl = std::make_shared<SymbolTable>();
+      ext_out_sym_tbl(par_ctx->ext_out_sym_tbl), arith_depth(0),
+      taken(LaneMask().set()), lane_invariant(false), inside_omp_simd(false) {
+    // Nested contexts share the local symbol table with the parent. The loops
+    // add their iterators on entry and remove them on exit, so the table
+    // always holds exactly the iterators that are visible in the scope.
     if (par_ctx.use_count() != 0) {
-        local_sym_tbl =
-            std::make_shared<SymbolTable>(*(par_ctx->getLocalSymTable()));
+        local_sym_tbl = par_ctx->getLocalSymTable();
         loop_depth = par_ctx->getLoopDepth();
         arith_depth = par_ctx->getArithDepth();
-        taken = par_ctx->isTaken();
+        taken = par_ctx->taken;
+        lane_invariant = par_ctx->lane_invariant;
         inside_omp_simd = par_ctx->inside_omp_simd;
         dims = par_ctx->dims;
     }
+    else
+        local_sym_tbl = std::make_shared<SymbolTable>();
 }
 
 PopulateCtx::PopulateCtx() {
@@ -44,10 +48,36 @@ PopulateCtx::PopulateCtx() {
     ext_inp_sym_tbl = std::make_shared<SymbolTable>();
     ext_out_sym_tbl = std::make_shared<SymbolTable>();
     arith_depth = 0;
-    taken = true;
+    taken.set();
+    lane_invariant = false;
     inside_omp_simd = false;
 }
 
+size_t PopulateCtx::getTripCount() {
+    const auto &iters = local_sym_tbl->getIters();
+    if (iters.empty())
+        return 1;
+
+    // The last iterator controls the trip count of the loop
+    auto iter = iters.back().back();
+    auto get_val = [](const std::shared_ptr<Expr> &expr) -> uint64_t {
+        EvalCtx eval_ctx;
+        auto eval_res = expr->evaluate(eval_ctx);
+        assert(eval_res->isScalarVar() &&
+               "Iterator should have a scalar value");
+        return std::static_pointer_cast<ScalarVar>(eval_res)
+            ->getCurrentValue()
+            .castToType(IntTypeID::ULLONG)
+            .getValueRef<uint64_t>();
+    };
+    uint64_t start = get_val(iter->getStart());
+    uint64_t end = get_val(iter->getEnd());
+    uint64_t step = get_val(iter->getStep());
+    if (end <= start || step == 0)
+        return 0;
+    return (end - start + step - 1) / step;
+}
+
 void SymbolTable::addArray(std::shared_ptr<Array> array) {
     arrays.push_back(array);
     assert(array->getType()->isArrayType() &&
@@ -56,10 +86,11 @@ void SymbolTable::addArray(std::shared_ptr<Array> array) {
     array_dim_map[array_type->getDimensions().size()].push_back(array);
 }
 
-std::vector<std::shared_ptr<Array>>
-SymbolTable::getArraysWithDimNum(size_t dim) {
+const std::vector<std::shared_ptr<Array>> &
+SymbolTable::getArraysWithDimNum(size_t dim) const {
+    static const std::vector<std::shared_ptr<Array>> empty_res;
     auto find_res = array_dim_map.find(dim);
     if (find_res != array_dim_map.end())
         return find_res->second;
-    return {};
+    return empty_res;
 }
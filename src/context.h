@@ -35,9 +35,15 @@ namespace yarpgen {
 // values.
 class EvalCtx {
   public:
+    EvalCtx() : lane(0), lanes_num(1) {}
     // TODO: we use string as a unique identifier and it is not a right way to
     // do it
     std::map<std::string, DataType> input;
+    // Lane of the innermost loop that we evaluate
+    size_t lane;
+    // Number of lanes that the evaluated expressions depend on. Reads from
+    // the arrays with clusters raise it.
+    size_t lanes_num;
 };
 
 class GenCtx {
@@ -70,19 +76,29 @@ class GenCtx {
     bool inside_foreach;
 };
 
+// Getters return references to the internal containers, so they stay valid
+// only until the next modification of the table.
 class SymbolTable {
   public:
     void addVar(std::shared_ptr<ScalarVar> var) { vars.push_back(var); }
     void addArray(std::shared_ptr<Array> array);
+    // Iterators of the nested loops form a stack of scopes. Each scope has to
+    // be removed by the loop that added it.
     void addIters(std::vector<std::shared_ptr<Iterator>> iter) {
-        iters.push_back(iter);
+        iters.push_back(std::move(iter));
     }
     void deleteLastIters() { iters.pop_back(); }
 
-    std::vector<std::shared_ptr<ScalarVar>> getVars() { return vars; }
-    std::vector<std::shared_ptr<Array>> getArrays() { return arrays; }
-    std::vector<std::shared_ptr<Array>> getArraysWithDimNum(size_t dim);
-    std::vector<std::vector<std::shared_ptr<Iterator>>> getIters() {
+    const std::vector<std::shared_ptr<ScalarVar>> &getVars() const {
+        return vars;
+    }
+    const std::vector<std::shared_ptr<Array>> &getArrays() const {
+        return arrays;
+    }
+    const std::vector<std::shared_ptr<Array>> &
+    getArraysWithDimNum(size_t dim) const;
+    const std::vector<std::vector<std::shared_ptr<Iterator>>> &
+    getIters() const {
         return iters;
     }
 
@@ -90,7 +106,8 @@ class SymbolTable {
         avail_vars.push_back(var);
     }
 
-    std::vector<std::shared_ptr<ScalarVarUseExpr>> getAvailVars() {
+    const std::vector<std::shared_ptr<ScalarVarUseExpr>> &
+    getAvailVars() const {
         return avail_vars;
     }
 
@@ -123,14 +140,26 @@ class PopulateCtx : public GenCtx {
     void incArithDepth() { arith_depth++; }
     void decArithDepth() { arith_depth--; }
 
-    bool isTaken() { return taken; }
-    void setTaken(bool _taken) { taken = _taken; }
+    bool isTaken() { return taken.any(); }
+    void setTaken(bool _taken) {
+        taken = _taken ? LaneMask().set() : LaneMask();
+    }
+    const LaneMask &getTakenLanes() { return taken; }
+    void setTakenLanes(const LaneMask &_taken) { taken = _taken; }
+    // Number of iterations of the innermost loop (the code outside of the
+    // loops is executed once)
+    size_t getTripCount();
+
+    // Expressions that we create have to have the same value in all lanes
+    // (e.g. loop parameters), so they can't read arrays with clusters
+    bool isLaneInvariant() { return lane_invariant; }
+    void setLaneInvariant(bool val) { lane_invariant = val; }
 
     void setInsideOMPSimd(bool val) { inside_omp_simd = val; }
     bool isInsideOMPSimd() { return inside_omp_simd; }
 
     void addDimension(size_t dim) { dims.push_back(dim); }
-    std::vector<size_t> getDimensions() { return dims; }
+    const std::vector<size_t> &getDimensions() const { return dims; }
     void deleteLastDim() { dims.pop_back(); }
 
   private:
@@ -139,8 +168,9 @@ class PopulateCtx : public GenCtx {
     std::shared_ptr<SymbolTable> ext_out_sym_tbl;
     std::shared_ptr<SymbolTable> local_sym_tbl;
     size_t arith_depth;
-    // If the test will actually execute the code
-    bool taken;
+    // Lanes of the innermost loop that will actually execute the code
+    LaneMask taken;
+    bool lane_invariant;
 
     // As of now, the pragma omp simd is attached to a loop and can't be nested.
     // TODO: we need to think about pragma omp ordered simd
@@ -20,6 +20,7 @@ limitations under the License.
 #include "data.h"
 #include "context.h"
 #include "expr.h"
+#include "statistics.h"
 
 #include <utility>
 
@@ -40,7 +41,7 @@ std::shared_ptr<ScalarVar> ScalarVar::create(std::shared_ptr<PopulateCtx> ctx) {
     IRValue init_val = rand_val_gen->getRandValue(type_id);
     auto int_type = IntegralType::init(type_id);
     NameHandler &nh = NameHandler::getInstance();
-    return std::make_shared<ScalarVar>(nh.getVarName(), int_type, init_val);
+    return makeIRNode<ScalarVar>(nh.getVarName(), int_type, init_val);
 }
 
 std::string ScalarVar::getName(std::shared_ptr<EmitCtx> ctx) {
@@ -60,11 +61,17 @@ void Array::dbgDump() {
     std::cout << "Array: " << name << std::endl;
     std::cout << "Type info:" << std::endl;
     type->dbgDump();
-    std::cout << "Init val: " << init_vals << std::endl;
+    std::cout << "Init val: [";
+    for (auto &val : init_vals)
+        std::cout << val << ", ";
+    std::cout << "]" << std::endl;
     std::cout << "Cur val: [";
     for (const auto &i : std::get<1>(cur_vals))
         std::cout << i << ", ";
-    std::cout << "] : " << std::get<0>(cur_vals) << std::endl;
+    std::cout << "] : [";
+    for (auto &val : std::get<0>(cur_vals))
+        std::cout << val << ", ";
+    std::cout << "]" << std::endl;
     std::cout << "Steps: ";
     for (const auto &i : std::get<2>(cur_vals))
         std::cout << i << " ";
@@ -74,25 +81,48 @@ void Array::dbgDump() {
 
 Array::Array(std::string _name, const std::shared_ptr<ArrayType> &_type,
              IRValue _val)
-    : Data(std::move(_name), _type), init_vals(_val) {
+    : Array(std::move(_name), _type, std::vector<IRValue>{_val}) {}
+
+Array::Array(std::string _name, const std::shared_ptr<ArrayType> &_type,
+             std::vector<IRValue> _init_vals)
+    : Data(std::move(_name), _type), init_vals(std::move(_init_vals)) {
     if (!type->isArrayType())
         ERROR("Array variable should have an ArrayType");
+    if (init_vals.empty() || LANES_NUM % init_vals.size() != 0)
+        ERROR("Size of the array cluster should divide the number of lanes");
 
     auto array_type = std::static_pointer_cast<ArrayType>(type);
+    // Every element is a lane of a loop with a unit step
     cur_vals = std::make_tuple(
-        _val, array_type->getDimensions(),
+        init_vals, array_type->getDimensions(),
         std::vector<size_t>(array_type->getDimensions().size(), 1));
     if (!array_type->getBaseType()->isIntType())
         ERROR("Only integer types are supported by now");
-    if (std::static_pointer_cast<IntegralType>(array_type->getBaseType())
-            ->getIntTypeId() != _val.getIntTypeID())
-        ERROR("Array initialization value should have the same type as array");
+    auto base_type_id =
+        std::static_pointer_cast<IntegralType>(array_type->getBaseType())
+            ->getIntTypeId();
+    for (auto &val : init_vals)
+        if (val.getIntTypeID() != base_type_id)
+            ERROR("Array initialization value should have the same type as "
+                  "array");
+
+    ub_code = init_vals.front().getUBCode();
+}
 
-    ub_code = init_vals.getUBCode();
+const IRValue &Array::getCurrentValue(size_t idx) {
+    const auto &vals = std::get<0>(cur_vals);
+    if (vals.size() == 1)
+        return vals.front();
+    return vals[idx / std::get<2>(cur_vals).back() % vals.size()];
 }
 
 void Array::setValue(IRValue _val, std::deque<size_t> &span,
                      std::deque<size_t> &steps) {
+    setValue(std::vector<IRValue>{_val}, LaneMask().set(), span, steps);
+}
+
+void Array::setValue(const std::vector<IRValue> &_vals, const LaneMask &taken,
+                     std::deque<size_t> &span, std::deque<size_t> &steps) {
     /*
     auto array_type = std::static_pointer_cast<ArrayType>(type);
     if (array_type->getBaseType() != _val->getType())
@@ -103,10 +133,21 @@ void Array::setValue(IRValue _val, std::deque<size_t> &span,
     if (span.size() != arr_type->getDimensions().size() ||
         steps.size() != arr_type->getDimensions().size())
         ERROR("Span and steps should have same size as array type");
+    if (_vals.empty() || LANES_NUM % _vals.size() != 0)
+        ERROR("Number of values should divide the number of lanes");
     std::vector<size_t> span_vec(span.begin(), span.end());
     std::vector<size_t> steps_vec(steps.begin(), steps.end());
-    cur_vals = std::make_tuple(_val, span_vec, steps_vec);
-    ub_code = std::get<0>(cur_vals).getUBCode();
+    std::vector<IRValue> vals = _vals;
+    if (!taken.all()) {
+        // Elements of lane i have innermost indices (k * LANES_NUM + i) * step,
+        // so all of them have the same initial value
+        vals.clear();
+        for (size_t i = 0; i < LANES_NUM; ++i)
+            vals.push_back(taken[i] ? _vals[i % _vals.size()]
+                                    : getInitValue(i * steps.back()));
+    }
+    cur_vals = std::make_tuple(std::move(vals), span_vec, steps_vec);
+    ub_code = std::get<0>(cur_vals).front().getUBCode();
 }
 
 std::shared_ptr<Array> Array::create(std::shared_ptr<PopulateCtx> ctx,
@@ -116,10 +157,21 @@ std::shared_ptr<Array> Array::create(std::shared_ptr<PopulateCtx> ctx,
     if (!base_type->isIntType())
         ERROR("We support only array of integers for now");
     auto int_type = std::static_pointer_cast<IntegralType>(base_type);
-    IRValue init_val = rand_val_gen->getRandValue(int_type->getIntTypeId());
+    std::vector<IRValue> init_vals = {
+        rand_val_gen->getRandValue(int_type->getIntTypeId())};
+    // ISPC reductions combine the lanes of a gang, so the values that
+    // they get depend on the gang size
+    Options &options = Options::getInstance();
+    if (options.getArrClusters() && !options.isISPC()) {
+        size_t cluster_size = rand_val_gen->getRandId(
+            ctx->getGenPolicy()->arr_cluster_size_distr);
+        while (init_vals.size() < cluster_size)
+            init_vals.push_back(
+                rand_val_gen->getRandValue(int_type->getIntTypeId()));
+    }
     NameHandler &nh = NameHandler::getInstance();
     auto new_array =
-        std::make_shared<Array>(nh.getArrayName(), array_type, init_val);
+        makeIRNode<Array>(nh.getArrayName(), array_type, std::move(init_vals));
     return new_array;
 }
 
@@ -139,12 +191,18 @@ std::shared_ptr<Iterator> Iterator::create(std::shared_ptr<PopulateCtx> ctx,
     auto gen_pol = ctx->getGenPolicy();
 
     IntTypeID type_id = rand_val_gen->getRandId(gen_pol->int_type_distr);
+    // Performance workloads need the whole trip count, so narrow types that
+    // would cut it are replaced
+    if (Options::getInstance().isPerfWorkload() &&
+        IntegralType::init(type_id)->getMax().getAbsValue().value <
+            ctx->getDimensions().back())
+        type_id = IntTypeID::INT;
     std::shared_ptr<Type> type = IntegralType::init(type_id);
     if (!is_uniform)
         type = type->makeVarying();
     auto int_type = std::static_pointer_cast<IntegralType>(type);
 
-    auto start = std::make_shared<ConstantExpr>(IRValue{type_id, {false, 0}});
+    auto start = makeIRNode<ConstantExpr>(IRValue{type_id, {false, 0}});
 
     size_t end_val = ctx->getDimensions().back();
     // We can't go pass the maximal value of the type
@@ -155,8 +213,7 @@ std::shared_ptr<Iterator> Iterator::create(std::shared_ptr<PopulateCtx> ctx,
     // array boundaries
     if (!is_uniform)
         end_val = (end_val / 64) * 64;
-    auto end =
-        std::make_shared<ConstantExpr>(IRValue(type_id, {false, end_val}));
+    auto end = makeIRNode<ConstantExpr>(IRValue(type_id, {false, end_val}));
 
     size_t step_val = rand_val_gen->getRandId(gen_pol->iters_step_distr);
     if (!is_uniform)
@@ -166,12 +223,11 @@ std::shared_ptr<Iterator> Iterator::create(std::shared_ptr<PopulateCtx> ctx,
     if ((end_val / step_val + 1) * step_val >=
         int_type->getMax().getAbsValue().value)
         step_val = 1;
-    auto step =
-        std::make_shared<ConstantExpr>(IRValue{type_id, {false, step_val}});
+    auto step = makeIRNode<ConstantExpr>(IRValue{type_id, {false, step_val}});
 
     NameHandler &nh = NameHandler::getInstance();
-    auto iter = std::make_shared<Iterator>(nh.getIterName(), type, start, end,
-                                           step, end_val == 0);
+    auto iter = makeIRNode<Iterator>(nh.getIterName(), type, start, end,
+                                     step, end_val == 0);
 
     return iter;
 }
@@ -185,6 +241,14 @@ void Iterator::dbgDump() {
     end->emit(emit_ctx, std::cout);
 }
 
+// Iterator expressions are created on their own, so we have to remove UB from
+// them separately
+static Expr::EvalResType rebuildIterExpr(const std::shared_ptr<Expr> &expr,
+                                         EvalCtx &eval_ctx) {
+    PhaseTimer timer(GenPhase::UB_ELIMINATION);
+    return expr->rebuild(eval_ctx);
+}
+
 // This function bring the value of an expression that used in iterator
 // specification to the desired value, using additions
 static std::shared_ptr<Expr> adjustIterExprValue(std::shared_ptr<Expr> expr,
@@ -207,12 +271,12 @@ static std::shared_ptr<Expr> adjustIterExprValue(std::shared_ptr<Expr> expr,
     Options &options = Options::getInstance();
     if (options.isISPC())
         if (!eval_res->getType()->isUniform())
-            expr = std::make_shared<ExtractCall>(expr);
+            expr = makeIRNode<ExtractCall>(expr);
 
     // Every binary operation applies integral promotion first, so we need to
     // guarantee that expression can be processed
     if (int_type->getIntTypeId() < IntTypeID::INT) {
-        expr = std::make_shared<TypeCastExpr>(
+        expr = makeIRNode<TypeCastExpr>(
             expr, IntegralType::init(IntTypeID::INT), true);
         value = value.castToType(IntTypeID::INT);
     }
@@ -240,11 +304,11 @@ static std::shared_ptr<Expr> adjustIterExprValue(std::shared_ptr<Expr> expr,
             break;
 
         if ((value > expr_val).getValueRef<bool>())
-            ret = std::make_shared<BinaryExpr>(
-                BinaryOp::ADD, ret, std::make_shared<ConstantExpr>(diff));
+            ret = makeIRNode<BinaryExpr>(
+                BinaryOp::ADD, ret, makeIRNode<ConstantExpr>(diff));
         else
-            ret = std::make_shared<BinaryExpr>(
-                BinaryOp::SUB, ret, std::make_shared<ConstantExpr>(diff));
+            ret = makeIRNode<BinaryExpr>(
+                BinaryOp::SUB, ret, makeIRNode<ConstantExpr>(diff));
     } while (true);
 
     return ret;
@@ -270,16 +334,17 @@ void Iterator::populate(std::shared_ptr<PopulateCtx> ctx) {
             // TODO: add appropriate option
             DataKind data_kind =
                 rand_val_gen->getRandId(gen_pol->out_kind_distr);
-            if (data_kind == DataKind::VAR || type->isUniform() ||
-                (data_kind == DataKind::ARR &&
-                 (ctx->getExtInpSymTable()->getArrays().empty() ||
-                  ctx->getLocalSymTable()->getIters().empty()))) {
+            std::shared_ptr<SubscriptExpr> new_subs_expr;
+            if (data_kind == DataKind::ARR && !type->isUniform() &&
+                !ctx->getExtInpSymTable()->getArrays().empty() &&
+                !ctx->getLocalSymTable()->getIters().empty())
+                new_subs_expr = SubscriptExpr::create(ctx);
+            if (data_kind == DataKind::VAR || !new_subs_expr) {
                 auto new_scalar_var_expr = ScalarVarUseExpr::create(ctx);
                 new_scalar_var_expr->setIsDead(false);
                 ret = new_scalar_var_expr;
             }
             else if (data_kind == DataKind::ARR) {
-                auto new_subs_expr = SubscriptExpr::create(ctx);
                 new_subs_expr->setIsDead(false);
                 ret = new_subs_expr;
             }
@@ -293,7 +358,7 @@ void Iterator::populate(std::shared_ptr<PopulateCtx> ctx) {
             ERROR("Bad Loop End Kind");
 
         EvalCtx eval_ctx;
-        auto ret_eval_res = ret->rebuild(eval_ctx);
+        auto ret_eval_res = rebuildIterExpr(ret, eval_ctx);
 
         if (!type->isIntType() || !ret_eval_res->getType()->isIntType())
             ERROR("We support only integer types for now");
@@ -304,16 +369,16 @@ void Iterator::populate(std::shared_ptr<PopulateCtx> ctx) {
 
         if (options.isISPC())
             if (!ret_eval_res->getType()->isUniform()) {
-                ret = std::make_shared<ExtractCall>(ret);
-                ret_eval_res = ret->rebuild(eval_ctx);
+                ret = makeIRNode<ExtractCall>(ret);
+                ret_eval_res = rebuildIterExpr(ret, eval_ctx);
                 int_eval_res_type = std::static_pointer_cast<IntegralType>(
                     ret_eval_res->getType());
             }
 
         if (int_type->getIntTypeId() != int_eval_res_type->getIntTypeId()) {
-            ret = std::make_shared<TypeCastExpr>(
+            ret = makeIRNode<TypeCastExpr>(
                 ret, IntegralType::init(int_type->getIntTypeId()), true);
-            ret_eval_res = ret->rebuild(eval_ctx);
+            ret_eval_res = rebuildIterExpr(ret, eval_ctx);
         }
 
         auto expr_eval_res = expr->evaluate(eval_ctx);
@@ -327,7 +392,11 @@ void Iterator::populate(std::shared_ptr<PopulateCtx> ctx) {
         return ret;
     };
 
+    // All of the iterations should have the same trip count
+    bool old_lane_invariant = ctx->isLaneInvariant();
+    ctx->setLaneInvariant(true);
     start = populate_impl(type, start);
     end = populate_impl(type, end);
     step = populate_impl(type, step);
+    ctx->setLaneInvariant(old_lane_invariant);
 }
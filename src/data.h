@@ -19,8 +19,10 @@ limitations under the License.
 
 #pragma once
 
+#include "arena.h"
 #include "enums.h"
 #include "type.h"
+#include <bitset>
 #include <deque>
 #include <string>
 #include <utility>
@@ -31,6 +33,13 @@ class GenCtx;
 class PopulateCtx;
 class EmitCtx;
 
+// Iterations of a loop are split into lanes: the lane of an iteration is its
+// number modulo LANES_NUM. Array clusters divide LANES_NUM, so all of the
+// iterations of a lane see the same values.
+const size_t LANES_NUM = 16;
+// Lanes that execute a statement
+using LaneMask = std::bitset<LANES_NUM>;
+
 class Data {
   public:
     Data(std::string _name, std::shared_ptr<Type> _type)
@@ -64,7 +73,7 @@ class Data {
 
   protected:
     template <typename T> static std::shared_ptr<Data> makeVaryingImpl(T val) {
-        auto ret = std::make_shared<T>(val);
+        auto ret = makeIRNode<T>(val);
         ret->type = ret->getType()->makeVarying();
         return ret;
     }
@@ -120,16 +129,31 @@ class ScalarVar : public Data {
 
 class Array : public Data {
   public:
-    // Value, end, step
-    using array_val_t =
-        std::tuple<IRValue, std::vector<size_t>, std::vector<size_t>>;
+    // Values of the lanes, end, step. A single value is shared by all lanes.
+    using array_val_t = std::tuple<std::vector<IRValue>, std::vector<size_t>,
+                                   std::vector<size_t>>;
 
     Array(std::string _name, const std::shared_ptr<ArrayType> &_type,
           IRValue _val);
-    IRValue getInitValues() { return init_vals; }
-    array_val_t getCurrentValues() { return cur_vals; }
+    Array(std::string _name, const std::shared_ptr<ArrayType> &_type,
+          std::vector<IRValue> _init_vals);
+    // Initial values form a cluster that is repeated along the innermost
+    // dimension
+    const std::vector<IRValue> &getInitValues() { return init_vals; }
+    // Initial value of the element with the given innermost index
+    const IRValue &getInitValue(size_t idx) {
+        return init_vals[idx % init_vals.size()];
+    }
+    const array_val_t &getCurrentValues() { return cur_vals; }
+    // Current value of the element with the given innermost index. The element
+    // has to be inside of the current value span.
+    const IRValue &getCurrentValue(size_t idx);
     void setValue(IRValue _val, std::deque<size_t> &span,
                   std::deque<size_t> &steps);
+    // Lane i of the assignment stores value i % _vals.size(). The elements of
+    // the lanes that don't execute it keep their initial values.
+    void setValue(const std::vector<IRValue> &_vals, const LaneMask &taken,
+                  std::deque<size_t> &span, std::deque<size_t> &steps);
 
     bool isArray() final { return true; }
     DataKind getKind() final { return DataKind::ARR; }
@@ -143,19 +167,20 @@ class Array : public Data {
     };
 
   private:
-    // TODO:
     // We want elements of the array to have different values.
     // It is the only way to properly test masked instructions and optimizations
     // designed to work with them.
     // Each vector represents a "cluster" with different values that is "copied"
-    // over the whole array. The size of the cluster should be smaller than the
+    // over the whole array. The size of the cluster should be close to the
     // typical target architecture vector size. This way we can cover
     // all of the interesting cases while preserving the simplicity of
     // the analysis.
+    // The input arrays are only read and the output arrays are only written,
+    // so the value that a loop iteration reads depends only on its lane.
 
     // Span of initialization value can always be determined from array
     // dimensions and current value span
-    IRValue init_vals;
+    std::vector<IRValue> init_vals;
     array_val_t cur_vals;
 };
 
@@ -126,10 +126,10 @@ void arrayTest() {
                 std::vector<size_t> steps_vec(steps.begin(), steps.end());
                 array->setValue(ptr_to_type->getMax(), span, steps);
 
-                CHECK((array->getInitValues().getAbsValue() ==
+                CHECK((array->getInitValue(0).getAbsValue() ==
                        ptr_to_type->getMin().getAbsValue()),
                       "Init Value");
-                CHECK((std::get<0>(array->getCurrentValues()).getAbsValue() ==
+                CHECK((array->getCurrentValue(0).getAbsValue() ==
                        ptr_to_type->getMax().getAbsValue()),
                       "CurrentValue");
                 CHECK(std::get<1>(array->getCurrentValues()) == span_vec,
@@ -137,6 +137,41 @@ void arrayTest() {
                 CHECK(std::get<2>(array->getCurrentValues()) == steps_vec,
                       "CurrentValueSteps");
                 CHECK(array->getIsDead(), "Is dead");
+
+                auto cluster_array = std::make_shared<Array>(
+                    std::to_string(i), array_type,
+                    std::vector<IRValue>{ptr_to_type->getMin(),
+                                         ptr_to_type->getMax()});
+                CHECK((cluster_array->getInitValue(2).getAbsValue() ==
+                       ptr_to_type->getMin().getAbsValue()),
+                      "Init value cluster");
+                CHECK((cluster_array->getInitValue(3).getAbsValue() ==
+                       ptr_to_type->getMax().getAbsValue()),
+                      "Init value cluster");
+                CHECK(std::get<1>(cluster_array->getCurrentValues()) ==
+                          std::vector<size_t>(dims.begin(), dims.end()),
+                      "Init value cluster span");
+                CHECK((cluster_array->getCurrentValue(3).getAbsValue() ==
+                       ptr_to_type->getMax().getAbsValue()),
+                      "Current value cluster");
+
+                // Lanes 1 and 3 (elements 2 and 6) keep the initial values
+                LaneMask taken = LaneMask().set().reset(1).reset(3);
+                cluster_array->setValue(
+                    {ptr_to_type->getMax(), ptr_to_type->getMin()}, taken,
+                    span, steps);
+                CHECK((cluster_array->getCurrentValue(0).getAbsValue() ==
+                       ptr_to_type->getMax().getAbsValue()),
+                      "Current value lane");
+                CHECK((cluster_array->getCurrentValue(2).getAbsValue() ==
+                       ptr_to_type->getMin().getAbsValue()),
+                      "Current value masked lane");
+                CHECK((cluster_array->getCurrentValue(10).getAbsValue() ==
+                       ptr_to_type->getMin().getAbsValue()),
+                      "Current value lane");
+                CHECK((cluster_array->getCurrentValue(6).getAbsValue() ==
+                       ptr_to_type->getMin().getAbsValue()),
+                      "Current value masked lane");
             }
 }
 
@@ -156,9 +156,22 @@ enum class OptionKind {
     OUT_DIR,
     PARAM_SHUFFLE,
     EXPL_LOOP_PARAM,
+    FOLD_EXPRS,
+    ARR_CLUSTERS,
     CHECK_ALGO,
     MUTATE,
     MUTATION_SEED,
+    BATCH,
+    SEED_RANGE,
+    JOBS,
+    OUT_MODE,
+    STATS,
+    PERF_TRIP_COUNT,
+    PERF_REPS,
+    PERF_TIME,
+    TIMING_RUNS,
+    FORK_SERVER,
+    UNITY_SIZE,
     MAX_OPTION_ID
 };
 
@@ -208,5 +221,32 @@ enum class SpecialConst {
     MAX_SPECIAL_CONST
 };
 
-enum class CheckAlgo { HASH, ASSERTS, PRECOMPUTE, MAX_CHECK_ALGO };
+// Lane variants of the hash combine output values in several independent
+// accumulators, so the checksum can be vectorized
+enum class CheckAlgo {
+    HASH,
+    ASSERTS,
+    PRECOMPUTE,
+    LANE_HASH,
+    LANE_PRECOMPUTE,
+    MAX_CHECK_ALGO
+};
+
+// Where the generated test goes: separate files in out-dir or a single bundle
+// in stdout
+enum class OutMode { FILES, STDOUT, MAX_OUT_MODE };
+
+enum class StatsFormat { NONE, JSON, MAX_STATS_FORMAT };
+
+// Phases of test generation that are measured separately. Some of them are
+// nested: population includes UB elimination and emission includes checksum
+// precomputation.
+enum class GenPhase {
+    STRUCTURE,
+    POPULATION,
+    UB_ELIMINATION,
+    PRECOMPUTE,
+    EMISSION,
+    MAX_GEN_PHASE
+};
 } // namespace yarpgen
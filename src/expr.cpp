@@ -20,17 +20,21 @@ limitations under the License.
 #include "expr.h"
 #include "context.h"
 #include "options.h"
+#include "statistics.h"
 #include <algorithm>
 #include <deque>
 #include <utility>
 
 using namespace yarpgen;
 
-std::unordered_map<std::shared_ptr<Data>, std::shared_ptr<ScalarVarUseExpr>>
+thread_local std::unordered_map<std::shared_ptr<Data>,
+                                std::shared_ptr<ScalarVarUseExpr>>
     yarpgen::ScalarVarUseExpr::scalar_var_use_set;
-std::unordered_map<std::shared_ptr<Data>, std::shared_ptr<ArrayUseExpr>>
+thread_local std::unordered_map<std::shared_ptr<Data>,
+                                std::shared_ptr<ArrayUseExpr>>
     yarpgen::ArrayUseExpr::array_use_set;
-std::unordered_map<std::shared_ptr<Data>, std::shared_ptr<IterUseExpr>>
+thread_local std::unordered_map<std::shared_ptr<Data>,
+                                std::shared_ptr<IterUseExpr>>
     yarpgen::IterUseExpr::iter_use_set;
 
 std::shared_ptr<Data> Expr::getValue() {
@@ -38,12 +42,53 @@ std::shared_ptr<Data> Expr::getValue() {
     return value;
 }
 
-std::vector<std::shared_ptr<ConstantExpr>> yarpgen::ConstantExpr::used_consts;
+std::vector<IRValue> Expr::evaluateLaneValues(EvalCtx &ctx) {
+    size_t cur_lane = ctx.lane;
+    size_t outer_lanes_num = ctx.lanes_num;
+    ctx.lanes_num = 1;
+    std::vector<IRValue> ret;
+    // The number of lanes grows when we find new reads from the arrays
+    for (ctx.lane = 0; ctx.lane < ctx.lanes_num; ++ctx.lane) {
+        EvalResType eval_res = evaluate(ctx);
+        if (!eval_res->isScalarVar())
+            ERROR("We support only scalar variables for now");
+        ret.push_back(
+            std::static_pointer_cast<ScalarVar>(eval_res)->getCurrentValue());
+    }
+    ctx.lane = cur_lane;
+    ctx.lanes_num = std::max(outer_lanes_num, ctx.lanes_num);
+    return ret;
+}
+
+Expr::EvalResType Expr::evaluateLanes(EvalCtx &ctx, size_t &lanes_num) {
+    size_t cur_lane = ctx.lane;
+    size_t outer_lanes_num = ctx.lanes_num;
+    ctx.lanes_num = 1;
+    EvalResType ret = evaluate(ctx);
+    if (ctx.lanes_num > 1 && !ret->hasUB()) {
+        for (ctx.lane = 0; ctx.lane < ctx.lanes_num; ++ctx.lane) {
+            ret = evaluate(ctx);
+            if (ret->hasUB())
+                break;
+        }
+        if (!ret->hasUB()) {
+            ctx.lane = cur_lane;
+            ret = evaluate(ctx);
+        }
+        ctx.lane = cur_lane;
+    }
+    lanes_num = ctx.lanes_num;
+    ctx.lanes_num = std::max(outer_lanes_num, ctx.lanes_num);
+    return ret;
+}
+
+thread_local std::vector<std::shared_ptr<ConstantExpr>>
+    yarpgen::ConstantExpr::used_consts;
 
 ConstantExpr::ConstantExpr(IRValue _value) {
     // TODO: maybe we need a constant data type rather than an anonymous scalar
     // variable
-    value = std::make_shared<ScalarVar>(
+    value = makeIRNode<ScalarVar>(
         "", IntegralType::init(_value.getIntTypeID()), _value);
 }
 
@@ -52,7 +97,7 @@ Expr::EvalResType ConstantExpr::evaluate(EvalCtx &ctx) { return value; }
 Expr::EvalResType ConstantExpr::rebuild(EvalCtx &ctx) { return evaluate(ctx); }
 
 void ConstantExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                        std::string offset) {
+                        const std::string &offset) {
     assert(value->isScalarVar() &&
            "ConstExpr can represent only scalar constant");
     auto scalar_var = std::static_pointer_cast<ScalarVar>(value);
@@ -137,7 +182,7 @@ ConstantExpr::create(std::shared_ptr<PopulateCtx> ctx) {
             if (type_id < IntTypeID::INT)
                 ir_val = ir_val.castToType(type_id);
 
-            ret = std::make_shared<ConstantExpr>(ir_val);
+            ret = makeIRNode<ConstantExpr>(ir_val);
         }
     }
     else {
@@ -195,7 +240,7 @@ ConstantExpr::create(std::shared_ptr<PopulateCtx> ctx) {
         else
             init_val = rand_val_gen->getRandValue(type_id);
 
-        ret = std::make_shared<ConstantExpr>(init_val);
+        ret = makeIRNode<ConstantExpr>(init_val);
     }
 
     bool use_offset = rand_val_gen->getRandId(gen_pol->use_const_offset_distr);
@@ -230,7 +275,7 @@ ConstantExpr::create(std::shared_ptr<PopulateCtx> ctx) {
             ir_val = ir_val.castToType(type_id);
 
         if (!ir_val.hasUB()) {
-            ret = std::make_shared<ConstantExpr>(ir_val);
+            ret = makeIRNode<ConstantExpr>(ir_val);
             can_add_to_buf = true;
         }
     }
@@ -258,7 +303,7 @@ ScalarVarUseExpr::init(std::shared_ptr<Data> _val) {
     if (find_res != scalar_var_use_set.end())
         return find_res->second;
 
-    auto ret = std::make_shared<ScalarVarUseExpr>(_val);
+    auto ret = makeIRNode<ScalarVarUseExpr>(_val);
     scalar_var_use_set[_val] = ret;
     return ret;
 }
@@ -302,13 +347,13 @@ std::shared_ptr<ArrayUseExpr> ArrayUseExpr::init(std::shared_ptr<Data> _val) {
     if (find_res != array_use_set.end())
         return find_res->second;
 
-    auto ret = std::make_shared<ArrayUseExpr>(_val);
+    auto ret = makeIRNode<ArrayUseExpr>(_val);
     array_use_set[_val] = ret;
     return ret;
 }
 
-void ArrayUseExpr::setValue(std::shared_ptr<Expr> _expr,
-                            std::deque<size_t> &span,
+void ArrayUseExpr::setValue(const std::vector<IRValue> &vals,
+                            const LaneMask &taken, std::deque<size_t> &span,
                             std::deque<size_t> &steps) {
     /*
     std::shared_ptr<Data> new_val = _expr->getValue();
@@ -319,11 +364,7 @@ void ArrayUseExpr::setValue(std::shared_ptr<Expr> _expr,
     }
     */
     auto arr_val = std::static_pointer_cast<Array>(value);
-    if (!_expr->getValue()->isScalarVar())
-        ERROR("Only scalar variables are supported for now");
-    auto expr_scalar_var =
-        std::static_pointer_cast<ScalarVar>(_expr->getValue());
-    arr_val->setValue(expr_scalar_var->getCurrentValue(), span, steps);
+    arr_val->setValue(vals, taken, span, steps);
 }
 
 Expr::EvalResType ArrayUseExpr::evaluate(EvalCtx &ctx) {
@@ -345,7 +386,7 @@ std::shared_ptr<IterUseExpr> IterUseExpr::init(std::shared_ptr<Data> _iter) {
     if (find_res != iter_use_set.end())
         return find_res->second;
 
-    auto ret = std::make_shared<IterUseExpr>(_iter);
+    auto ret = makeIRNode<IterUseExpr>(_iter);
     iter_use_set[_iter] = ret;
     return ret;
 }
@@ -384,13 +425,13 @@ TypeCastExpr::TypeCastExpr(std::shared_ptr<Expr> _expr,
 bool TypeCastExpr::propagateType() {
     assert(to_type->isIntType() && "We can cast only integral types for now");
     auto to_int_type = std::static_pointer_cast<IntegralType>(to_type);
-    value = std::make_shared<ScalarVar>("", to_int_type,
-                                        IRValue(to_int_type->getIntTypeId()));
+    value = makeIRNode<ScalarVar>("", to_int_type,
+                                  IRValue(to_int_type->getIntTypeId()));
     return true;
 }
 
 void TypeCastExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                        std::string offset) {
+                        const std::string &offset) {
     // TODO: add switch for C++ style conversions and switch for implicit casts
     stream << "((" << (is_implicit ? "/* implicit */" : "")
            << to_type->getName(ctx) << ") ";
@@ -413,7 +454,7 @@ TypeCastExpr::create(std::shared_ptr<PopulateCtx> ctx) {
         is_uniform = expr_val->getType()->isUniform();
     }
 
-    return std::make_shared<TypeCastExpr>(
+    return makeIRNode<TypeCastExpr>(
         expr, IntegralType::init(to_type, false, CVQualifier::NONE, is_uniform),
         /*is_implicit*/ false);
 }
@@ -439,7 +480,7 @@ Expr::EvalResType TypeCastExpr::evaluate(EvalCtx &ctx) {
     if (base_type->isIntType() && expr_eval_res->isScalarVar()) {
         std::shared_ptr<IntegralType> to_int_type =
             std::static_pointer_cast<IntegralType>(to_type);
-        auto scalar_val = std::make_shared<ScalarVar>(
+        auto scalar_val = makeIRNode<ScalarVar>(
             "", to_int_type, IRValue(to_int_type->getIntTypeId()));
         std::shared_ptr<ScalarVar> base_scalar_var =
             std::static_pointer_cast<ScalarVar>(expr_eval_res);
@@ -501,7 +542,7 @@ std::shared_ptr<Expr> ArithmeticExpr::integralProm(std::shared_ptr<Expr> arg) {
         IntTypeID::INT) // can't perform integral promotion
         return arg;
     // TODO: we need to check if type fits in int or unsigned int
-    return std::make_shared<TypeCastExpr>(
+    return makeIRNode<TypeCastExpr>(
         arg,
         IntegralType::init(IntTypeID::INT, false, CVQualifier::NONE,
                            arg->getValue()->getType()->isUniform()),
@@ -517,7 +558,7 @@ std::shared_ptr<Expr> ArithmeticExpr::convToBool(std::shared_ptr<Expr> arg) {
         std::static_pointer_cast<IntegralType>(arg->getValue()->getType());
     if (int_type->getIntTypeId() == IntTypeID::BOOL)
         return arg;
-    return std::make_shared<TypeCastExpr>(
+    return makeIRNode<TypeCastExpr>(
         arg,
         IntegralType::init(IntTypeID::BOOL, false, CVQualifier::NONE,
                            arg->getValue()->getType()->isUniform()),
@@ -548,11 +589,9 @@ void ArithmeticExpr::arithConv(std::shared_ptr<Expr> &lhs,
             lhs_type->getIntTypeId() > rhs_type->getIntTypeId() ? lhs_type
                                                                 : rhs_type;
         if (lhs_type->getIntTypeId() > rhs_type->getIntTypeId())
-            rhs = std::make_shared<TypeCastExpr>(rhs, max_type,
-                                                 /*is_implicit*/ true);
+            rhs = makeIRNode<TypeCastExpr>(rhs, max_type, /*is_implicit*/ true);
         else
-            lhs = std::make_shared<TypeCastExpr>(lhs, max_type,
-                                                 /*is_implicit*/ true);
+            lhs = makeIRNode<TypeCastExpr>(lhs, max_type, /*is_implicit*/ true);
         return;
     }
 
@@ -563,8 +602,8 @@ void ArithmeticExpr::arithConv(std::shared_ptr<Expr> &lhs,
                                       std::shared_ptr<Expr> &b_expr) -> bool {
         if (!a_type->getIsSigned() &&
             (a_type->getIntTypeId() >= b_type->getIntTypeId())) {
-            b_expr = std::make_shared<TypeCastExpr>(b_expr, a_type,
-                                                    /*is_implicit*/ true);
+            b_expr = makeIRNode<TypeCastExpr>(b_expr, a_type,
+                                              /*is_implicit*/ true);
             return true;
         }
         return false;
@@ -581,8 +620,8 @@ void ArithmeticExpr::arithConv(std::shared_ptr<Expr> &lhs,
         if (a_type->getIsSigned() &&
             IntegralType::canRepresentType(a_type->getIntTypeId(),
                                            b_type->getIntTypeId())) {
-            b_expr = std::make_shared<TypeCastExpr>(b_expr, a_type,
-                                                    /*is_implicit*/ true);
+            b_expr = makeIRNode<TypeCastExpr>(b_expr, a_type,
+                                              /*is_implicit*/ true);
             return true;
         }
         return false;
@@ -601,10 +640,10 @@ void ArithmeticExpr::arithConv(std::shared_ptr<Expr> &lhs,
             if (!a_type->isUniform())
                 new_type = std::static_pointer_cast<IntegralType>(
                     new_type->makeVarying());
-            a_expr = std::make_shared<TypeCastExpr>(a_expr, new_type,
-                                                    /*is_implicit*/ true);
-            b_expr = std::make_shared<TypeCastExpr>(b_expr, new_type,
-                                                    /*is_implicit*/ true);
+            a_expr = makeIRNode<TypeCastExpr>(a_expr, new_type,
+                                              /*is_implicit*/ true);
+            b_expr = makeIRNode<TypeCastExpr>(b_expr, new_type,
+                                              /*is_implicit*/ true);
             return true;
         }
         return false;
@@ -626,8 +665,8 @@ void ArithmeticExpr::varyingPromotion(std::shared_ptr<Expr> &lhs,
                                  std::shared_ptr<Expr> &b_expr) -> bool {
         if (!a_type->isUniform() && b_type->isUniform()) {
             auto new_type = b_type->makeVarying();
-            b_expr = std::make_shared<TypeCastExpr>(b_expr, new_type,
-                                                    /*is_implicit*/ true);
+            b_expr = makeIRNode<TypeCastExpr>(b_expr, new_type,
+                                              /*is_implicit*/ true);
             return true;
         }
         return false;
@@ -642,11 +681,15 @@ std::shared_ptr<Expr> ArithmeticExpr::create(std::shared_ptr<PopulateCtx> ctx) {
     auto gen_pol = ctx->getGenPolicy();
     std::shared_ptr<Expr> new_node;
     ctx->incArithDepth();
-    auto active_ctx = std::make_shared<PopulateCtx>(*ctx);
-    if (active_ctx->getArithDepth() == gen_pol->max_arith_depth) {
+    // The context is modified in place instead of being cloned for every
+    // node. Policy changes are visible only to the subtree of the new node,
+    // so the original policy is restored before the exit.
+    auto old_gen_pol = gen_pol;
+    if (ctx->getArithDepth() == gen_pol->max_arith_depth) {
         // We can have only constants, variables and arrays as leaves
-        std::vector<Probability<IRNodeKind>> new_node_distr;
-        for (auto &item : gen_pol->arith_node_distr) {
+        ProbDistr<IRNodeKind> new_node_distr;
+        const auto &arith_node_distr = gen_pol->arith_node_distr;
+        for (auto &item : arith_node_distr) {
             if (item.getId() == IRNodeKind::CONST ||
                 item.getId() == IRNodeKind::SCALAR_VAR_USE ||
                 item.getId() == IRNodeKind::ARRAY_USE)
@@ -670,9 +713,9 @@ std::shared_ptr<Expr> ArithmeticExpr::create(std::shared_ptr<PopulateCtx> ctx) {
 
         auto new_gen_policy = std::make_shared<GenPolicy>(*gen_pol);
         new_gen_policy->arith_node_distr = new_node_distr;
-        active_ctx->setGenPolicy(new_gen_policy);
+        ctx->setGenPolicy(new_gen_policy);
     }
-    gen_pol = active_ctx->getGenPolicy();
+    gen_pol = ctx->getGenPolicy();
 
     bool apply_similar_op =
         rand_val_gen->getRandId(gen_pol->apply_similar_op_distr);
@@ -680,7 +723,7 @@ std::shared_ptr<Expr> ArithmeticExpr::create(std::shared_ptr<PopulateCtx> ctx) {
         auto new_gen_policy = std::make_shared<GenPolicy>(*gen_pol);
         gen_pol = new_gen_policy;
         gen_pol->chooseAndApplySimilarOp();
-        active_ctx->setGenPolicy(gen_pol);
+        ctx->setGenPolicy(gen_pol);
     }
 
     bool apply_const_use =
@@ -689,51 +732,58 @@ std::shared_ptr<Expr> ArithmeticExpr::create(std::shared_ptr<PopulateCtx> ctx) {
         auto new_gen_policy = std::make_shared<GenPolicy>(*gen_pol);
         gen_pol = new_gen_policy;
         gen_pol->chooseAndApplyConstUse();
-        active_ctx->setGenPolicy(gen_pol);
+        ctx->setGenPolicy(gen_pol);
     }
 
     IRNodeKind node_kind = rand_val_gen->getRandId(gen_pol->arith_node_distr);
 
+    std::shared_ptr<SubscriptExpr> new_subs_expr;
+    if (node_kind == IRNodeKind::SUBSCRIPT &&
+        !ctx->getExtInpSymTable()->getArrays().empty() &&
+        !ctx->getLocalSymTable()->getIters().empty())
+        new_subs_expr = SubscriptExpr::create(ctx);
+
     if (node_kind == IRNodeKind::CONST) {
-        new_node = ConstantExpr::create(active_ctx);
+        new_node = ConstantExpr::create(ctx);
     }
     else if (node_kind == IRNodeKind::SCALAR_VAR_USE ||
-             ((active_ctx->getExtInpSymTable()->getArrays().empty() ||
-               active_ctx->getLocalSymTable()->getIters().empty()) &&
-              node_kind == IRNodeKind::SUBSCRIPT)) {
-        auto new_scalar_var_use_expr = ScalarVarUseExpr::create(active_ctx);
+             (node_kind == IRNodeKind::SUBSCRIPT && !new_subs_expr)) {
+        auto new_scalar_var_use_expr = ScalarVarUseExpr::create(ctx);
         new_scalar_var_use_expr->setIsDead(false);
         new_node = new_scalar_var_use_expr;
     }
     else if (node_kind == IRNodeKind::SUBSCRIPT) {
-        auto new_subs_expr = SubscriptExpr::create(active_ctx);
         new_subs_expr->setIsDead(false);
         new_node = new_subs_expr;
     }
     else if (node_kind == IRNodeKind::TYPE_CAST) {
-        new_node = TypeCastExpr::create(active_ctx);
+        new_node = TypeCastExpr::create(ctx);
     }
     else if (node_kind == IRNodeKind::UNARY) {
-        new_node = UnaryExpr::create(active_ctx);
+        new_node = UnaryExpr::create(ctx);
     }
     else if (node_kind == IRNodeKind::BINARY) {
-        new_node = BinaryExpr::create(active_ctx);
+        new_node = BinaryExpr::create(ctx);
     }
     else if (node_kind == IRNodeKind::CALL) {
-        new_node = LibCallExpr::create(active_ctx);
+        new_node = LibCallExpr::create(ctx);
     }
     else if (node_kind == IRNodeKind::TERNARY) {
-        new_node = TernaryExpr::create(active_ctx);
+        new_node = TernaryExpr::create(ctx);
     }
     else
         ERROR("Bad node kind");
 
+    ctx->setGenPolicy(old_gen_pol);
     ctx->decArithDepth();
 
     if (ctx->getArithDepth() == 0) {
+        PhaseTimer timer(GenPhase::UB_ELIMINATION);
         new_node->propagateType();
         EvalCtx eval_ctx;
         new_node->rebuild(eval_ctx);
+        if (Options::getInstance().getFoldExprs())
+            new_node = ExprFoldingSet::fold(new_node);
     }
 
     return new_node;
@@ -784,7 +834,7 @@ Expr::EvalResType UnaryExpr::evaluate(EvalCtx &ctx) {
     assert(scalar_arg->getType()->isIntType() &&
            "Unary operations are supported for Scalar Variables of Integral "
            "Types only");
-    value = std::make_shared<ScalarVar>(
+    value = makeIRNode<ScalarVar>(
         "",
         IntegralType::init(new_val.getIntTypeID(), false, CVQualifier::NONE,
                            arg->getValue()->getType()->isUniform()),
@@ -795,7 +845,9 @@ Expr::EvalResType UnaryExpr::evaluate(EvalCtx &ctx) {
 Expr::EvalResType UnaryExpr::rebuild(EvalCtx &ctx) {
     propagateType();
     arg->rebuild(ctx);
-    EvalResType eval_res = evaluate(ctx);
+    // The fix doesn't depend on the value, so it works for all of the lanes
+    size_t lanes_num = 1;
+    EvalResType eval_res = evaluateLanes(ctx, lanes_num);
     assert(eval_res->getKind() == DataKind::VAR &&
            "Unary operations are supported for Scalar Variables of Integral "
            "Types only");
@@ -805,6 +857,8 @@ Expr::EvalResType UnaryExpr::rebuild(EvalCtx &ctx) {
         return value;
     }
 
+    Statistics::getInstance().addUB(
+        eval_scalar_res->getCurrentValue().getUBCode());
     if (op == UnaryOp::NEGATE) {
         op = UnaryOp::PLUS;
     }
@@ -825,7 +879,7 @@ Expr::EvalResType UnaryExpr::rebuild(EvalCtx &ctx) {
 }
 
 void UnaryExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                     std::string offset) {
+                     const std::string &offset) {
     stream << offset << "(";
     switch (op) {
         case UnaryOp::PLUS:
@@ -852,7 +906,7 @@ std::shared_ptr<UnaryExpr> UnaryExpr::create(std::shared_ptr<PopulateCtx> ctx) {
     auto gen_pol = ctx->getGenPolicy();
     UnaryOp op = rand_val_gen->getRandId(gen_pol->unary_op_distr);
     auto expr = ArithmeticExpr::create(ctx);
-    return std::make_shared<UnaryExpr>(op, expr);
+    return makeIRNode<UnaryExpr>(op, expr);
 }
 
 UnaryExpr::UnaryExpr(UnaryOp _op, std::shared_ptr<Expr> _expr)
@@ -985,7 +1039,7 @@ Expr::EvalResType BinaryExpr::evaluate(EvalCtx &ctx) {
             break;
     }
 
-    value = std::make_shared<ScalarVar>(
+    value = makeIRNode<ScalarVar>(
         "",
         IntegralType::init(new_val.getIntTypeID(), false, CVQualifier::NONE,
                            lhs->getValue()->getType()->isUniform()),
@@ -997,7 +1051,8 @@ Expr::EvalResType BinaryExpr::rebuild(EvalCtx &ctx) {
     propagateType();
     lhs->rebuild(ctx);
     rhs->rebuild(ctx);
-    std::shared_ptr<Data> eval_res = evaluate(ctx);
+    size_t lanes_num = 1;
+    std::shared_ptr<Data> eval_res = evaluateLanes(ctx, lanes_num);
     assert(eval_res->getKind() == DataKind::VAR &&
            "Binary operations are supported only for Scalar Variables");
 
@@ -1008,6 +1063,16 @@ Expr::EvalResType BinaryExpr::rebuild(EvalCtx &ctx) {
     }
 
     UBKind ub = eval_scalar_res->getCurrentValue().getUBCode();
+    Statistics::getInstance().addUB(ub);
+
+    // The fixes below depend on the values of the operands, so they can't
+    // handle the operands that differ from lane to lane. Bitwise operations
+    // never cause UB.
+    if (lanes_num > 1) {
+        op = BinaryOp::BIT_XOR;
+        value = evaluate(ctx);
+        return value;
+    }
 
     switch (op) {
         case BinaryOp::ADD:
@@ -1085,14 +1150,12 @@ Expr::EvalResType BinaryExpr::rebuild(EvalCtx &ctx) {
                 IRValue adjust_val = IRValue(rhs_int_type->getIntTypeId());
                 assert(new_val > 0 && "Correction values can't be negative");
                 adjust_val.setValue(IRValue::AbsValue{false, new_val});
-                auto const_val = std::make_shared<ConstantExpr>(adjust_val);
+                auto const_val = makeIRNode<ConstantExpr>(adjust_val);
                 if (ub == UBKind::ShiftRhsNeg)
-                    rhs = std::make_shared<BinaryExpr>(BinaryOp::ADD, rhs,
-                                                       const_val);
+                    rhs = makeIRNode<BinaryExpr>(BinaryOp::ADD, rhs, const_val);
                 // UBKind::ShiftRhsLarge
                 else
-                    rhs = std::make_shared<BinaryExpr>(BinaryOp::SUB, rhs,
-                                                       const_val);
+                    rhs = makeIRNode<BinaryExpr>(BinaryOp::SUB, rhs, const_val);
             }
             // UBKind::NegShift
             else {
@@ -1103,9 +1166,8 @@ Expr::EvalResType BinaryExpr::rebuild(EvalCtx &ctx) {
                 auto lhs_int_type = std::static_pointer_cast<IntegralType>(
                     lhs->getValue()->getType());
                 auto const_val =
-                    std::make_shared<ConstantExpr>(lhs_int_type->getMax());
-                lhs =
-                    std::make_shared<BinaryExpr>(BinaryOp::ADD, lhs, const_val);
+                    makeIRNode<ConstantExpr>(lhs_int_type->getMax());
+                lhs = makeIRNode<BinaryExpr>(BinaryOp::ADD, lhs, const_val);
             }
             break;
         case BinaryOp::LT:
@@ -1138,7 +1200,7 @@ Expr::EvalResType BinaryExpr::rebuild(EvalCtx &ctx) {
 }
 
 void BinaryExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                      std::string offset) {
+                      const std::string &offset) {
     stream << offset << "((";
     lhs->emit(ctx, stream);
     stream << ")";
@@ -1219,7 +1281,7 @@ BinaryExpr::create(std::shared_ptr<PopulateCtx> ctx) {
     BinaryOp op = rand_val_gen->getRandId(gen_pol->binary_op_distr);
     auto lhs = ArithmeticExpr::create(ctx);
     auto rhs = ArithmeticExpr::create(ctx);
-    return std::make_shared<BinaryExpr>(op, lhs, rhs);
+    return makeIRNode<BinaryExpr>(op, lhs, rhs);
 }
 
 TernaryExpr::TernaryExpr(std::shared_ptr<Expr> _cond,
@@ -1277,7 +1339,7 @@ Expr::EvalResType TernaryExpr::rebuild(EvalCtx &ctx) {
 }
 
 void TernaryExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                       std::string offset) {
+                       const std::string &offset) {
     stream << offset << "((";
     cond->emit(ctx, stream);
     stream << ") ? (";
@@ -1293,7 +1355,7 @@ TernaryExpr::create(std::shared_ptr<PopulateCtx> ctx) {
     auto true_br = ArithmeticExpr::create(ctx);
     auto false_br = ArithmeticExpr::create(ctx);
 
-    return std::make_shared<TernaryExpr>(cond, true_br, false_br);
+    return makeIRNode<TernaryExpr>(cond, true_br, false_br);
 }
 
 bool SubscriptExpr::propagateType() {
@@ -1336,6 +1398,17 @@ bool SubscriptExpr::inBounds(size_t dim, std::shared_ptr<Data> idx_val,
     return false;
 }
 
+// We can't use size_t, because MacOS maps it to unsigned long, and
+// getValueRef doesn't support it
+static uint64_t getIdxValue(const std::shared_ptr<Data> &idx_val) {
+    if (!idx_val->isScalarVar())
+        ERROR("only scalar variables are supported for now");
+    return std::static_pointer_cast<ScalarVar>(idx_val)
+        ->getCurrentValue()
+        .castToType(IntTypeID::ULLONG)
+        .getValueRef<uint64_t>();
+}
+
 Expr::EvalResType SubscriptExpr::evaluate(EvalCtx &ctx) {
     propagateType();
 
@@ -1370,10 +1443,26 @@ Expr::EvalResType SubscriptExpr::evaluate(EvalCtx &ctx) {
         auto array_val = std::static_pointer_cast<Array>(array_eval_res);
         if (!array_type->getBaseType()->isIntType())
             ERROR("Only integral types are supported for now");
-        value = std::make_shared<ScalarVar>(
+        // We read only the input arrays, so the elements keep their initial
+        // values. The element that a lane reads is determined by the step of
+        // the innermost iterator.
+        size_t elem_idx = 0;
+        const auto &init_vals = array_val->getInitValues();
+        if (init_vals.size() > 1) {
+            if (idx_eval_res->isIterator()) {
+                auto iter = std::static_pointer_cast<Iterator>(idx_eval_res);
+                elem_idx = getIdxValue(iter->getStart()->evaluate(ctx)) +
+                           getIdxValue(iter->getStep()->evaluate(ctx)) *
+                               ctx.lane;
+            }
+            else
+                elem_idx = getIdxValue(idx_eval_res);
+            ctx.lanes_num = std::max(ctx.lanes_num, init_vals.size());
+        }
+        value = makeIRNode<ScalarVar>(
             "",
             std::static_pointer_cast<IntegralType>(array_type->getBaseType()),
-            std::get<0>(array_val->getCurrentValues()));
+            array_val->getInitValue(elem_idx));
     }
 
     Options &options = Options::getInstance();
@@ -1399,11 +1488,12 @@ Expr::EvalResType SubscriptExpr::rebuild(EvalCtx &ctx) {
 
     assert(eval_res->getUBCode() == UBKind::OutOfBounds &&
            "Every other UB should be handled before");
+    Statistics::getInstance().addUB(UBKind::OutOfBounds);
 
     IRValue active_size_val(idx_int_type_id);
     active_size_val.setValue({false, active_size});
-    auto size_constant = std::make_shared<ConstantExpr>(active_size_val);
-    idx = std::make_shared<BinaryExpr>(BinaryOp::MOD, idx, size_constant);
+    auto size_constant = makeIRNode<ConstantExpr>(active_size_val);
+    idx = makeIRNode<BinaryExpr>(BinaryOp::MOD, idx, size_constant);
 
     eval_res = evaluate(ctx);
     assert(eval_res->hasUB() && "All of the UB should be fixed by now");
@@ -1412,7 +1502,7 @@ Expr::EvalResType SubscriptExpr::rebuild(EvalCtx &ctx) {
 }
 
 void SubscriptExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                         std::string offset) {
+                         const std::string &offset) {
     stream << offset;
     // TODO: it may cause some problems in the future
     array->emit(ctx, stream);
@@ -1423,14 +1513,16 @@ void SubscriptExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
 
 std::shared_ptr<SubscriptExpr>
 SubscriptExpr::create(std::shared_ptr<PopulateCtx> ctx) {
-    auto arrs_with_dim =
+    const auto &arrs_with_dim =
         ctx->getExtInpSymTable()->getArraysWithDimNum(ctx->getLoopDepth());
     std::vector<std::shared_ptr<Array>> avail_arrs;
     for (auto &arr : arrs_with_dim) {
         assert(arr->getType()->isArrayType() &&
                "Array should have an array type");
         auto arr_type = std::static_pointer_cast<ArrayType>(arr->getType());
-        bool suit_arr = true;
+        // Values of the arrays with clusters differ from lane to lane
+        bool suit_arr =
+            !ctx->isLaneInvariant() || arr->getInitValues().size() == 1;
         assert(arr_type->getDimensions().size() <= ctx->getLoopDepth() &&
                "Array and context should have same number of dimensions to "
                "create a SubscriptionExpr");
@@ -1444,7 +1536,8 @@ SubscriptExpr::create(std::shared_ptr<PopulateCtx> ctx) {
         if (suit_arr)
             avail_arrs.push_back(arr);
     }
-    assert(!avail_arrs.empty());
+    if (avail_arrs.empty())
+        return nullptr;
     size_t inp_arr_idx = rand_val_gen->getRandValue(static_cast<size_t>(0),
                                                     avail_arrs.size() - 1);
     return init(avail_arrs.at(inp_arr_idx), ctx);
@@ -1458,8 +1551,8 @@ SubscriptExpr::SubscriptExpr(std::shared_ptr<Expr> _arr,
     evaluate(ctx);
 }
 
-void SubscriptExpr::setValue(std::shared_ptr<Expr> _expr,
-                             std::deque<size_t> &span,
+void SubscriptExpr::setValue(const std::vector<IRValue> &vals,
+                             const LaneMask &taken, std::deque<size_t> &span,
                              std::deque<size_t> &steps) {
     EvalCtx ctx;
     auto eval_res = idx->evaluate(ctx);
@@ -1492,11 +1585,11 @@ void SubscriptExpr::setValue(std::shared_ptr<Expr> _expr,
 
     if (array->getKind() == IRNodeKind::SUBSCRIPT) {
         auto subs = std::static_pointer_cast<SubscriptExpr>(array);
-        subs->setValue(_expr, span, steps);
+        subs->setValue(vals, taken, span, steps);
     }
     else if (array->getKind() == IRNodeKind::ARRAY_USE) {
         auto array_use = std::static_pointer_cast<ArrayUseExpr>(array);
-        array_use->setValue(_expr, span, steps);
+        array_use->setValue(vals, taken, span, steps);
     }
     else
         ERROR("Bad IRNodeKind");
@@ -1519,7 +1612,7 @@ std::shared_ptr<SubscriptExpr>
 SubscriptExpr::init(std::shared_ptr<Array> arr,
                     std::shared_ptr<PopulateCtx> ctx) {
     // TODO: relax assumptions
-    std::shared_ptr<Expr> res_expr = std::make_shared<ArrayUseExpr>(arr);
+    std::shared_ptr<Expr> res_expr = makeIRNode<ArrayUseExpr>(arr);
     assert(!ctx->getDimensions().empty() &&
            "We can create a SubscriptExpr only inside loops");
     assert(arr->getType()->isArrayType() &&
@@ -1531,8 +1624,8 @@ SubscriptExpr::init(std::shared_ptr<Array> arr,
     for (size_t i = 0; i < array_type->getDimensions().size(); ++i) {
         auto iter = rand_val_gen->getRandElem(
             ctx->getLocalSymTable()->getIters().at(i));
-        auto iter_use_expr = std::make_shared<IterUseExpr>(iter);
-        res_expr = std::make_shared<SubscriptExpr>(res_expr, iter_use_expr);
+        auto iter_use_expr = makeIRNode<IterUseExpr>(iter);
+        res_expr = makeIRNode<SubscriptExpr>(res_expr, iter_use_expr);
     }
     return std::static_pointer_cast<SubscriptExpr>(res_expr);
 }
@@ -1540,8 +1633,7 @@ SubscriptExpr::init(std::shared_ptr<Array> arr,
 bool AssignmentExpr::propagateType() {
     to->propagateType();
     from->propagateType();
-    from =
-        std::make_shared<TypeCastExpr>(from, to->getValue()->getType(), true);
+    from = makeIRNode<TypeCastExpr>(from, to->getValue()->getType(), true);
     return true;
 }
 
@@ -1556,18 +1648,30 @@ Expr::EvalResType AssignmentExpr::evaluate(EvalCtx &ctx) {
     auto from_int_type =
         std::static_pointer_cast<IntegralType>(from->getValue()->getType());
     if (to_int_type != from_int_type)
-        from = std::make_shared<TypeCastExpr>(from, to_int_type,
-                                              /*is_implicit*/ true);
+        from = makeIRNode<TypeCastExpr>(from, to_int_type,
+                                        /*is_implicit*/ true);
 
     EvalResType to_eval_res = to->evaluate(ctx);
     EvalResType from_eval_res = from->evaluate(ctx);
     if (to_eval_res->getKind() != from_eval_res->getKind())
         ERROR("We can't assign incompatible data types");
 
-    if (!taken)
+    if (taken.none())
         return from_eval_res;
 
     if (to->getKind() == IRNodeKind::SCALAR_VAR_USE) {
+        // The variable keeps the value of the last iteration that executes
+        // the assignment
+        size_t lanes_num = std::min(trip_count, LANES_NUM);
+        size_t i = 0;
+        while (i < lanes_num && !taken[(trip_count - 1 - i) % LANES_NUM])
+            ++i;
+        if (i == lanes_num)
+            return from_eval_res;
+        size_t cur_lane = ctx.lane;
+        ctx.lane = (trip_count - 1 - i) % LANES_NUM;
+        from->evaluate(ctx);
+        ctx.lane = cur_lane;
         auto to_scalar = std::static_pointer_cast<ScalarVarUseExpr>(to);
         to_scalar->setValue(from);
     }
@@ -1578,7 +1682,7 @@ Expr::EvalResType AssignmentExpr::evaluate(EvalCtx &ctx) {
     else if (to->getKind() == IRNodeKind::SUBSCRIPT) {
         auto to_array = std::static_pointer_cast<SubscriptExpr>(to);
         std::deque<size_t> span, steps;
-        to_array->setValue(from, span, steps);
+        to_array->setValue(from->evaluateLaneValues(ctx), taken, span, steps);
     }
     else
         ERROR("Bad IRNodeKind");
@@ -1594,7 +1698,7 @@ Expr::EvalResType AssignmentExpr::rebuild(EvalCtx &ctx) {
 }
 
 void AssignmentExpr::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                          std::string offset) {
+                          const std::string &offset) {
     stream << offset;
     to->emit(ctx, stream);
     stream << " = ";
@@ -1620,7 +1724,7 @@ AssignmentExpr::create(std::shared_ptr<PopulateCtx> ctx) {
     if ((out_kind == DataKind::VAR || ctx->getLoopDepth() == 0)) {
         auto new_var = ScalarVar::create(ctx);
         ctx->getExtOutSymTable()->addVar(new_var);
-        auto new_scalar_use_expr = std::make_shared<ScalarVarUseExpr>(new_var);
+        auto new_scalar_use_expr = makeIRNode<ScalarVarUseExpr>(new_var);
         new_scalar_use_expr->setIsDead(false);
         to = new_scalar_use_expr;
     }
@@ -1636,9 +1740,10 @@ AssignmentExpr::create(std::shared_ptr<PopulateCtx> ctx) {
 
     if (!from_val->getType()->isUniform() &&
         to->getValue()->getType()->isUniform())
-        from = std::make_shared<ExtractCall>(from);
+        from = makeIRNode<ExtractCall>(from);
 
-    return std::make_shared<AssignmentExpr>(to, from, ctx->isTaken());
+    return makeIRNode<AssignmentExpr>(to, from, ctx->getTakenLanes(),
+                                      ctx->getTripCount());
 }
 
 std::shared_ptr<LibCallExpr>
@@ -1693,7 +1798,7 @@ void LibCallExpr::ispcArgPromotion(std::shared_ptr<Expr> &arg) {
     if (!arg_type->isUniform())
         return;
     arg_type = arg_type->makeVarying();
-    arg = std::make_shared<TypeCastExpr>(arg, arg_type, true);
+    arg = makeIRNode<TypeCastExpr>(arg, arg_type, true);
 }
 
 IntTypeID LibCallExpr::getTopIntID(std::vector<std::shared_ptr<Expr>> args) {
@@ -1724,7 +1829,7 @@ void LibCallExpr::cxxArgPromotion(std::shared_ptr<Expr> &arg,
     auto arg_int_type = std::static_pointer_cast<IntegralType>(arg_type);
     if (arg_int_type->getIntTypeId() == type_id)
         return;
-    arg = std::make_shared<TypeCastExpr>(
+    arg = makeIRNode<TypeCastExpr>(
         arg,
         IntegralType::init(type_id, arg_type->getIsStatic(),
                            arg_type->getCVQualifier(), arg_type->isUniform()),
@@ -1788,13 +1893,13 @@ Expr::EvalResType MinMaxCallBase::evaluate(yarpgen::EvalCtx &ctx) {
         res_val = (a_max_val < b_max_val).getValueRef<bool>() ? a_val : b_val;
     else
         ERROR("Unsupported LibCallKind");
-    value = std::make_shared<ScalarVar>("", a_int_type, res_val);
+    value = makeIRNode<ScalarVar>("", a_int_type, res_val);
 
     return value;
 }
 
 void MinMaxCallBase::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                          std::string offset) {
+                          const std::string &offset) {
     Options &options = Options::getInstance();
     stream << offset;
     if (options.isCXX())
@@ -1840,7 +1945,7 @@ MinMaxCallBase::createHelper(std::shared_ptr<PopulateCtx> ctx,
             auto new_type = IntegralType::init(
                 new_type_id, expr_int_type->getIsStatic(),
                 expr_int_type->getCVQualifier(), expr_int_type->isUniform());
-            expr = std::make_shared<TypeCastExpr>(expr, new_type, false);
+            expr = makeIRNode<TypeCastExpr>(expr, new_type, false);
         }
     };
 
@@ -1851,16 +1956,17 @@ MinMaxCallBase::createHelper(std::shared_ptr<PopulateCtx> ctx,
     }
 
     if (kind == LibCallKind::MAX)
-        return std::make_shared<MaxCall>(a, b);
+        return makeIRNode<MaxCall>(a, b);
     else if (kind == LibCallKind::MIN)
-        return std::make_shared<MinCall>(a, b);
+        return makeIRNode<MinCall>(a, b);
     else
         ERROR("Unsupported LibCallKind");
 }
 
 void MinMaxCallBase::emitCDefinitionImpl(std::shared_ptr<EmitCtx> ctx,
                                          std::ostream &stream,
-                                         std::string offset, LibCallKind kind) {
+                                         const std::string &offset,
+                                         LibCallKind kind) {
     std::string func_name, func_sign;
     if (kind == LibCallKind::MAX) {
         func_name = "max";
@@ -1894,7 +2000,7 @@ bool SelectCall::propagateType() {
     assert(cond_type->isIntType() && "We support only integral types for now");
     auto cond_int_type = std::static_pointer_cast<IntegralType>(cond_type);
     if (cond_int_type->getIntTypeId() != IntTypeID::BOOL)
-        cond = std::make_shared<TypeCastExpr>(
+        cond = makeIRNode<TypeCastExpr>(
             cond,
             IntegralType::init(IntTypeID::BOOL, cond_type->getIsStatic(),
                                cond_type->getCVQualifier(),
@@ -1946,7 +2052,7 @@ Expr::EvalResType SelectCall::rebuild(EvalCtx &ctx) {
 }
 
 void SelectCall::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                      std::string offset) {
+                      const std::string &offset) {
     stream << offset << "select((";
     cond->emit(ctx, stream);
     stream << "), (";
@@ -1961,7 +2067,7 @@ SelectCall::create(std::shared_ptr<PopulateCtx> ctx) {
     auto cond = ArithmeticExpr::create(ctx);
     auto true_arg = ArithmeticExpr::create(ctx);
     auto false_arg = ArithmeticExpr::create(ctx);
-    return std::make_shared<SelectCall>(cond, true_arg, false_arg);
+    return makeIRNode<SelectCall>(cond, true_arg, false_arg);
 }
 
 LogicalReductionBase::LogicalReductionBase(std::shared_ptr<Expr> _arg,
@@ -1998,12 +2104,13 @@ Expr::EvalResType LogicalReductionBase::evaluate(EvalCtx &ctx) {
             IRValue::AbsValue{false, !arg_val.getValueRef<bool>()});
     else
         ERROR("Unsupported LibCallKind");
-    value = std::make_shared<ScalarVar>("", type, init_val);
+    value = makeIRNode<ScalarVar>("", type, init_val);
     return value;
 }
 
 void LogicalReductionBase::emit(std::shared_ptr<EmitCtx> ctx,
-                                std::ostream &stream, std::string offset) {
+                                std::ostream &stream,
+                                const std::string &offset) {
     stream << offset;
     if (kind == LibCallKind::ANY)
         stream << "any";
@@ -2023,11 +2130,11 @@ LogicalReductionBase::createHelper(std::shared_ptr<PopulateCtx> ctx,
                                    LibCallKind kind) {
     auto arg = ArithmeticExpr::create(std::move(ctx));
     if (kind == LibCallKind::ANY)
-        return std::make_shared<AnyCall>(arg);
+        return makeIRNode<AnyCall>(arg);
     else if (kind == LibCallKind::ALL)
-        return std::make_shared<AllCall>(arg);
+        return makeIRNode<AllCall>(arg);
     else if (kind == LibCallKind::NONE)
-        return std::make_shared<NoneCall>(arg);
+        return makeIRNode<NoneCall>(arg);
     else
         ERROR("Unsupported LibCallKind");
 }
@@ -2060,13 +2167,13 @@ Expr::EvalResType MinMaxEqReductionBase::evaluate(EvalCtx &ctx) {
     if (!arg_eval_res->getType()->isIntType())
         ERROR("Reduce_min/max accept only integral types");
     if (kind == LibCallKind::RED_MIN || kind == LibCallKind::RED_MAX)
-        value = std::make_shared<ScalarVar>(
+        value = makeIRNode<ScalarVar>(
             "", std::static_pointer_cast<IntegralType>(arg_eval_res->getType()),
             arg_val);
     else if (kind == LibCallKind::RED_EQ) {
         IRValue init_val(IntTypeID::BOOL);
         init_val.setValue(IRValue::AbsValue{false, true});
-        value = std::make_shared<ScalarVar>(
+        value = makeIRNode<ScalarVar>(
             "", IntegralType::init(IntTypeID::BOOL), init_val);
     }
     else
@@ -2075,7 +2182,8 @@ Expr::EvalResType MinMaxEqReductionBase::evaluate(EvalCtx &ctx) {
 }
 
 void MinMaxEqReductionBase::emit(std::shared_ptr<EmitCtx> ctx,
-                                 std::ostream &stream, std::string offset) {
+                                 std::ostream &stream,
+                                 const std::string &offset) {
     stream << offset;
     if (kind == LibCallKind::RED_MIN)
         stream << "reduce_min";
@@ -2095,11 +2203,11 @@ MinMaxEqReductionBase::createHelper(std::shared_ptr<PopulateCtx> ctx,
                                     LibCallKind kind) {
     auto arg = ArithmeticExpr::create(std::move(ctx));
     if (kind == LibCallKind::RED_MIN)
-        return std::make_shared<ReduceMinCall>(arg);
+        return makeIRNode<ReduceMinCall>(arg);
     else if (kind == LibCallKind::RED_MAX)
-        return std::make_shared<ReduceMaxCall>(arg);
+        return makeIRNode<ReduceMaxCall>(arg);
     else if (kind == LibCallKind::RED_EQ)
-        return std::make_shared<ReduceEqCall>(arg);
+        return makeIRNode<ReduceEqCall>(arg);
     else
         ERROR("Unsupported LibCallKind");
 }
@@ -2107,7 +2215,7 @@ MinMaxEqReductionBase::createHelper(std::shared_ptr<PopulateCtx> ctx,
 ExtractCall::ExtractCall(std::shared_ptr<Expr> _arg) : arg(_arg) {
     IRValue idx_val(IntTypeID::UINT);
     idx_val.setValue(IRValue::AbsValue{false, 0});
-    idx = std::make_shared<ConstantExpr>(idx_val);
+    idx = makeIRNode<ConstantExpr>(idx_val);
     EvalCtx ctx;
     evaluate(ctx);
 }
@@ -2129,12 +2237,12 @@ Expr::EvalResType ExtractCall::evaluate(EvalCtx &ctx) {
     auto arg_type =
         std::static_pointer_cast<IntegralType>(arg_eval_res->getType());
     auto ret_type = IntegralType::init(arg_type->getIntTypeId());
-    value = std::make_shared<ScalarVar>("", ret_type, arg_val);
+    value = makeIRNode<ScalarVar>("", ret_type, arg_val);
     return value;
 }
 
 void ExtractCall::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                       std::string offset) {
+                       const std::string &offset) {
     stream << offset << "extract";
     stream << "((";
     arg->emit(ctx, stream);
@@ -2146,5 +2254,81 @@ void ExtractCall::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
 std::shared_ptr<LibCallExpr>
 ExtractCall::create(std::shared_ptr<PopulateCtx> ctx) {
     auto arg = ArithmeticExpr::create(std::move(ctx));
-    return std::make_shared<ExtractCall>(arg);
+    return makeIRNode<ExtractCall>(arg);
+}
+
+thread_local std::unordered_map<ExprKey, std::shared_ptr<Expr>, ExprKeyHasher>
+    yarpgen::ExprFoldingSet::fold_set;
+
+std::shared_ptr<Expr> ExprFoldingSet::fold(const std::shared_ptr<Expr> &expr) {
+    bool foldable = false;
+    return foldImpl(expr, foldable);
+}
+
+std::shared_ptr<Expr>
+ExprFoldingSet::foldImpl(const std::shared_ptr<Expr> &expr, bool &foldable) {
+    foldable = false;
+    IRNodeKind kind = expr->getKind();
+    uint32_t attr = 0;
+    uint64_t const_val = 0;
+    const Expr *first = nullptr;
+    const Expr *second = nullptr;
+    bool first_foldable = false;
+    bool second_foldable = false;
+
+    switch (kind) {
+        case IRNodeKind::CONST: {
+            IRValue::AbsValue abs_val =
+                std::static_pointer_cast<ScalarVar>(expr->getValue())
+                    ->getCurrentValue()
+                    .getAbsValue();
+            attr = abs_val.isNegative;
+            const_val = abs_val.value;
+            break;
+        }
+        case IRNodeKind::SCALAR_VAR_USE:
+            // There is exactly one use expression for every variable
+            foldable = true;
+            return expr;
+        case IRNodeKind::TYPE_CAST: {
+            auto cast = std::static_pointer_cast<TypeCastExpr>(expr);
+            cast->expr = foldImpl(cast->expr, first_foldable);
+            if (!first_foldable)
+                return expr;
+            attr = cast->is_implicit;
+            first = cast->expr.get();
+            break;
+        }
+        case IRNodeKind::UNARY: {
+            auto unary = std::static_pointer_cast<UnaryExpr>(expr);
+            unary->arg = foldImpl(unary->arg, first_foldable);
+            if (!first_foldable)
+                return expr;
+            attr = static_cast<uint32_t>(unary->op);
+            first = unary->arg.get();
+            break;
+        }
+        case IRNodeKind::BINARY: {
+            auto binary = std::static_pointer_cast<BinaryExpr>(expr);
+            binary->lhs = foldImpl(binary->lhs, first_foldable);
+            binary->rhs = foldImpl(binary->rhs, second_foldable);
+            if (!first_foldable || !second_foldable)
+                return expr;
+            attr = static_cast<uint32_t>(binary->op);
+            first = binary->lhs.get();
+            second = binary->rhs.get();
+            break;
+        }
+        default:
+            return expr;
+    }
+
+    foldable = true;
+    ExprKey key(kind, attr, expr->getValue()->getType().get(), const_val,
+                first, second);
+    auto find_res = fold_set.find(key);
+    if (find_res != fold_set.end())
+        return find_res->second;
+    fold_set.emplace(key, expr);
+    return expr;
 }
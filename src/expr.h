@@ -25,6 +25,7 @@ limitations under the License.
 #include <utility>
 
 #include "data.h"
+#include "hash.h"
 #include "ir_node.h"
 #include "ir_value.h"
 
@@ -61,7 +62,15 @@ class Expr : public IRNode {
     virtual IRNodeKind getKind() { return IRNodeKind::MAX_EXPR_KIND; }
     virtual std::shared_ptr<Data> getValue();
 
+    // Values of the expression in the lanes that it depends on. Lane i of the
+    // loop gets the value with index i % size of the result.
+    std::vector<IRValue> evaluateLaneValues(EvalCtx &ctx);
+
   protected:
+    // Evaluates the expression in all of the lanes that it depends on and
+    // returns the value of the first lane with UB (or of the current lane)
+    EvalResType evaluateLanes(EvalCtx &ctx, size_t &lanes_num);
+
     std::shared_ptr<Data> value;
 
   private:
@@ -87,12 +96,14 @@ class ConstantExpr : public Expr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<ConstantExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
 
+    static void clearUsedConsts() { used_consts.clear(); }
+
   private:
-    static std::vector<std::shared_ptr<ConstantExpr>> used_consts;
+    static thread_local std::vector<std::shared_ptr<ConstantExpr>> used_consts;
 };
 
 // Abstract class that represents access to all sorts of variables
@@ -118,14 +129,16 @@ class ScalarVarUseExpr : public VarUseExpr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final {
+              const std::string &offset = "") final {
         stream << offset << value->getName(ctx);
     };
     static std::shared_ptr<ScalarVarUseExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
 
+    static void clearUseSet() { scalar_var_use_set.clear(); }
+
   private:
-    static std::unordered_map<std::shared_ptr<Data>,
+    static thread_local std::unordered_map<std::shared_ptr<Data>,
                               std::shared_ptr<ScalarVarUseExpr>>
         scalar_var_use_set;
 };
@@ -137,20 +150,22 @@ class ArrayUseExpr : public VarUseExpr {
     static std::shared_ptr<ArrayUseExpr> init(std::shared_ptr<Data> _val);
     IRNodeKind getKind() final { return IRNodeKind::ARRAY_USE; }
 
-    void setValue(std::shared_ptr<Expr> _expr, std::deque<size_t> &span,
-                  std::deque<size_t> &steps);
+    static void clearUseSet() { array_use_set.clear(); }
+
+    void setValue(const std::vector<IRValue> &vals, const LaneMask &taken,
+                  std::deque<size_t> &span, std::deque<size_t> &steps);
 
     bool propagateType() final { return true; }
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final {
+              const std::string &offset = "") final {
         stream << offset << value->getName(ctx);
     };
 
   private:
-    static std::unordered_map<std::shared_ptr<Data>,
+    static thread_local std::unordered_map<std::shared_ptr<Data>,
                               std::shared_ptr<ArrayUseExpr>>
         array_use_set;
 };
@@ -162,6 +177,8 @@ class IterUseExpr : public VarUseExpr {
     static std::shared_ptr<IterUseExpr> init(std::shared_ptr<Data> _iter);
     IRNodeKind getKind() final { return IRNodeKind::ITER_USE; }
 
+    static void clearUseSet() { iter_use_set.clear(); }
+
     void setValue(std::shared_ptr<Expr> _expr);
 
     bool propagateType() final { return true; }
@@ -169,12 +186,12 @@ class IterUseExpr : public VarUseExpr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final {
+              const std::string &offset = "") final {
         stream << offset << value->getName(ctx);
     };
 
   private:
-    static std::unordered_map<std::shared_ptr<Data>,
+    static thread_local std::unordered_map<std::shared_ptr<Data>,
                               std::shared_ptr<IterUseExpr>>
         iter_use_set;
 };
@@ -191,7 +208,7 @@ class TypeCastExpr : public Expr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<TypeCastExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
 
@@ -199,6 +216,8 @@ class TypeCastExpr : public Expr {
     std::shared_ptr<Expr> expr;
     std::shared_ptr<Type> to_type;
     bool is_implicit;
+
+    friend class ExprFoldingSet;
 };
 
 class ArithmeticExpr : public Expr {
@@ -228,12 +247,14 @@ class UnaryExpr : public ArithmeticExpr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<UnaryExpr> create(std::shared_ptr<PopulateCtx> ctx);
 
   private:
     UnaryOp op;
     std::shared_ptr<Expr> arg;
+
+    friend class ExprFoldingSet;
 };
 
 class BinaryExpr : public ArithmeticExpr {
@@ -247,13 +268,15 @@ class BinaryExpr : public ArithmeticExpr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<BinaryExpr> create(std::shared_ptr<PopulateCtx> ctx);
 
   private:
     BinaryOp op;
     std::shared_ptr<Expr> lhs;
     std::shared_ptr<Expr> rhs;
+
+    friend class ExprFoldingSet;
 };
 
 class TernaryExpr : public ArithmeticExpr {
@@ -267,7 +290,7 @@ class TernaryExpr : public ArithmeticExpr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<TernaryExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
 
@@ -289,13 +312,14 @@ class SubscriptExpr : public Expr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<SubscriptExpr>
     init(std::shared_ptr<Array> arr, std::shared_ptr<PopulateCtx> ctx);
+    // Returns nullptr if none of the arrays can be used in the context
     static std::shared_ptr<SubscriptExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
-    void setValue(std::shared_ptr<Expr> _expr, std::deque<size_t> &span,
-                  std::deque<size_t> &steps);
+    void setValue(const std::vector<IRValue> &vals, const LaneMask &taken,
+                  std::deque<size_t> &span, std::deque<size_t> &steps);
 
     void setIsDead(bool val);
 
@@ -313,8 +337,9 @@ class SubscriptExpr : public Expr {
 class AssignmentExpr : public Expr {
   public:
     AssignmentExpr(std::shared_ptr<Expr> _to, std::shared_ptr<Expr> _from,
-                   bool _taken = true)
-        : to(std::move(_to)), from(std::move(_from)), taken(_taken) {}
+                   LaneMask _taken = LaneMask().set(), size_t _trip_count = 1)
+        : to(std::move(_to)), from(std::move(_from)), taken(_taken),
+          trip_count(_trip_count) {}
     IRNodeKind getKind() final { return IRNodeKind::ASSIGN; }
 
     bool propagateType() final;
@@ -322,14 +347,16 @@ class AssignmentExpr : public Expr {
     EvalResType rebuild(EvalCtx &ctx) final;
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<AssignmentExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
 
   private:
     std::shared_ptr<Expr> to;
     std::shared_ptr<Expr> from;
-    bool taken;
+    // Lanes of the innermost loop that execute the assignment
+    LaneMask taken;
+    size_t trip_count;
 };
 
 class CallExpr : public Expr {
@@ -368,7 +395,7 @@ class MinMaxCallBase : public LibCallExpr {
         return evaluate(ctx);
     }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") override;
+              const std::string &offset = "") override;
 
   protected:
     MinMaxCallBase(std::shared_ptr<Expr> _a, std::shared_ptr<Expr> _b,
@@ -376,7 +403,8 @@ class MinMaxCallBase : public LibCallExpr {
     static std::shared_ptr<LibCallExpr>
     createHelper(std::shared_ptr<PopulateCtx> ctx, LibCallKind kind);
     static void emitCDefinitionImpl(std::shared_ptr<EmitCtx> ctx,
-                                    std::ostream &stream, std::string offset,
+                                    std::ostream &stream,
+                                    const std::string &offset,
                                     LibCallKind kind);
     std::shared_ptr<Expr> a;
     std::shared_ptr<Expr> b;
@@ -392,7 +420,8 @@ class MinCall : public MinMaxCallBase {
         return createHelper(std::move(ctx), LibCallKind::MIN);
     }
     static void emitCDefinition(std::shared_ptr<EmitCtx> ctx,
-                                std::ostream &stream, std::string offset = "") {
+                                std::ostream &stream,
+                                const std::string &offset = "") {
         emitCDefinitionImpl(ctx, stream, offset, LibCallKind::MAX);
     }
 };
@@ -406,7 +435,8 @@ class MaxCall : public MinMaxCallBase {
         return createHelper(std::move(ctx), LibCallKind::MAX);
     }
     static void emitCDefinition(std::shared_ptr<EmitCtx> ctx,
-                                std::ostream &stream, std::string offset = "") {
+                                std::ostream &stream,
+                                const std::string &offset = "") {
         emitCDefinitionImpl(ctx, stream, offset, LibCallKind::MIN);
     }
 };
@@ -419,7 +449,7 @@ class SelectCall : public LibCallExpr {
     EvalResType evaluate(EvalCtx &ctx) final;
     EvalResType rebuild(EvalCtx &ctx) final;
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<LibCallExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
 
@@ -438,7 +468,7 @@ class LogicalReductionBase : public LibCallExpr {
         return evaluate(ctx);
     }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
 
   protected:
     LogicalReductionBase(std::shared_ptr<Expr> _arg, LibCallKind _kind);
@@ -490,7 +520,7 @@ class MinMaxEqReductionBase : public LibCallExpr {
         return evaluate(ctx);
     }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
 
   protected:
     MinMaxEqReductionBase(std::shared_ptr<Expr> _arg, LibCallKind _kind);
@@ -544,7 +574,7 @@ class ExtractCall : public LibCallExpr {
         return evaluate(ctx);
     };
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<LibCallExpr>
     create(std::shared_ptr<PopulateCtx> ctx);
 
@@ -552,4 +582,25 @@ class ExtractCall : public LibCallExpr {
     std::shared_ptr<Expr> arg;
     std::shared_ptr<Expr> idx;
 };
+
+// Hash-consing of expression trees. After the UB elimination the subtrees
+// that consist only of constants, scalar variables, casts, unary and binary
+// operators are immutable, so all equal subtrees can share one instance.
+// The rest of the nodes are kept as is, but their children are not folded.
+class ExprFoldingSet {
+  public:
+    // Returns the canonical instance of the tree
+    static std::shared_ptr<Expr> fold(const std::shared_ptr<Expr> &expr);
+    static void clear() { fold_set.clear(); }
+
+  private:
+    // Folds the children first. The tree is foldable only if all of its
+    // children are foldable.
+    static std::shared_ptr<Expr> foldImpl(const std::shared_ptr<Expr> &expr,
+                                          bool &foldable);
+
+    static thread_local std::unordered_map<ExprKey, std::shared_ptr<Expr>,
+                                           ExprKeyHasher>
+        fold_set;
+};
 } // namespace yarpgen
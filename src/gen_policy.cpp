@@ -18,12 +18,14 @@ limitations under the License.
 #include "gen_policy.h"
 #include "options.h"
 
+#include <algorithm>
+
 using namespace yarpgen;
 
 size_t GenPolicy::leaves_prob_bump = 30;
 
 template <typename T>
-static void shuffleProbProxy(std::vector<Probability<T>> &vec) {
+static void shuffleProbProxy(ProbDistr<T> &vec) {
     Options &options = Options::getInstance();
     if (!options.getUseParamShuffle())
         return;
@@ -32,16 +34,20 @@ static void shuffleProbProxy(std::vector<Probability<T>> &vec) {
 
 GenPolicy::GenPolicy() {
     Options &options = Options::getInstance();
+    // Performance workloads trade statement count for long shallow loop nests
+    // over large arrays
+    size_t perf_trip_count = options.getPerfTripCount();
+    bool perf = options.isPerfWorkload();
 
-    stmt_num_lim = 1000;
+    stmt_num_lim = perf ? 200 : 1000;
 
     loop_seq_num_lim = 4;
     uniformProbFromMax(loop_seq_num_distr, loop_seq_num_lim, 1);
 
-    loop_nest_depth_lim = 3;
+    loop_nest_depth_lim = perf ? 2 : 3;
     uniformProbFromMax(loop_nest_depth_distr, loop_nest_depth_lim, 2);
 
-    loop_depth_limit = 5;
+    loop_depth_limit = perf ? 2 : 5;
 
     if_else_depth_limit = 5;
 
@@ -54,8 +60,8 @@ GenPolicy::GenPolicy() {
     max_iters_num = 1;
     uniformProbFromMax(iters_num_distr, max_iters_num, min_iters_num);
 
-    iters_end_limit_min = 10;
-    iter_end_limit_max = 25;
+    iters_end_limit_min = perf ? std::max<size_t>(perf_trip_count / 2, 1) : 10;
+    iter_end_limit_max = perf ? perf_trip_count : 25;
     iters_step_distr.emplace_back(Probability<size_t>{1, 10});
     iters_step_distr.emplace_back(Probability<size_t>{2, 10});
     iters_step_distr.emplace_back(Probability<size_t>{3, 10});
@@ -66,7 +72,7 @@ GenPolicy::GenPolicy() {
         stmt_kind_struct_distr.emplace_back(
             Probability<IRNodeKind>{IRNodeKind::LOOP_SEQ, 10});
         stmt_kind_struct_distr.emplace_back(
-            Probability<IRNodeKind>{IRNodeKind::LOOP_NEST, 10});
+            Probability<IRNodeKind>(IRNodeKind::LOOP_NEST, perf ? 40 : 10));
     }
     stmt_kind_struct_distr.emplace_back(
         Probability<IRNodeKind>{IRNodeKind::IF_ELSE, 10});
@@ -95,14 +101,19 @@ GenPolicy::GenPolicy() {
     stmt_kind_pop_distr.emplace_back(
         Probability<IRNodeKind>(IRNodeKind::ASSIGN, 20));
 
-    min_new_arr_num = 2;
-    max_new_arr_num = 4;
+    min_new_arr_num = perf ? 1 : 2;
+    max_new_arr_num = perf ? 2 : 4;
     uniformProbFromMax(new_arr_num_distr, max_new_arr_num, min_new_arr_num);
 
     out_kind_distr.emplace_back(Probability<DataKind>(DataKind::VAR, 20));
     out_kind_distr.emplace_back(Probability<DataKind>(DataKind::ARR, 20));
     shuffleProbProxy(out_kind_distr);
 
+    arr_cluster_size_distr.emplace_back(Probability<size_t>{1, 10});
+    arr_cluster_size_distr.emplace_back(Probability<size_t>{4, 20});
+    arr_cluster_size_distr.emplace_back(Probability<size_t>{8, 20});
+    arr_cluster_size_distr.emplace_back(Probability<size_t>{16, 20});
+
     max_arith_depth = 3;
 
     arith_node_distr.emplace_back(
@@ -378,8 +389,8 @@ void GenPolicy::chooseAndApplyConstUse() {
 }
 
 template <typename T>
-void GenPolicy::uniformProbFromMax(std::vector<Probability<T>> &distr,
-                                   size_t max_num, size_t min_num) {
+void GenPolicy::uniformProbFromMax(ProbDistr<T> &distr, size_t max_num,
+                                   size_t min_num) {
     distr.reserve(max_num - min_num);
     for (size_t i = min_num; i <= max_num; ++i)
         distr.emplace_back(i, (max_num - i + 1) * 10);
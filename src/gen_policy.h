@@ -34,12 +34,12 @@ class GenPolicy {
     // Maximal number of loops in a single LoopSequence
     size_t loop_seq_num_lim;
     // Distribution of loop numbers for a LoopSequence
-    std::vector<Probability<size_t>> loop_seq_num_distr;
+    ProbDistr<size_t> loop_seq_num_distr;
 
     // Maximal depth of a single LoopNest
     size_t loop_nest_depth_lim;
     // Distribution of depths for a LoopNest
-    std::vector<Probability<size_t>> loop_nest_depth_distr;
+    ProbDistr<size_t> loop_nest_depth_distr;
 
     // Hard threshold for loop depth
     size_t loop_depth_limit;
@@ -50,12 +50,12 @@ class GenPolicy {
     // Number of statements in a scope
     size_t scope_stmt_min_num;
     size_t scope_stmt_max_num;
-    std::vector<Probability<size_t>> scope_stmt_num_distr;
+    ProbDistr<size_t> scope_stmt_num_distr;
 
     // Number of iterators per loop
     size_t min_iters_num;
     size_t max_iters_num;
-    std::vector<Probability<size_t>> iters_num_distr;
+    ProbDistr<size_t> iters_num_distr;
 
     // TODO: we want to replace constant parameters of iterators with something
     // smarter
@@ -64,19 +64,19 @@ class GenPolicy {
     size_t iters_end_limit_min;
     size_t iter_end_limit_max;
     // Step distribution for iterators
-    std::vector<Probability<size_t>> iters_step_distr;
+    ProbDistr<size_t> iters_step_distr;
 
     // Distribution of statements type for structure generation
-    std::vector<Probability<IRNodeKind>> stmt_kind_struct_distr;
+    ProbDistr<IRNodeKind> stmt_kind_struct_distr;
 
     // Distribution of "else" branch in ifElseStmt
-    std::vector<Probability<bool>> else_br_distr;
+    ProbDistr<bool> else_br_distr;
 
     // Distribution of statements type for population generation
-    std::vector<Probability<IRNodeKind>> stmt_kind_pop_distr;
+    ProbDistr<IRNodeKind> stmt_kind_pop_distr;
 
     // Distribution of available integral types
-    std::vector<Probability<IntTypeID>> int_type_distr;
+    ProbDistr<IntTypeID> int_type_distr;
 
     // Number of external input variables
     size_t min_inp_vars_num;
@@ -85,60 +85,63 @@ class GenPolicy {
     // Number of new arrays that we create in each loop scope
     size_t min_new_arr_num;
     size_t max_new_arr_num;
-    std::vector<Probability<size_t>> new_arr_num_distr;
+    ProbDistr<size_t> new_arr_num_distr;
 
     // Output kind probability
-    std::vector<Probability<DataKind>> out_kind_distr;
+    ProbDistr<DataKind> out_kind_distr;
+    // Number of different values in array clusters (if they are enabled).
+    // Sizes close to the vector width of the target let us test masked code.
+    ProbDistr<size_t> arr_cluster_size_distr;
 
     // Maximal depth of arithmetic expression
     size_t max_arith_depth;
     // Distribution of nodes in arithmetic expression
-    std::vector<Probability<IRNodeKind>> arith_node_distr;
+    ProbDistr<IRNodeKind> arith_node_distr;
     // Unary operator distribution
-    std::vector<Probability<UnaryOp>> unary_op_distr;
+    ProbDistr<UnaryOp> unary_op_distr;
     // Binary operator distribution
-    std::vector<Probability<BinaryOp>> binary_op_distr;
+    ProbDistr<BinaryOp> binary_op_distr;
 
-    std::vector<Probability<LibCallKind>> c_lib_call_distr;
-    std::vector<Probability<LibCallKind>> cxx_lib_call_distr;
-    std::vector<Probability<LibCallKind>> ispc_lib_call_distr;
+    ProbDistr<LibCallKind> c_lib_call_distr;
+    ProbDistr<LibCallKind> cxx_lib_call_distr;
+    ProbDistr<LibCallKind> ispc_lib_call_distr;
 
     static size_t leaves_prob_bump;
 
-    std::vector<Probability<LoopEndKind>> loop_end_kind_distr;
+    ProbDistr<LoopEndKind> loop_end_kind_distr;
 
-    std::vector<Probability<size_t>> pragma_num_distr;
-    std::vector<Probability<PragmaKind>> pragma_kind_distr;
+    ProbDistr<size_t> pragma_num_distr;
+    ProbDistr<PragmaKind> pragma_kind_distr;
 
-    std::vector<Probability<bool>> mutation_probability;
+    ProbDistr<bool> mutation_probability;
 
     // ISPC
     // Probability to generate loop header as foreach or foreach_tiled
-    std::vector<Probability<bool>> foreach_distr;
+    ProbDistr<bool> foreach_distr;
 
-    std::vector<Probability<bool>> apply_similar_op_distr;
-    std::vector<Probability<SimilarOperators>> similar_op_distr;
+    ProbDistr<bool> apply_similar_op_distr;
+    ProbDistr<SimilarOperators> similar_op_distr;
     // This function overrides default distributions
     void chooseAndApplySimilarOp();
 
-    std::vector<Probability<bool>> apply_const_use_distr;
-    std::vector<Probability<ConstUse>> const_use_distr;
+    ProbDistr<bool> apply_const_use_distr;
+    ProbDistr<ConstUse> const_use_distr;
     // This function overrides default distributions
     void chooseAndApplyConstUse();
 
-    std::vector<Probability<bool>> use_special_const_distr;
-    std::vector<Probability<SpecialConst>> special_const_distr;
-    std::vector<Probability<bool>> use_lsb_bit_end_distr;
-    std::vector<Probability<bool>> use_const_offset_distr;
+    ProbDistr<bool> use_special_const_distr;
+    ProbDistr<SpecialConst> special_const_distr;
+    ProbDistr<bool> use_lsb_bit_end_distr;
+    ProbDistr<bool> use_const_offset_distr;
     size_t max_offset;
     size_t min_offset;
-    std::vector<Probability<size_t>> const_offset_distr;
-    std::vector<Probability<bool>> pos_const_offset_distr;
+    ProbDistr<size_t> const_offset_distr;
+    ProbDistr<bool> pos_const_offset_distr;
     static size_t const_buf_size;
-    std::vector<Probability<bool>> replace_in_buf_distr;
-    std::vector<Probability<bool>> reuse_const_prob;
-    std::vector<Probability<bool>> use_const_transform_distr;
-    std::vector<Probability<UnaryOp>> const_transform_distr;
+    ProbDistr<bool> replace_in_buf_distr;
+    ProbDistr<bool> reuse_const_prob;
+    ProbDistr<bool> use_const_transform_distr;
+    ProbDistr<UnaryOp> const_transform_distr;
 
     template <typename F> auto makeMutatableDecision(F function_call) {
         auto res = function_call();
@@ -155,7 +158,7 @@ class GenPolicy {
 
   private:
     template <typename T>
-    void uniformProbFromMax(std::vector<Probability<T>> &distr, size_t max_num,
+    void uniformProbFromMax(ProbDistr<T> &distr, size_t max_num,
                             size_t min_num = 0);
 
     SimilarOperators active_similar_op;
@@ -26,6 +26,7 @@ using namespace yarpgen;
 
 int main() {
     rand_val_gen = std::make_shared<RandValGen>(0);
+    std::cout << "/*SEED " << rand_val_gen->getSeed() << "*/" << std::endl;
 
     auto gen_ctx = std::make_shared<GenCtx>();
     auto scope_stmt = ScopeStmt::generateStructure(gen_ctx);
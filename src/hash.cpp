@@ -107,3 +107,25 @@ std::size_t ArrayTypeKeyHasher::operator()(const ArrayTypeKey &key) const {
 
     return hash.getSeed();
 }
+
+ExprKey::ExprKey(IRNodeKind _kind, uint32_t _attr, const Type *_type,
+                 uint64_t _const_val, const Expr *_first, const Expr *_second)
+    : kind(_kind), attr(_attr), type(_type), const_val(_const_val),
+      first(_first), second(_second) {}
+
+bool ExprKey::operator==(const ExprKey &other) const {
+    return (kind == other.kind) && (attr == other.attr) &&
+           (type == other.type) && (const_val == other.const_val) &&
+           (first == other.first) && (second == other.second);
+}
+
+std::size_t ExprKeyHasher::operator()(const ExprKey &key) const {
+    Hash hash;
+    hash(key.kind);
+    hash(key.attr);
+    hash(key.type);
+    hash(key.const_val);
+    hash(key.first);
+    hash(key.second);
+    return hash.getSeed();
+}
@@ -19,15 +19,26 @@ limitations under the License.
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <type_traits>
 #include <vector>
 
 #include "enums.h"
 
 namespace yarpgen {
 
-const size_t HASH_SEED = 42;
+const uint64_t HASH_SEED = 42;
+
+// Finalizer of SplitMix64. Every bit of the input affects every bit of the
+// result, so the values that differ only in a few low bits (small enums,
+// sizes or aligned pointers) don't collide.
+inline uint64_t mix64(uint64_t val) {
+    val = (val ^ (val >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    val = (val ^ (val >> 27)) * 0x94d049bb133111ebULL;
+    return val ^ (val >> 31);
+}
 
 // Class that is used to calculate various hashes.
 // Right now it is used for folding sets of various types.
@@ -35,7 +46,6 @@ class Hash {
   public:
     Hash() : seed(HASH_SEED) {}
 
-    // TODO: we have a collisions. We need to think about better hash-functions
     template <typename T>
     inline typename std::enable_if<std::is_fundamental<T>::value, void>::type
     operator()(T value) {
@@ -57,22 +67,30 @@ class Hash {
             std::hash<enum_under_type>()(static_cast<enum_under_type>(value)));
     }
 
-    template <typename T> inline void operator()(std::vector<T> value) {
+    template <typename T> inline void operator()(const std::vector<T> &value) {
         Hash hash;
         for (const auto &elem : value)
             hash(elem);
+        hash(value.size());
         hashCombine(hash.getSeed());
     }
 
-    size_t getSeed() { return seed; }
+    // Folded objects are compared by address, so we hash the address
+    template <typename T> inline void operator()(T *ptr) {
+        hashCombine(reinterpret_cast<uintptr_t>(ptr));
+    }
+
+    size_t getSeed() { return static_cast<size_t>(seed); }
 
   private:
-    // Combine existing seed with a new hash value.
-    void hashCombine(size_t value) {
-        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    // Combine existing seed with a new hash value. The seed is advanced by
+    // the golden ratio first, so the order of the values matters and the
+    // zero values are not lost.
+    inline void hashCombine(uint64_t value) {
+        seed = mix64((seed + 0x9e3779b97f4a7c15ULL) ^ value);
     }
 
-    size_t seed;
+    uint64_t seed;
 };
 
 // We need a folding set for integral types. There is a fixed number of them.
@@ -122,4 +140,30 @@ class ArrayTypeKeyHasher {
   public:
     std::size_t operator()(const ArrayTypeKey &key) const;
 };
+
+class Expr;
+
+// This class is used as a key in the folding set of expressions. Child nodes
+// are folded before their parents, so they are compared by pointer.
+class ExprKey {
+  public:
+    ExprKey(IRNodeKind _kind, uint32_t _attr, const Type *_type,
+            uint64_t _const_val, const Expr *_first, const Expr *_second);
+    bool operator==(const ExprKey &other) const;
+
+    IRNodeKind kind;
+    // Operator of the node or its other attributes
+    uint32_t attr;
+    const Type *type;
+    // Absolute value of a constant (its sign is a part of attr)
+    uint64_t const_val;
+    const Expr *first;
+    const Expr *second;
+};
+
+// This class provides a hashing mechanism for folding set.
+class ExprKeyHasher {
+  public:
+    std::size_t operator()(const ExprKey &key) const;
+};
 } // namespace yarpgen
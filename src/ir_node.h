@@ -19,12 +19,30 @@ limitations under the License.
 
 #pragma once
 
+#include <deque>
 #include <iostream>
+#include <string>
 
 namespace yarpgen {
 
 class EmitCtx;
 
+const size_t INDENT_SIZE = 4;
+
+// Emit functions receive offsets by reference. Each nesting level has its own
+// string that is created once, so recursive calls don't have to build them.
+// Deque keeps references to the existing levels valid when a new one is added.
+inline const std::string &getIndent(size_t level) {
+    static thread_local std::deque<std::string> indents;
+    while (indents.size() <= level)
+        indents.emplace_back(indents.size() * INDENT_SIZE, ' ');
+    return indents[level];
+}
+
+inline const std::string &getNextIndent(const std::string &offset) {
+    return getIndent(offset.size() / INDENT_SIZE + 1);
+}
+
 class IRNode {
   public:
     virtual ~IRNode() = default;
@@ -35,7 +53,7 @@ class IRNode {
     // TODO: in the future we might output the same test using different
     // language constructions
     virtual void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                      std::string offset = "") = 0;
+                      const std::string &offset = "") = 0;
     // TODO: make it pure virtual later
     virtual void populate(std::shared_ptr<PopulateCtx> ctx){};
 };
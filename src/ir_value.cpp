@@ -47,6 +47,41 @@ template <> uint32_t &IRValue::getValueRef() { return value.uint_val; }
 template <> int64_t &IRValue::getValueRef() { return value.llong_val; }
 template <> uint64_t &IRValue::getValueRef() { return value.ullong_val; }
 
+//////////////////////////////////////////////////////////////////////////////
+// Operators are dispatched through the tables of function pointers, which are
+// built by the defines in the header.
+
+static const size_t INT_TYPE_ID_NUM =
+    static_cast<size_t>(IntTypeID::MAX_INT_TYPE_ID);
+
+using UnaryOperatorFunc = IRValue (*)(IRValue &);
+using BinaryOperatorFunc = IRValue (*)(IRValue &, IRValue &);
+using CastOperatorFunc = IRValue (*)(IntTypeID, IRValue &);
+
+template <typename F>
+static inline F getOperatorFunc(const F (&table)[INT_TYPE_ID_NUM],
+                                IntTypeID type_id) {
+    auto idx = static_cast<size_t>(type_id);
+    if (idx >= INT_TYPE_ID_NUM || !table[idx])
+        ERROR(std::string("Bad IntTypeID value: ") +
+              std::to_string(static_cast<int>(type_id)));
+    return table[idx];
+}
+
+template <typename F>
+static inline F
+getOperatorFunc(const F (&table)[INT_TYPE_ID_NUM][INT_TYPE_ID_NUM],
+                IntTypeID first_type_id, IntTypeID second_type_id) {
+    auto first_idx = static_cast<size_t>(first_type_id);
+    auto second_idx = static_cast<size_t>(second_type_id);
+    if (first_idx >= INT_TYPE_ID_NUM || second_idx >= INT_TYPE_ID_NUM ||
+        !table[first_idx][second_idx])
+        ERROR(std::string("Bad IntTypeID values: ") +
+              std::to_string(static_cast<int>(first_type_id)) + ", " +
+              std::to_string(static_cast<int>(second_type_id)));
+    return table[first_idx][second_idx];
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 // The idea here is to have a template functions to do all the real work and
@@ -280,9 +315,9 @@ IRValue yarpgen::operator*(IRValue lhs, IRValue rhs) {
 
 //////////////////////////////////////////////////////////////////////////////
 
-template <typename T>
+template <typename T, typename Op>
 static typename std::enable_if<std::is_unsigned<T>::value, IRValue>::type
-divModImpl(IRValue &lhs, IRValue &rhs, std::function<T(T &, T &)> op) {
+divModImpl(IRValue &lhs, IRValue &rhs, Op op) {
     if (rhs.getIntTypeID() != lhs.getIntTypeID())
         ERROR("Can perform operation only on IRValues with the same IntTypeID");
 
@@ -298,9 +333,9 @@ divModImpl(IRValue &lhs, IRValue &rhs, std::function<T(T &, T &)> op) {
     return ret;
 }
 
-template <typename T>
+template <typename T, typename Op>
 static typename std::enable_if<!std::is_unsigned<T>::value, IRValue>::type
-divModImpl(IRValue &lhs, IRValue &rhs, std::function<T(T &, T &)> op) {
+divModImpl(IRValue &lhs, IRValue &rhs, Op op) {
     if (rhs.getIntTypeID() != lhs.getIntTypeID())
         ERROR("Can perform operation only on IRValues with the same IntTypeID");
 
@@ -344,9 +379,8 @@ IRValue yarpgen::operator%(IRValue lhs, IRValue rhs) {
 
 //////////////////////////////////////////////////////////////////////////////
 
-template <typename T>
-static IRValue cmpEqImpl(IRValue &lhs, IRValue &rhs,
-                         std::function<T(T &, T &)> op) {
+template <typename T, typename Op>
+static IRValue cmpEqImpl(IRValue &lhs, IRValue &rhs, Op op) {
     if (rhs.getIntTypeID() != lhs.getIntTypeID())
         ERROR("Can perform operation only on IRValues with the same IntTypeID");
 
@@ -412,8 +446,8 @@ IRValue yarpgen::operator!=(IRValue lhs, IRValue rhs) {
 
 //////////////////////////////////////////////////////////////////////////////
 
-static IRValue logicalAndOrImpl(IRValue &lhs, IRValue &rhs,
-                                std::function<bool(bool &, bool &)> op) {
+template <typename Op>
+static IRValue logicalAndOrImpl(IRValue &lhs, IRValue &rhs, Op op) {
     if (rhs.getIntTypeID() != lhs.getIntTypeID())
         ERROR("Can perform operation only on IRValues with the same IntTypeID");
     if (lhs.getIntTypeID() != IntTypeID::BOOL)
@@ -446,9 +480,8 @@ IRValue yarpgen::operator||(IRValue lhs, IRValue rhs) {
 
 //////////////////////////////////////////////////////////////////////////////
 
-template <typename T>
-static IRValue bitwiseAndOrXorImpl(IRValue &lhs, IRValue &rhs,
-                                   std::function<T(T &, T &)> op) {
+template <typename T, typename Op>
+static IRValue bitwiseAndOrXorImpl(IRValue &lhs, IRValue &rhs, Op op) {
     if (rhs.getIntTypeID() != lhs.getIntTypeID())
         ERROR("Can perform operation only on IRValues with the same IntTypeID");
 
@@ -586,9 +619,11 @@ static IRValue castOperatorImpl(IntTypeID to_type_id, IRValue &from) {
 }
 
 IRValue IRValue::castToType(IntTypeID to_type_id) {
-    std::function<IRValue(IntTypeID, IRValue &)> func;
-    CastOperatorWrapper(castOperatorImpl);
-    return {func(to_type_id, *this)};
+    static const CastOperatorFunc table[][INT_TYPE_ID_NUM] =
+        CastOperatorTable(castOperatorImpl);
+    static_assert(sizeof(table) / sizeof(table[0]) == INT_TYPE_ID_NUM,
+                  "Table has to cover all IntTypeIDs");
+    return {getOperatorFunc(table, to_type_id, type_id)(to_type_id, *this)};
 }
 
 std::ostream &yarpgen::operator<<(std::ostream &out, yarpgen::IRValue &val) {
@@ -608,7 +643,7 @@ std::ostream &yarpgen::operator<<(std::ostream &out, yarpgen::IRValue &val) {
     return out;
 }
 
-IRValue::AbsValue IRValue::getAbsValue() {
+IRValue::AbsValue IRValue::getAbsValue() const {
     AbsValue ret{false, 0};
     // TODO: function can be called on value which is undefined and we need
     // somehow to pass this information
@@ -96,7 +96,7 @@ class IRValue {
 
     size_t getMSB();
 
-    AbsValue getAbsValue();
+    AbsValue getAbsValue() const;
     void setValue(AbsValue val);
 
   private:
@@ -116,135 +116,82 @@ template <> int64_t &IRValue::getValueRef();
 template <> uint64_t &IRValue::getValueRef();
 
 //////////////////////////////////////////////////////////////////////////////
-// These are defines that dispatch the appropriate template instantiation
+// These are defines that build dispatch tables of the appropriate template
+// instantiations. The tables are indexed by IntTypeID and filled at compile
+// time, so the dispatch is a single indexed load. Arithmetic operators are
+// defined only for the types after the integral promotion, the entries for
+// the rest of the types are empty.
 
 // clang-format off
-#define OperatorWrapperCase(__type_id__, __foo__)                              \
-    case (__type_id__): func = __foo__; break;
-
-#define OperatorWrapper(__foo__, __type_id__)                                  \
-    do {                                                                       \
-        switch (__type_id__) {                                                     \
-            OperatorWrapperCase(IntTypeID::INT,  __foo__<TypeSInt::value_type>)\
-            OperatorWrapperCase(IntTypeID::UINT,                               \
-                                __foo__<TypeUInt::value_type>)                 \
-            OperatorWrapperCase(IntTypeID::LLONG,                              \
-                                __foo__<TypeSLLong::value_type>)               \
-            OperatorWrapperCase(IntTypeID::ULLONG,                             \
-                                __foo__<TypeULLong::value_type>)               \
-            default: ERROR(std::string("Bad IntTypeID value: ") +              \
-                           std::to_string(static_cast<int>(__type_id__)));     \
-        }                                                                      \
-    } while (0)
-
-#define ShiftOperatorWrapperCaseCase(__type_id__, __foo__, __lhs_value_type__, \
-                                     __rhs_value_type__)                       \
-    case (__type_id__):                                                        \
-        func = __foo__<__lhs_value_type__, __rhs_value_type__>;                \
-        break;
-
-#define ShiftOperatorWrapperCase(__type_id__, __foo__, __lhs_value_type__)     \
-    case __type_id__:                                                          \
-        switch (rhs.getIntTypeID()) {                                          \
-            ShiftOperatorWrapperCaseCase(IntTypeID::INT, __foo__,              \
-                                         __lhs_value_type__,                   \
-                                         TypeSInt::value_type)                 \
-            ShiftOperatorWrapperCaseCase(IntTypeID::UINT, __foo__,             \
-                                         __lhs_value_type__,                   \
-                                         TypeUInt::value_type)                 \
-            ShiftOperatorWrapperCaseCase(IntTypeID::LLONG, __foo__,            \
-                                         __lhs_value_type__,                   \
-                                         TypeSLLong::value_type)               \
-            ShiftOperatorWrapperCaseCase(IntTypeID::ULLONG, __foo__,           \
-                                         __lhs_value_type__,                   \
-                                         TypeULLong::value_type)               \
-            default: ERROR(std::string("Bad IntTypeID value: ") +              \
-                           std::to_string(static_cast<int>(rhs.getIntTypeID())));\
-        }                                                                      \
-        break;
-
-#define ShiftOperatorWrapper(__foo__)                                          \
-    do {                                                                       \
-        switch (lhs.getIntTypeID()) {                                          \
-            ShiftOperatorWrapperCase(IntTypeID::INT, __foo__,                  \
-                                     TypeSInt::value_type)                     \
-            ShiftOperatorWrapperCase(IntTypeID::UINT, __foo__,                 \
-                                     TypeUInt::value_type)                     \
-            ShiftOperatorWrapperCase(IntTypeID::LLONG, __foo__,                \
-                                     TypeSLLong::value_type)                   \
-            ShiftOperatorWrapperCase(IntTypeID::ULLONG, __foo__,               \
-                                     TypeULLong::value_type)                   \
-            default: ERROR(std::string("Bad IntTypeID value: ") +              \
-                           std::to_string(static_cast<int>(lhs.getIntTypeID())));\
-        }                                                                      \
-    } while (0)
-
-#define CastOperatorWrapperCaseCase(__type_id__, __foo__, __to_value_type__,   \
-                                     __from_value_type__)                      \
-    case (__type_id__):                                                        \
-        func = __foo__<__to_value_type__, __from_value_type__>;                \
-        break;
-
-#define CastOperatorWrapperCase(__type_id__, __foo__, __to_value_type__)       \
-    case __type_id__:                                                          \
-        switch (type_id) {                                                     \
-            CastOperatorWrapperCaseCase(IntTypeID::BOOL, __foo__,              \
-                                         __to_value_type__,                    \
-                                         TypeBool::value_type)                 \
-            CastOperatorWrapperCaseCase(IntTypeID::SCHAR, __foo__,             \
-                                         __to_value_type__,                    \
-                                         TypeSChar::value_type)                \
-            CastOperatorWrapperCaseCase(IntTypeID::UCHAR, __foo__,             \
-                                         __to_value_type__,                    \
-                                         TypeUChar::value_type)                \
-            CastOperatorWrapperCaseCase(IntTypeID::SHORT, __foo__,             \
-                                         __to_value_type__,                    \
-                                         TypeSShort::value_type)               \
-            CastOperatorWrapperCaseCase(IntTypeID::USHORT, __foo__,            \
-                                         __to_value_type__,                    \
-                                         TypeUShort::value_type)               \
-            CastOperatorWrapperCaseCase(IntTypeID::INT, __foo__,               \
-                                         __to_value_type__,                    \
-                                         TypeSInt::value_type)                 \
-            CastOperatorWrapperCaseCase(IntTypeID::UINT, __foo__,              \
-                                         __to_value_type__,                    \
-                                         TypeUInt::value_type)                 \
-            CastOperatorWrapperCaseCase(IntTypeID::LLONG, __foo__,             \
-                                         __to_value_type__,                    \
-                                         TypeSLLong::value_type)               \
-            CastOperatorWrapperCaseCase(IntTypeID::ULLONG, __foo__,            \
-                                         __to_value_type__,                    \
-                                         TypeULLong::value_type)               \
-            default: ERROR(std::string("Bad IntTypeID value: ") +              \
-                           std::to_string(static_cast<int>(type_id)));         \
-        }                                                                      \
-        break;
-
-#define CastOperatorWrapper(__foo__)                                           \
-    do {                                                                       \
-        switch (to_type_id) {                                                  \
-            CastOperatorWrapperCase(IntTypeID::BOOL, __foo__,                  \
-                                     TypeBool::value_type)                     \
-            CastOperatorWrapperCase(IntTypeID::SCHAR, __foo__,                 \
-                                     TypeSChar::value_type)                    \
-            CastOperatorWrapperCase(IntTypeID::UCHAR, __foo__,                 \
-                                     TypeUChar::value_type)                    \
-            CastOperatorWrapperCase(IntTypeID::SHORT, __foo__,                 \
-                                     TypeSShort::value_type)                   \
-            CastOperatorWrapperCase(IntTypeID::USHORT, __foo__,                \
-                                     TypeUShort::value_type)                   \
-            CastOperatorWrapperCase(IntTypeID::INT, __foo__,                   \
-                                     TypeSInt::value_type)                     \
-            CastOperatorWrapperCase(IntTypeID::UINT, __foo__,                  \
-                                     TypeUInt::value_type)                     \
-            CastOperatorWrapperCase(IntTypeID::LLONG, __foo__,                 \
-                                     TypeSLLong::value_type)                   \
-            CastOperatorWrapperCase(IntTypeID::ULLONG, __foo__,                \
-                                     TypeULLong::value_type)                   \
-            default: ERROR(std::string("Bad IntTypeID value: ") +              \
-                           std::to_string(static_cast<int>(type_id)));         \
-        }                                                                      \
-    } while (0)
+#define PromotedTypesRow(__foo__)                                              \
+    {nullptr, nullptr, nullptr, nullptr, nullptr,                              \
+     __foo__<TypeSInt::value_type>, __foo__<TypeUInt::value_type>,             \
+     __foo__<TypeSLLong::value_type>, __foo__<TypeULLong::value_type>}
+
+// Row entries are positional, so the order of IntTypeID must not change
+static_assert(static_cast<size_t>(IntTypeID::INT) == 5 &&
+                  static_cast<size_t>(IntTypeID::UINT) == 6 &&
+                  static_cast<size_t>(IntTypeID::LLONG) == 7 &&
+                  static_cast<size_t>(IntTypeID::ULLONG) == 8 &&
+                  static_cast<size_t>(IntTypeID::MAX_INT_TYPE_ID) == 9,
+              "PromotedTypesRow doesn't match IntTypeID");
+
+// Shift operators are indexed by the types of both operands
+#define ShiftOperatorRow(__foo__, __lhs_value_type__)                          \
+    {nullptr, nullptr, nullptr, nullptr, nullptr,                              \
+     __foo__<__lhs_value_type__, TypeSInt::value_type>,                        \
+     __foo__<__lhs_value_type__, TypeUInt::value_type>,                        \
+     __foo__<__lhs_value_type__, TypeSLLong::value_type>,                      \
+     __foo__<__lhs_value_type__, TypeULLong::value_type>}
+
+#define ShiftOperatorTable(__foo__)                                            \
+    {{}, {}, {}, {}, {},                                                       \
+     ShiftOperatorRow(__foo__, TypeSInt::value_type),                          \
+     ShiftOperatorRow(__foo__, TypeUInt::value_type),                          \
+     ShiftOperatorRow(__foo__, TypeSLLong::value_type),                        \
+     ShiftOperatorRow(__foo__, TypeULLong::value_type)}
+
+static_assert(static_cast<size_t>(IntTypeID::INT) == 5 &&
+                  static_cast<size_t>(IntTypeID::UINT) == 6 &&
+                  static_cast<size_t>(IntTypeID::LLONG) == 7 &&
+                  static_cast<size_t>(IntTypeID::ULLONG) == 8 &&
+                  static_cast<size_t>(IntTypeID::MAX_INT_TYPE_ID) == 9,
+              "ShiftOperatorTable doesn't match IntTypeID");
+
+// Cast operator is indexed by the new type and the old type
+#define CastOperatorRow(__foo__, __to_value_type__)                            \
+    {__foo__<__to_value_type__, TypeBool::value_type>,                         \
+     __foo__<__to_value_type__, TypeSChar::value_type>,                        \
+     __foo__<__to_value_type__, TypeUChar::value_type>,                        \
+     __foo__<__to_value_type__, TypeSShort::value_type>,                       \
+     __foo__<__to_value_type__, TypeUShort::value_type>,                       \
+     __foo__<__to_value_type__, TypeSInt::value_type>,                         \
+     __foo__<__to_value_type__, TypeUInt::value_type>,                         \
+     __foo__<__to_value_type__, TypeSLLong::value_type>,                       \
+     __foo__<__to_value_type__, TypeULLong::value_type>}
+
+#define CastOperatorTable(__foo__)                                             \
+    {CastOperatorRow(__foo__, TypeBool::value_type),                           \
+     CastOperatorRow(__foo__, TypeSChar::value_type),                          \
+     CastOperatorRow(__foo__, TypeUChar::value_type),                          \
+     CastOperatorRow(__foo__, TypeSShort::value_type),                         \
+     CastOperatorRow(__foo__, TypeUShort::value_type),                         \
+     CastOperatorRow(__foo__, TypeSInt::value_type),                           \
+     CastOperatorRow(__foo__, TypeUInt::value_type),                           \
+     CastOperatorRow(__foo__, TypeSLLong::value_type),                         \
+     CastOperatorRow(__foo__, TypeULLong::value_type)}
+
+static_assert(static_cast<size_t>(IntTypeID::BOOL) == 0 &&
+                  static_cast<size_t>(IntTypeID::SCHAR) == 1 &&
+                  static_cast<size_t>(IntTypeID::UCHAR) == 2 &&
+                  static_cast<size_t>(IntTypeID::SHORT) == 3 &&
+                  static_cast<size_t>(IntTypeID::USHORT) == 4 &&
+                  static_cast<size_t>(IntTypeID::INT) == 5 &&
+                  static_cast<size_t>(IntTypeID::UINT) == 6 &&
+                  static_cast<size_t>(IntTypeID::LLONG) == 7 &&
+                  static_cast<size_t>(IntTypeID::ULLONG) == 8 &&
+                  static_cast<size_t>(IntTypeID::MAX_INT_TYPE_ID) == 9,
+              "CastOperatorTable doesn't match IntTypeID");
 
 #define OutOperatorCase(__type_id__, __type__)                                 \
     case (__type_id__):                                                        \
@@ -262,23 +209,28 @@ template <> uint64_t &IRValue::getValueRef();
 
 #define UnaryOperatorImpl(__foo__)                                             \
     do {                                                                       \
-        std::function<IRValue(IRValue &)> func;                                \
-        OperatorWrapper(__foo__, getIntTypeID());                              \
-        return {func(*this)};                                                  \
+        static const UnaryOperatorFunc table[] = PromotedTypesRow(__foo__);    \
+        static_assert(sizeof(table) / sizeof(table[0]) == INT_TYPE_ID_NUM,     \
+                      "Table has to cover all IntTypeIDs");                    \
+        return {getOperatorFunc(table, getIntTypeID())(*this)};                \
     } while (0)
 
 #define BinaryOperatorImpl(__foo__)                                            \
     do {                                                                       \
-        std::function<IRValue(IRValue &, IRValue &)> func;                     \
-        OperatorWrapper(__foo__, lhs.getIntTypeID());                          \
-        return {func(lhs, rhs)};                                               \
+        static const BinaryOperatorFunc table[] = PromotedTypesRow(__foo__);   \
+        static_assert(sizeof(table) / sizeof(table[0]) == INT_TYPE_ID_NUM,     \
+                      "Table has to cover all IntTypeIDs");                    \
+        return {getOperatorFunc(table, lhs.getIntTypeID())(lhs, rhs)};         \
     } while (0)
 
 #define ShiftOperatorImpl(__foo__)                                             \
     do {                                                                       \
-        std::function<IRValue(IRValue &, IRValue &)> func;                     \
-        ShiftOperatorWrapper(__foo__);                                         \
-        return {func(lhs, rhs)};                                               \
+        static const BinaryOperatorFunc table[][INT_TYPE_ID_NUM] =             \
+            ShiftOperatorTable(__foo__);                                       \
+        static_assert(sizeof(table) / sizeof(table[0]) == INT_TYPE_ID_NUM,     \
+                      "Table has to cover all IntTypeIDs");                    \
+        return {getOperatorFunc(table, lhs.getIntTypeID(),                     \
+                                rhs.getIntTypeID())(lhs, rhs)};                \
     } while (0)
 
 //////////////////////////////////////////////////////////////////////////////
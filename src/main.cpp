@@ -20,35 +20,167 @@ limitations under the License.
 #include "program.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <iostream>
+#include <random>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 using namespace yarpgen;
 
+static void makeDir(const std::string &dir) {
+#ifdef _WIN32
+    int res = _mkdir(dir.c_str());
+#else
+    int res = mkdir(dir.c_str(), 0777);
+#endif
+    if (res != 0 && errno != EEXIST)
+        ERROR(std::string("Can't create directory ") + dir);
+}
+
+static void startTest(size_t seed) {
+    Options &options = Options::getInstance();
+    initRandGen(seed);
+    // Single write, so the output of parallel generation threads doesn't mix
+    std::cout << "/*SEED " + std::to_string(options.getSeed()) + "*/\n";
+    if (options.getMutate())
+        std::cout << "/*MUTATION_SEED " +
+                         std::to_string(options.getMutationSeed()) + "*/\n";
+    std::cout << std::flush;
+}
+
+static void generateTest(size_t seed) {
+    startTest(seed);
+    ProgramGenerator new_program;
+    new_program.emit();
+}
+
+// Every test of a unity build starts with the options that the user passed,
+// so that it is the same as the test generated separately with its seed
+static void generateUnity(Options &main_options,
+                          const std::vector<size_t> &seeds) {
+    Options &options = Options::getInstance();
+    std::string out_dir = options.getOutDir();
+    UnityGenerator unity;
+    for (size_t seed : seeds) {
+        options.copyFrom(main_options);
+        options.setOutDir(out_dir);
+        startTest(seed);
+        unity.addTest();
+    }
+    unity.emit();
+}
+
+// Generation thread takes groups of seeds from the shared list one by one
+// until all of them are done. Each group is a separate test or a unity build.
+// Tests are independent, so the order doesn't matter.
+static void batchWorker(Options &main_options,
+                        const std::vector<std::vector<size_t>> &groups,
+                        bool own_dirs, std::atomic<size_t> &next_group_idx) {
+    // Some of the options are narrowed down during the generation of a test.
+    // Every test in a batch should start with the values that the user passed.
+    Options &options = Options::getInstance();
+    std::string base_out_dir = main_options.getOutDir();
+
+    for (size_t i = next_group_idx++; i < groups.size();
+         i = next_group_idx++) {
+        options.copyFrom(main_options);
+
+        const std::vector<size_t> &seeds = groups[i];
+        if (own_dirs && options.getOutMode() == OutMode::FILES) {
+            std::string out_dir =
+                joinPath(base_out_dir, std::to_string(seeds.front()));
+            makeDir(out_dir);
+            options.setOutDir(out_dir);
+        }
+
+        if (seeds.size() == 1)
+            generateTest(seeds.front());
+        else
+            generateUnity(main_options, seeds);
+    }
+}
+
 int main(int argc, char *argv[]) {
     OptionParser::initOptions();
     OptionParser::parse(argc, argv);
 
     Options &options = Options::getInstance();
-    rand_val_gen = std::make_shared<RandValGen>(options.getSeed());
-    options.setSeed(rand_val_gen->getSeed());
-
-    if (options.getMutate()) {
-        if (options.getMutationSeed() == 0)
-            options.setMutationSeed(
-                rand_val_gen->getRandValue(std::numeric_limits<size_t>::min(),
-                                           std::numeric_limits<size_t>::max()));
-        rand_val_gen->switchMutationStates();
-        rand_val_gen->setSeed(options.getMutationSeed());
-        rand_val_gen->switchMutationStates();
-
-        std::cout << "/*MUTATION_SEED " << options.getMutationSeed() << "*/"
-                  << std::endl;
+    std::string conflict = options.getConflict();
+    if (!conflict.empty())
+        ERROR(conflict);
+
+    size_t unity_size = options.getUnitySize();
+    if (!options.isBatchMode() && !options.isUnityBuild()) {
+        generateTest(options.getSeed());
+        return 0;
     }
 
-    ProgramGenerator new_program;
-    new_program.emit();
+    std::vector<size_t> seeds;
+    if (!options.isBatchMode()) {
+        // A single unity build of the tests with consecutive seeds
+        size_t first_seed = options.getSeed();
+        if (first_seed == 0)
+            first_seed = RandValGen::getRandomSeed();
+        for (size_t i = 0; i < unity_size; ++i)
+            seeds.push_back(first_seed + i);
+    }
+    else if (options.hasSeedRange()) {
+        for (size_t seed = options.getSeedRangeStart();
+             seed <= options.getSeedRangeEnd() && seed != 0; ++seed)
+            seeds.push_back(seed);
+    }
+    else if (options.getSeed() != 0) {
+        size_t first_seed = options.getSeed();
+        for (size_t i = 0; i < options.getBatchSize(); ++i)
+            seeds.push_back(first_seed + i);
+    }
+    else {
+        // Random seeds are drawn up front from a single generator and the
+        // duplicates are skipped, so that every test and its directory are
+        // unique
+        std::mt19937_64 seed_gen(RandValGen::getRandomSeed());
+        std::unordered_set<size_t> used_seeds;
+        while (seeds.size() < options.getBatchSize()) {
+            size_t seed = static_cast<size_t>(seed_gen());
+            if (seed != 0 && used_seeds.insert(seed).second)
+                seeds.push_back(seed);
+        }
+    }
+
+    std::vector<std::vector<size_t>> groups;
+    for (size_t i = 0; i < seeds.size(); i += unity_size)
+        groups.emplace_back(
+            seeds.begin() + i,
+            seeds.begin() + std::min(i + unity_size, seeds.size()));
+
+    size_t jobs = options.getJobs();
+    if (jobs == 0)
+        jobs = std::max(std::thread::hardware_concurrency(), 1U);
+    jobs = std::min(jobs, groups.size());
+    // Bundles of different tests would be mixed up in stdout
+    if (options.getOutMode() == OutMode::STDOUT && jobs > 1)
+        ERROR("Batch mode with output to stdout requires a single job");
+
+    // Main thread's options are used as a template for all the tests, so it
+    // only waits for the workers and never generates anything itself
+    std::atomic<size_t> next_group_idx(0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobs; ++i)
+        workers.emplace_back(batchWorker, std::ref(options), std::cref(groups),
+                             options.isBatchMode(), std::ref(next_group_idx));
+    for (auto &worker : workers)
+        worker.join();
 
     return 0;
 }
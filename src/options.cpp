@@ -94,7 +94,7 @@ std::vector<OptionDescr> yarpgen::OptionParser::options_set{
      "Can't parse check algo",
      OptionParser::parseCheckAlgo,
      "hash",
-     {"hash", "asserts", "precompute"}},
+     {"hash", "asserts", "precompute", "lane-hash", "lane-precompute"}},
     {OptionKind::INP_AS_ARGS,
      "",
      "--inp-as-args",
@@ -176,6 +176,26 @@ std::vector<OptionDescr> yarpgen::OptionParser::options_set{
      OptionParser::parseExplLoopParams,
      "false",
      {"true", "false"}},
+    {OptionKind::FOLD_EXPRS,
+     "",
+     "--fold-exprs",
+     true,
+     "Share identical immutable expression subtrees to save memory",
+     "Can't parse fold expressions",
+     OptionParser::parseFoldExprs,
+     "false",
+     {"true", "false"}},
+    {OptionKind::ARR_CLUSTERS,
+     "",
+     "--arr-clusters",
+     true,
+     "Fill arrays with clusters of up to 16 different values, so that loop "
+     "iterations get different values and execute different branches (it is "
+     "ignored for ISPC)",
+     "Can't parse array clusters",
+     OptionParser::parseArrClusters,
+     "false",
+     {"true", "false"}},
     {OptionKind::MUTATE,
      "",
      "--mutate",
@@ -194,6 +214,117 @@ std::vector<OptionDescr> yarpgen::OptionParser::options_set{
      OptionParser::parseMutationSeed,
      "0",
      {}},
+    {OptionKind::BATCH,
+     "",
+     "--batch",
+     true,
+     "Generate several tests in one process, each in a separate subfolder of "
+     "out-dir (0 is reserved for a single test)",
+     "Can't parse batch size",
+     OptionParser::parseBatch,
+     "0",
+     {}},
+    {OptionKind::SEED_RANGE,
+     "",
+     "--seed-range",
+     true,
+     "Generate a test for every seed in the range <start>:<end> (inclusive), "
+     "each in a separate subfolder of out-dir",
+     "Can't parse seed range",
+     OptionParser::parseSeedRange,
+     "",
+     {}},
+    {OptionKind::JOBS,
+     "-j",
+     "--jobs",
+     true,
+     "Number of threads that generate tests in batch mode (0 means all "
+     "available cores)",
+     "Can't parse number of jobs",
+     OptionParser::parseJobs,
+     "1",
+     {}},
+    {OptionKind::OUT_MODE,
+     "",
+     "--out-mode",
+     true,
+     "Write the test files to out-dir or as a single delimited bundle to "
+     "stdout",
+     "Can't parse output mode",
+     OptionParser::parseOutMode,
+     "files",
+     {"files", "stdout"}},
+    {OptionKind::STATS,
+     "",
+     "--stats",
+     true,
+     "Report self time and IR allocations of each generation phase (nested "
+     "phases are excluded), counts of the IR nodes allocated in the arena "
+     "and UB rewrites in stats.json next to the test files",
+     "Can't parse stats format",
+     OptionParser::parseStats,
+     "none",
+     {"none", "json"}},
+    {OptionKind::PERF_TRIP_COUNT,
+     "",
+     "--perf-trip-count",
+     true,
+     "Generate a performance workload with loops of up to <n> iterations "
+     "and arrays of up to <n>^2 elements (0 means a regular test)",
+     "Can't parse performance trip count",
+     OptionParser::parsePerfTripCount,
+     "0",
+     {}},
+    {OptionKind::PERF_REPS,
+     "",
+     "--perf-reps",
+     true,
+     "Number of times the driver calls the test function",
+     "Can't parse performance repetitions",
+     OptionParser::parsePerfReps,
+     "1",
+     {}},
+    {OptionKind::PERF_TIME,
+     "",
+     "--perf-time",
+     true,
+     "Make the driver call the test function for at least <ms> "
+     "milliseconds and report the number of calls to stderr (0 means that "
+     "it is called perf-reps times)",
+     "Can't parse performance time",
+     OptionParser::parsePerfTime,
+     "0",
+     {}},
+    {OptionKind::TIMING_RUNS,
+     "",
+     "--timing-runs",
+     true,
+     "Time <n> runs of the test function in the driver and report the "
+     "minimal and median time to stderr (0 disables timing)",
+     "Can't parse timing runs",
+     OptionParser::parseTimingRuns,
+     "0",
+     {}},
+    {OptionKind::FORK_SERVER,
+     "",
+     "--fork-server",
+     true,
+     "Emit a driver that can work as a fork server: it initializes the data "
+     "once and forks a child that runs the test for every request",
+     "Can't parse fork server",
+     OptionParser::parseForkServer,
+     "false",
+     {"true", "false"}},
+    {OptionKind::UNITY_SIZE,
+     "",
+     "--unity-size",
+     true,
+     "Bundle <n> tests into a single unity build, so that the compiler is "
+     "started once for all of them (a single bundle gets consecutive seeds)",
+     "Can't parse unity size",
+     OptionParser::parseUnitySize,
+     "1",
+     {}},
 };
 
 static void dumpVersion(std::ostream &stream) {
@@ -372,6 +503,10 @@ void OptionParser::parseCheckAlgo(std::string val) {
         options.setCheckAlgo(CheckAlgo::ASSERTS);
     else if (val == "precompute")
         options.setCheckAlgo(CheckAlgo::PRECOMPUTE);
+    else if (val == "lane-hash")
+        options.setCheckAlgo(CheckAlgo::LANE_HASH);
+    else if (val == "lane-precompute")
+        options.setCheckAlgo(CheckAlgo::LANE_PRECOMPUTE);
     else
         printHelpAndExit("Can't recognize checking algorithm");
 }
@@ -472,6 +607,26 @@ void OptionParser::parseExplLoopParams(std::string val) {
         printHelpAndExit("Can't recognize explicit loop parameters");
 }
 
+void OptionParser::parseFoldExprs(std::string val) {
+    Options &options = Options::getInstance();
+    if (val == "true")
+        options.setFoldExprs(true);
+    else if (val == "false")
+        options.setFoldExprs(false);
+    else
+        printHelpAndExit("Can't recognize fold expressions");
+}
+
+void OptionParser::parseArrClusters(std::string val) {
+    Options &options = Options::getInstance();
+    if (val == "true")
+        options.setArrClusters(true);
+    else if (val == "false")
+        options.setArrClusters(false);
+    else
+        printHelpAndExit("Can't recognize array clusters");
+}
+
 void OptionParser::parseMutationSeed(std::string mutation_seed_str) {
     std::stringstream arg_ss(mutation_seed_str);
     Options &options = Options::getInstance();
@@ -480,6 +635,117 @@ void OptionParser::parseMutationSeed(std::string mutation_seed_str) {
     options.setMutationSeed(seed);
 }
 
+void OptionParser::parseBatch(std::string batch_str) {
+    std::stringstream arg_ss(batch_str);
+    Options &options = Options::getInstance();
+    size_t batch_size = 0;
+    if (!(arg_ss >> batch_size))
+        printHelpAndExit("Can't recognize batch size");
+    options.setBatchSize(batch_size);
+}
+
+void OptionParser::parseSeedRange(std::string seed_range_str) {
+    Options &options = Options::getInstance();
+    if (seed_range_str.empty()) {
+        options.setSeedRange(0, 0);
+        return;
+    }
+
+    size_t start = 0;
+    size_t end = 0;
+    char sep = 0;
+    std::stringstream arg_ss(seed_range_str);
+    if (!(arg_ss >> start >> sep >> end) || sep != ':' || !arg_ss.eof())
+        printHelpAndExit("Can't recognize seed range");
+    if (start == 0 || end < start)
+        printHelpAndExit("Bad seed range (0 is reserved for random)");
+    options.setSeedRange(start, end);
+}
+
+void OptionParser::parseJobs(std::string jobs_str) {
+    std::stringstream arg_ss(jobs_str);
+    Options &options = Options::getInstance();
+    size_t jobs = 0;
+    if (!(arg_ss >> jobs))
+        printHelpAndExit("Can't recognize number of jobs");
+    options.setJobs(jobs);
+}
+
+void OptionParser::parsePerfTripCount(std::string trip_count_str) {
+    std::stringstream arg_ss(trip_count_str);
+    Options &options = Options::getInstance();
+    size_t trip_count = 0;
+    if (!(arg_ss >> trip_count))
+        printHelpAndExit("Can't recognize performance trip count");
+    options.setPerfTripCount(trip_count);
+}
+
+void OptionParser::parsePerfReps(std::string reps_str) {
+    std::stringstream arg_ss(reps_str);
+    Options &options = Options::getInstance();
+    size_t reps = 0;
+    if (!(arg_ss >> reps) || reps == 0)
+        printHelpAndExit("Can't recognize performance repetitions");
+    options.setPerfReps(reps);
+}
+
+void OptionParser::parsePerfTime(std::string time_str) {
+    std::stringstream arg_ss(time_str);
+    Options &options = Options::getInstance();
+    size_t time = 0;
+    if (!(arg_ss >> time))
+        printHelpAndExit("Can't recognize performance time");
+    options.setPerfTime(time);
+}
+
+void OptionParser::parseTimingRuns(std::string runs_str) {
+    std::stringstream arg_ss(runs_str);
+    Options &options = Options::getInstance();
+    size_t runs = 0;
+    if (!(arg_ss >> runs))
+        printHelpAndExit("Can't recognize timing runs");
+    options.setTimingRuns(runs);
+}
+
+void OptionParser::parseForkServer(std::string val) {
+    Options &options = Options::getInstance();
+    if (val == "true")
+        options.setForkServer(true);
+    else if (val == "false")
+        options.setForkServer(false);
+    else
+        printHelpAndExit("Can't recognize fork server");
+}
+
+void OptionParser::parseUnitySize(std::string size_str) {
+    std::stringstream arg_ss(size_str);
+    Options &options = Options::getInstance();
+    size_t size = 0;
+    if (!(arg_ss >> size) || size == 0)
+        printHelpAndExit("Can't recognize unity size");
+    options.setUnitySize(size);
+}
+
+void OptionParser::parseOutMode(std::string val) {
+    Options &options = Options::getInstance();
+    if (val == "files")
+        options.setOutMode(OutMode::FILES);
+    else if (val == "stdout")
+        options.setOutMode(OutMode::STDOUT);
+    else
+        printHelpAndExit("Can't recognize output mode");
+}
+
+void OptionParser::parseStats(std::string val) {
+    Options &options = Options::getInstance();
+    if (val == "none")
+        options.setStatsFormat(StatsFormat::NONE);
+    else if (val == "json")
+        options.setStatsFormat(StatsFormat::JSON);
+    else
+        printHelpAndExit("Can't recognize stats format");
+}
+
 void OptionParser::parseMutate(std::string mutate_str) {
     Options &options = Options::getInstance();
     if (mutate_str == "true")
@@ -505,3 +771,16 @@ void Options::setRawOptions(size_t argc, char *argv[]) {
     for (size_t i = 0; i < argc; ++i)
         raw_options.emplace_back(argv[i]);
 }
+
+std::string Options::getConflict() {
+    // SYCL runtime doesn't survive a fork
+    if (fork_server && isSYCL())
+        return "Fork server mode isn't supported for SYCL";
+    // Driver of a unity build runs each test once and doesn't time them
+    if (isUnityBuild() && (usesClock() || fork_server))
+        return "Unity build doesn't support timing runs, performance time and "
+               "fork server";
+    if (batch_size != 0 && hasSeedRange())
+        return "--batch and --seed-range can't be used together";
+    return "";
+}
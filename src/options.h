@@ -95,21 +95,42 @@ class OptionParser {
     static void parseOutDir(std::string val);
     static void parseUseParamShuffle(std::string val);
     static void parseExplLoopParams(std::string val);
+    static void parseFoldExprs(std::string val);
+    static void parseArrClusters(std::string val);
     static void parseMutate(std::string mutate_str);
     static void parseMutationSeed(std::string mutation_seed_str);
+    static void parseBatch(std::string batch_str);
+    static void parseSeedRange(std::string seed_range_str);
+    static void parseJobs(std::string jobs_str);
+    static void parseOutMode(std::string val);
+    static void parseStats(std::string val);
+    static void parsePerfTripCount(std::string trip_count_str);
+    static void parsePerfReps(std::string reps_str);
+    static void parsePerfTime(std::string time_str);
+    static void parseTimingRuns(std::string runs_str);
+    static void parseForkServer(std::string val);
+    static void parseUnitySize(std::string size_str);
 };
 
 class Options {
   public:
+    // Every generation thread has its own copy of the options, because some
+    // of them are adjusted during the generation of a test
     static Options &getInstance() {
-        static Options instance;
+        static thread_local Options instance;
         return instance;
     }
     Options(const Options &options) = delete;
-    Options &operator=(const Options &) = delete;
+
+    // Worker threads should start with options that were parsed by main thread
+    void copyFrom(const Options &other) { *this = other; }
 
     void setRawOptions(size_t argc, char *argv[]);
 
+    // Returns the description of a conflict between the options or an empty
+    // string if they can be used together
+    std::string getConflict();
+
     void setSeed(size_t _seed) { seed = _seed; }
     size_t getSeed() { return seed; }
 
@@ -122,6 +143,19 @@ class Options {
 
     void setCheckAlgo(CheckAlgo val) { check_algo = val; }
     CheckAlgo getCheckAlgo() { return check_algo; }
+    bool isHashCheck() {
+        return check_algo == CheckAlgo::HASH ||
+               check_algo == CheckAlgo::PRECOMPUTE || isLaneHashCheck();
+    }
+    bool isLaneHashCheck() {
+        return check_algo == CheckAlgo::LANE_HASH ||
+               check_algo == CheckAlgo::LANE_PRECOMPUTE;
+    }
+    // The expected hash is calculated during the generation
+    bool isPrecomputeCheck() {
+        return check_algo == CheckAlgo::PRECOMPUTE ||
+               check_algo == CheckAlgo::LANE_PRECOMPUTE;
+    }
 
     void setInpAsArgs(OptionLevel val) { inp_as_args = val; }
     OptionLevel inpAsArgs() { return inp_as_args; }
@@ -144,18 +178,70 @@ class Options {
     void setOutDir(std::string _out_dir) { out_dir = _out_dir; }
     std::string getOutDir() { return out_dir; }
 
+    void setOutMode(OutMode val) { out_mode = val; }
+    OutMode getOutMode() { return out_mode; }
+
+    void setStatsFormat(StatsFormat val) { stats_format = val; }
+    StatsFormat getStatsFormat() { return stats_format; }
+
     void setUseParamShuffle(bool val) { use_param_shuffle = val; }
     bool getUseParamShuffle() { return use_param_shuffle; }
 
     void setExplLoopParams(bool val) { expl_loop_params = val; }
     bool getExplLoopParams() { return expl_loop_params; }
 
+    void setFoldExprs(bool val) { fold_exprs = val; }
+    bool getFoldExprs() { return fold_exprs; }
+
+    void setArrClusters(bool val) { arr_clusters = val; }
+    bool getArrClusters() { return arr_clusters; }
+
     void setMutate(bool val) { mutate = val; }
     bool getMutate() { return mutate; }
 
     void setMutationSeed(size_t val) { mutation_seed = val; }
     size_t getMutationSeed() { return mutation_seed; }
 
+    void setBatchSize(size_t val) { batch_size = val; }
+    size_t getBatchSize() { return batch_size; }
+
+    void setSeedRange(size_t start, size_t end) {
+        seed_range_start = start;
+        seed_range_end = end;
+    }
+    size_t getSeedRangeStart() { return seed_range_start; }
+    size_t getSeedRangeEnd() { return seed_range_end; }
+    bool hasSeedRange() { return seed_range_start != 0; }
+
+    // Generate several tests in one process
+    bool isBatchMode() { return batch_size != 0 || hasSeedRange(); }
+
+    void setJobs(size_t val) { jobs = val; }
+    size_t getJobs() { return jobs; }
+
+    void setPerfTripCount(size_t val) { perf_trip_count = val; }
+    size_t getPerfTripCount() { return perf_trip_count; }
+    bool isPerfWorkload() { return perf_trip_count != 0; }
+
+    void setPerfReps(size_t val) { perf_reps = val; }
+    size_t getPerfReps() { return perf_reps; }
+
+    void setPerfTime(size_t val) { perf_time = val; }
+    size_t getPerfTime() { return perf_time; }
+
+    // The driver needs a clock for timed runs or a time budget
+    bool usesClock() { return hasTiming() || perf_time != 0; }
+
+    void setTimingRuns(size_t val) { timing_runs = val; }
+    size_t getTimingRuns() { return timing_runs; }
+    bool hasTiming() { return timing_runs != 0; }
+
+    void setForkServer(bool val) { fork_server = val; }
+    bool getForkServer() { return fork_server; }
+    void setUnitySize(size_t val) { unity_size = val; }
+    size_t getUnitySize() { return unity_size; }
+    bool isUnityBuild() { return unity_size > 1; }
+
     void dump(std::ostream &stream);
 
   private:
@@ -165,7 +251,12 @@ class Options {
           unique_align_size(false),
           align_size(AlignmentSize::MAX_ALIGNMENT_SIZE), allow_dead_data(false),
           emit_pragmas(OptionLevel::SOME), out_dir("."),
-          use_param_shuffle(false) {}
+          out_mode(OutMode::FILES), use_param_shuffle(false), fold_exprs(false),
+          arr_clusters(false), batch_size(0), seed_range_start(0),
+          seed_range_end(0), jobs(1), perf_trip_count(0), perf_reps(1), perf_time(0),
+          timing_runs(0), fork_server(false), unity_size(1),
+          stats_format(StatsFormat::NONE) {}
+    Options &operator=(const Options &) = default;
 
     std::vector<std::string> raw_options;
 
@@ -185,13 +276,44 @@ class Options {
     OptionLevel emit_pragmas;
 
     std::string out_dir;
+    OutMode out_mode;
 
     bool use_param_shuffle;
 
     // Explicit loop parameters. Some applications need that option available
     bool expl_loop_params;
 
+    // Hash-consing of immutable expression subtrees
+    bool fold_exprs;
+
+    // Arrays have clusters of different values, so loop iterations diverge
+    bool arr_clusters;
+
     bool mutate;
     size_t mutation_seed;
+
+    // Batch mode: number of tests or an inclusive range of seeds.
+    // Each test goes to its own subdirectory of out_dir.
+    size_t batch_size;
+    size_t seed_range_start;
+    size_t seed_range_end;
+    // Number of threads that generate tests in batch mode
+    size_t jobs;
+
+    // Performance workload: the maximal trip count of loops and the number
+    // of test function calls
+    size_t perf_trip_count;
+    size_t perf_reps;
+    // The driver keeps calling the test function for this number of
+    // milliseconds (0 means that it is called perf_reps times)
+    size_t perf_time;
+    // Number of timed runs of the test function in the driver
+    size_t timing_runs;
+    // Driver can run as a fork server
+    bool fork_server;
+    // Number of tests in a single unity build
+    size_t unity_size;
+
+    StatsFormat stats_format;
 };
 } // namespace yarpgen
@@ -16,19 +16,81 @@ limitations under the License.
 //////////////////////////////////////////////////////////////////////////////
 
 #include "program.h"
+#include "arena.h"
 #include "data.h"
 #include "emit_policy.h"
+#include "hash.h"
+#include "statistics.h"
 #include "stmt.h"
-#include <fstream>
+#include <algorithm>
+#include <limits>
 #include <memory>
-#include <sstream>
 
 using namespace yarpgen;
 
-ProgramGenerator::ProgramGenerator() : hash_seed(0) {
+// This buffer tracks what input data we pass as a parameters to test functions
+static thread_local std::vector<std::string> pass_as_param_buffer;
+static thread_local bool any_vars_as_params = false;
+static thread_local bool any_arrays_as_params = false;
+
+// Generator keeps some of its state in global objects. It has to be dropped
+// before we start a new test, otherwise batch mode will produce tests that
+// differ from the ones generated by a separate yarpgen invocation.
+static void resetGlobalState() {
+    // Thread-local objects are destroyed in the reverse order of their
+    // creation. The arena is created before any holder of IR nodes, so all
+    // of the nodes are released by the time the arena frees its chunks.
+    Arena::getInstance();
+    NameHandler::getInstance().reset();
+    Statistics::getInstance().reset();
+    ConstantExpr::clearUsedConsts();
+    ScalarVarUseExpr::clearUseSet();
+    ArrayUseExpr::clearUseSet();
+    IterUseExpr::clearUseSet();
+    ExprFoldingSet::clear();
+    pass_as_param_buffer.clear();
+    any_vars_as_params = false;
+    any_arrays_as_params = false;
+}
+
+void yarpgen::initRandGen(uint64_t seed) {
+    Options &options = Options::getInstance();
+    rand_val_gen = std::make_shared<RandValGen>(seed);
+    options.setSeed(rand_val_gen->getSeed());
+
+    if (options.getMutate()) {
+        if (options.getMutationSeed() == 0)
+            options.setMutationSeed(
+                rand_val_gen->getRandValue(std::numeric_limits<size_t>::min(),
+                                           std::numeric_limits<size_t>::max()));
+        rand_val_gen->switchMutationStates();
+        rand_val_gen->setSeed(options.getMutationSeed());
+        rand_val_gen->switchMutationStates();
+    }
+}
+
+ProgramGenerator::ProgramGenerator() : ProgramGenerator("", "") {}
+
+ProgramGenerator::ProgramGenerator(size_t unity_idx)
+    : ProgramGenerator("t" + std::to_string(unity_idx) + "_",
+                       "_" + std::to_string(unity_idx)) {}
+
+ProgramGenerator::ProgramGenerator(const std::string &name_prefix,
+                                   std::string _func_suffix)
+    : func_suffix(std::move(_func_suffix)), hash_seed(0), hash_lanes() {
+    resetGlobalState();
+    NameHandler::getInstance().setPrefix(name_prefix);
+    Statistics::getInstance().setEnabled(
+        Options::getInstance().getStatsFormat() != StatsFormat::NONE);
+
     // Generate the general structure of the test
-    auto gen_ctx = std::make_shared<GenCtx>();
-    new_test = ScopeStmt::generateStructure(gen_ctx);
+    {
+        PhaseTimer timer(GenPhase::STRUCTURE);
+        auto gen_ctx = std::make_shared<GenCtx>();
+        new_test = ScopeStmt::generateStructure(gen_ctx);
+    }
+
+    PhaseTimer timer(GenPhase::POPULATION);
 
     // Prepare to generate some math inside the structure
     ext_inp_sym_tbl = std::make_shared<SymbolTable>();
@@ -43,8 +105,7 @@ ProgramGenerator::ProgramGenerator() : hash_seed(0) {
     for (size_t i = 0; i < inp_vars_num; ++i) {
         auto new_var = ScalarVar::create(pop_ctx);
         ext_inp_sym_tbl->addVar(new_var);
-        ext_inp_sym_tbl->addVarExpr(
-            std::make_shared<ScalarVarUseExpr>(new_var));
+        ext_inp_sym_tbl->addVarExpr(makeIRNode<ScalarVarUseExpr>(new_var));
     }
 
     pop_ctx->setExtInpSymTable(ext_inp_sym_tbl);
@@ -53,11 +114,21 @@ ProgramGenerator::ProgramGenerator() : hash_seed(0) {
     new_test->populate(pop_ctx);
 }
 
+ProgramGenerator::~ProgramGenerator() {
+    new_test.reset();
+    ext_inp_sym_tbl.reset();
+    ext_out_sym_tbl.reset();
+    resetGlobalState();
+}
+
 void ProgramGenerator::emitCheckFunc(std::ostream &stream) {
     std::ostream &out_file = stream;
+    Options &options = Options::getInstance();
+    // clock_gettime() and fork() are hidden by strict C standard modes
+    if ((options.usesClock() || options.getForkServer()) && options.isC())
+        out_file << "#define _POSIX_C_SOURCE 199309L\n";
     out_file << "#include <stdio.h>\n\n";
 
-    Options &options = Options::getInstance();
     if (options.getCheckAlgo() == CheckAlgo::ASSERTS) {
         stream << "static ";
         stream << (options.isC() ? "_Bool" : "bool") << " value_mismatch = ";
@@ -71,26 +142,147 @@ void ProgramGenerator::emitCheckFunc(std::ostream &stream) {
                 "int const v) {\n";
     out_file << "    *seed ^= v + 0x9e3779b9 + ((*seed)<<6) + ((*seed)>>2);\n";
     out_file << "}\n\n";
+
+    if (!options.isLaneHashCheck())
+        return;
+
+    // Lanes are independent, so the compiler can update several of them at
+    // once. They are combined with hash() at the end of checksum().
+    // The update of lane-precompute is affine in the lane, so that the
+    // generator can combine long runs of updates while it precomputes the
+    // hash. The value is mixed first, so that errors in several elements of
+    // the same lane don't cancel out.
+    out_file << "unsigned long long int hash_lanes[" << HASH_LANES_NUM
+             << "];\n";
+    out_file << "static inline unsigned long long int hash_lane("
+                "unsigned long long int lane, unsigned long long int const "
+                "v) {\n";
+    if (options.getCheckAlgo() == CheckAlgo::LANE_PRECOMPUTE) {
+        // The same as mix64()
+        out_file << "    unsigned long long int m = (v ^ (v >> 30)) * "
+                    "0xbf58476d1ce4e5b9ULL;\n";
+        out_file << "    m = (m ^ (m >> 27)) * 0x94d049bb133111ebULL;\n";
+        out_file << "    return lane * " << LANE_HASH_MUL
+                 << "ULL + (m ^ (m >> 31));\n";
+    }
+    else {
+        out_file << "    lane = (lane ^ v) * " << LANE_HASH_MUL << "ULL;\n";
+        out_file << "    return lane ^ (lane >> 29);\n";
+    }
+    out_file << "}\n\n";
+}
+
+void ProgramGenerator::emitTimingFunc(std::ostream &stream) {
+    Options &options = Options::getInstance();
+    if (!options.usesClock())
+        return;
+
+    if (options.isC()) {
+        stream << "#include <time.h>\n\n";
+        stream << "unsigned long long int get_time_ns() {\n";
+        stream << "    struct timespec ts;\n";
+        stream << "    clock_gettime(CLOCK_MONOTONIC, &ts);\n";
+        stream << "    return (unsigned long long int)ts.tv_sec * "
+                  "1000000000ULL + ts.tv_nsec;\n";
+        stream << "}\n\n";
+    }
+    else {
+        stream << "#include <chrono>\n\n";
+        stream << "unsigned long long int get_time_ns() {\n";
+        stream << "    return std::chrono::duration_cast<"
+                  "std::chrono::nanoseconds>(\n";
+        stream << "        std::chrono::steady_clock::now()."
+                  "time_since_epoch()).count();\n";
+        stream << "}\n\n";
+    }
+
+    // The report goes to stderr, so that the checksum in stdout can still be
+    // compared as is
+    stream << "void report_time(unsigned long long int *times, "
+              "unsigned long long int num) {\n";
+    stream << "    for (unsigned long long int i = 1; i < num; ++i)\n";
+    stream << "        for (unsigned long long int j = i; j > 0 && "
+              "times[j - 1] > times[j]; --j) {\n";
+    stream << "            unsigned long long int tmp = times[j];\n";
+    stream << "            times[j] = times[j - 1];\n";
+    stream << "            times[j - 1] = tmp;\n";
+    stream << "        }\n";
+    stream << "    fprintf(stderr, \"time: min %llu ns, median %llu ns\\n\", "
+              "times[0], times[num / 2]);\n";
+    stream << "}\n\n";
+}
+
+void ProgramGenerator::emitForkServerFunc(std::ostream &stream) {
+    Options &options = Options::getInstance();
+    if (!options.getForkServer())
+        return;
+
+    // The protocol follows AFL. The driver greets the harness with 4 bytes
+    // on FORKSRV_FD + 1. For every byte read from FORKSRV_FD it forks a child
+    // that runs the test and prints the checksum to stdout, and then it
+    // reports the wait status of the child on FORKSRV_FD + 1. If nobody
+    // listens, the driver just runs the test once.
+    stream << "#include <sys/wait.h>\n";
+    stream << "#include <unistd.h>\n\n";
+    stream << "#define FORKSRV_FD 198\n\n";
+    stream << "void fork_server() {\n";
+    stream << "    int status = 0;\n";
+    stream << "    unsigned char req = 0;\n";
+    stream << "    if (write(FORKSRV_FD + 1, &status, 4) != 4)\n";
+    stream << "        return;\n";
+    stream << "    while (read(FORKSRV_FD, &req, 1) == 1) {\n";
+    stream << "        fflush(stdout);\n";
+    stream << "        pid_t pid = fork();\n";
+    stream << "        if (pid < 0)\n";
+    stream << "            _exit(1);\n";
+    stream << "        if (pid == 0) {\n";
+    stream << "            close(FORKSRV_FD);\n";
+    stream << "            close(FORKSRV_FD + 1);\n";
+    stream << "            return;\n";
+    stream << "        }\n";
+    stream << "        if (waitpid(pid, &status, 0) < 0 ||\n";
+    stream << "            write(FORKSRV_FD + 1, &status, 4) != 4)\n";
+    stream << "            _exit(1);\n";
+    stream << "    }\n";
+    stream << "    _exit(0);\n";
+    stream << "}\n\n";
 }
 
 static void emitVarsDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                         std::vector<std::shared_ptr<ScalarVar>> vars) {
+                         const std::vector<std::shared_ptr<ScalarVar>> &vars) {
     Options &options = Options::getInstance();
     if (options.isSYCL())
         ctx->setSYCLPrefix("app_");
     for (auto &var : vars) {
         if (!options.getAllowDeadData() && var->getIsDead())
             continue;
-        auto init_val = std::make_shared<ConstantExpr>(var->getInitValue());
-        auto decl_stmt = std::make_shared<DeclStmt>(var, init_val);
+        auto init_val = makeIRNode<ConstantExpr>(var->getInitValue());
+        auto decl_stmt = makeIRNode<DeclStmt>(var, init_val);
         decl_stmt->emit(ctx, stream);
         stream << "\n";
     }
     ctx->setSYCLPrefix("");
 }
 
+// Restores the initial values of the variables, so that the test can be run
+// again from the same state
+static void emitVarsReset(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
+                          const std::vector<std::shared_ptr<ScalarVar>> &vars) {
+    Options &options = Options::getInstance();
+    if (options.isSYCL())
+        ctx->setSYCLPrefix("app_");
+    for (auto &var : vars) {
+        if (!options.getAllowDeadData() && var->getIsDead())
+            continue;
+        stream << getIndent(1) << var->getName(ctx) << " = ";
+        makeIRNode<ConstantExpr>(var->getInitValue())->emit(ctx, stream);
+        stream << ";\n";
+    }
+    ctx->setSYCLPrefix("");
+}
+
 static void emitArrayDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                          std::vector<std::shared_ptr<Array>> arrays) {
+                          const std::vector<std::shared_ptr<Array>> &arrays) {
     Options &options = Options::getInstance();
     for (auto &array : arrays) {
         if (!options.getAllowDeadData() && array->getIsDead())
@@ -107,9 +299,35 @@ static void emitArrayDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
             stream << "__attribute__((aligned(" << array->getAlignment()
                    << ")))";
         stream << ";\n";
+
+        const auto &init_vals = array->getInitValues();
+        if (init_vals.size() == 1)
+            continue;
+        stream << "static const " << array_type->getBaseType()->getName(ctx)
+               << " " << array->getName(ctx) << "_init [" << init_vals.size()
+               << "] = {";
+        for (size_t i = 0; i < init_vals.size(); ++i) {
+            stream << (i != 0 ? ", " : "");
+            makeIRNode<ConstantExpr>(init_vals[i])->emit(ctx, stream);
+        }
+        stream << "};\n";
     }
 }
 
+// Emits the initial value of the array element. The indices of the element
+// are i_0, i_1 and so on.
+static void emitArrayInitVal(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
+                             const std::shared_ptr<Array> &array,
+                             size_t dims_num) {
+    const auto &init_vals = array->getInitValues();
+    if (init_vals.size() == 1) {
+        makeIRNode<ConstantExpr>(init_vals.front())->emit(ctx, stream);
+        return;
+    }
+    stream << array->getName(ctx) << "_init [i_" << dims_num - 1 << " % "
+           << init_vals.size() << "]";
+}
+
 void ProgramGenerator::emitDecl(std::shared_ptr<EmitCtx> ctx,
                                 std::ostream &stream) {
     emitVarsDecl(ctx, stream, ext_inp_sym_tbl->getVars());
@@ -120,36 +338,36 @@ void ProgramGenerator::emitDecl(std::shared_ptr<EmitCtx> ctx,
 }
 
 static void emitArrayInit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                          std::vector<std::shared_ptr<Array>> arrays) {
+                          const std::vector<std::shared_ptr<Array>> &arrays) {
     Options &options = Options::getInstance();
     for (const auto &array : arrays) {
         if (!options.getAllowDeadData() && array->getIsDead())
             continue;
-        std::string offset = "    ";
         auto type = array->getType();
         assert(type->isArrayType() && "Array should have an Array type");
         auto array_type = std::static_pointer_cast<ArrayType>(type);
         size_t idx = 0;
         for (const auto &dimension : array_type->getDimensions()) {
-            stream << offset << "for (size_t i_" << idx << " = 0; i_" << idx
-                   << " < " << dimension << "; ++i_" << idx << ") \n";
-            offset += "    ";
+            stream << getIndent(idx + 1) << "for (size_t i_" << idx
+                   << " = 0; i_" << idx << " < " << dimension << "; ++i_"
+                   << idx << ") \n";
             idx++;
         }
-        stream << offset << array->getName(ctx) << " ";
+        stream << getIndent(idx + 1) << array->getName(ctx) << " ";
         for (size_t i = 0; i < idx; ++i)
             stream << "[i_" << i << "] ";
         stream << "= ";
-        auto init_val = array->getInitValues();
-        auto init_const = std::make_shared<ConstantExpr>(init_val);
-        init_const->emit(ctx, stream);
+        emitArrayInitVal(ctx, stream, array, idx);
         stream << ";\n";
     }
 }
 
 void ProgramGenerator::emitInit(std::shared_ptr<EmitCtx> ctx,
                                 std::ostream &stream) {
-    stream << "void init() {\n";
+    stream << "void init" << func_suffix << "() {\n";
+    // Timed runs call init() before each run of the test
+    if (Options::getInstance().hasTiming())
+        emitVarsReset(ctx, stream, ext_out_sym_tbl->getVars());
     emitArrayInit(ctx, stream, ext_inp_sym_tbl->getArrays());
     emitArrayInit(ctx, stream, ext_out_sym_tbl->getArrays());
     stream << "}\n\n";
@@ -157,7 +375,7 @@ void ProgramGenerator::emitInit(std::shared_ptr<EmitCtx> ctx,
 
 void ProgramGenerator::emitCheck(std::shared_ptr<EmitCtx> ctx,
                                  std::ostream &stream) {
-    stream << "void checksum() {\n";
+    stream << "void checksum" << func_suffix << "() {\n";
 
     Options &options = Options::getInstance();
 
@@ -166,18 +384,25 @@ void ProgramGenerator::emitCheck(std::shared_ptr<EmitCtx> ctx,
     if (options.isSYCL())
         ctx->setSYCLPrefix("app_");
 
+    size_t var_idx = 0;
     for (auto &var : ext_out_sym_tbl->getVars()) {
         std::string var_name = var->getName(ctx);
 
-        if (options.getCheckAlgo() == CheckAlgo::HASH ||
-            options.getCheckAlgo() == CheckAlgo::PRECOMPUTE) {
+        if (options.isLaneHashCheck()) {
+            // Variables are distributed over the lanes one by one
+            size_t lane = var_idx++ % HASH_LANES_NUM;
+            stream << "    hash_lanes[" << lane << "] = hash_lane(hash_lanes["
+                   << lane << "], " << var_name << ");\n";
+            if (options.isPrecomputeCheck())
+                hashLane(lane, var->getCurrentValue().getAbsValue().value);
+        }
+        else if (options.isHashCheck()) {
             stream << "    hash(&seed, " << var_name << ");\n";
-            if (options.getCheckAlgo() == CheckAlgo::PRECOMPUTE)
+            if (options.isPrecomputeCheck())
                 hash(var->getCurrentValue().getAbsValue().value);
         }
         else if (options.getCheckAlgo() == CheckAlgo::ASSERTS) {
-            auto const_val =
-                std::make_shared<ConstantExpr>(var->getCurrentValue());
+            auto const_val = makeIRNode<ConstantExpr>(var->getCurrentValue());
             stream << "    value_mismatch |= " << var_name << " != ";
             const_val->emit(ctx, stream);
             stream << ";\n";
@@ -190,25 +415,48 @@ void ProgramGenerator::emitCheck(std::shared_ptr<EmitCtx> ctx,
     ctx->setSYCLPrefix("");
 
     for (const auto &array : ext_out_sym_tbl->getArrays()) {
-        std::string offset = "    ";
+        if (options.isLaneHashCheck()) {
+            emitLaneHashArray(ctx, stream, array);
+            if (options.isPrecomputeCheck())
+                hashArray(array);
+            continue;
+        }
+
         auto type = array->getType();
         assert(type->isArrayType() && "Array should have an Array type");
         auto array_type = std::static_pointer_cast<ArrayType>(type);
+        const auto &cur_vals = std::get<0>(array->getCurrentValues());
+        if (options.getCheckAlgo() == CheckAlgo::ASSERTS &&
+            cur_vals.size() > 1) {
+            stream << "    static const "
+                   << array_type->getBaseType()->getName(ctx) << " "
+                   << array->getName(ctx) << "_cur [" << cur_vals.size()
+                   << "] = {";
+            for (size_t i = 0; i < cur_vals.size(); ++i) {
+                stream << (i != 0 ? ", " : "");
+                makeIRNode<ConstantExpr>(cur_vals[i])->emit(ctx, stream);
+            }
+            stream << "};\n";
+        }
         size_t idx = 0;
-        std::stringstream ss;
-        ss << array->getName(ctx) << " ";
         for (const auto &dimension : array_type->getDimensions()) {
-            stream << offset << "for (size_t i_" << idx << " = 0; i_" << idx
-                   << " < " << dimension << "; ++i_" << idx << ") \n";
-            ss << "[i_" << idx << "] ";
-            offset += "    ";
+            stream << getIndent(idx + 1) << "for (size_t i_" << idx
+                   << " = 0; i_" << idx << " < " << dimension << "; ++i_"
+                   << idx << ") \n";
             idx++;
         }
-
-        if (options.getCheckAlgo() == CheckAlgo::HASH ||
-            options.getCheckAlgo() == CheckAlgo::PRECOMPUTE) {
+        const std::string &offset = getIndent(idx + 1);
+        // Array element is referenced twice in asserts mode, so we write it
+        // directly to the stream every time instead of building a string
+        auto emit_arr_elem = [&stream, &array, &ctx, idx]() {
+            stream << array->getName(ctx) << " ";
+            for (size_t i = 0; i < idx; ++i)
+                stream << "[i_" << i << "] ";
+        };
+
+        if (options.isHashCheck()) {
             stream << offset << "hash(&seed, ";
-            if (options.getCheckAlgo() == CheckAlgo::PRECOMPUTE)
+            if (options.isPrecomputeCheck())
                 hashArray(array);
         }
         else if (options.getCheckAlgo() == CheckAlgo::ASSERTS)
@@ -216,32 +464,95 @@ void ProgramGenerator::emitCheck(std::shared_ptr<EmitCtx> ctx,
         else
             ERROR("Unsupported");
 
-        std::string arr_name = ss.str();
-        stream << arr_name;
+        emit_arr_elem();
 
         if (options.getCheckAlgo() == CheckAlgo::ASSERTS) {
-            auto const_val = std::make_shared<ConstantExpr>(
-                std::get<0>(array->getCurrentValues()));
             stream << "!= ";
-            const_val->emit(ctx, stream);
-            stream << " && " << arr_name << " != ";
-            const_val = std::make_shared<ConstantExpr>(array->getInitValues());
-            const_val->emit(ctx, stream);
+            // Lanes of the loop that has written the array store different
+            // values
+            if (cur_vals.size() > 1)
+                stream << array->getName(ctx) << "_cur [(i_" << idx - 1
+                       << " / "
+                       << std::get<2>(array->getCurrentValues()).back()
+                       << ") % " << cur_vals.size() << "]";
+            else
+                makeIRNode<ConstantExpr>(cur_vals.front())->emit(ctx, stream);
+            stream << " && ";
+            emit_arr_elem();
+            stream << " != ";
+            emitArrayInitVal(ctx, stream, array, idx);
         }
         else
             stream << ")";
         stream << ";\n";
     }
+
+    if (options.isLaneHashCheck()) {
+        stream << "    for (size_t lane = 0; lane < " << HASH_LANES_NUM
+               << "; ++lane)\n";
+        stream << "        hash(&seed, hash_lanes[lane] ^ (hash_lanes[lane] >> "
+                  "32));\n";
+        if (options.isPrecomputeCheck())
+            for (auto lane_val : hash_lanes)
+                hash(lane_val ^ (lane_val >> 32));
+    }
     stream << "}\n";
 }
 
-// This buffer tracks what input data we pass as a parameters to test functions
-static std::vector<std::string> pass_as_param_buffer;
-static bool any_vars_as_params = false;
-static bool any_arrays_as_params = false;
+// The innermost dimension is split into chunks of HASH_LANES_NUM elements.
+// Every chunk updates all the lanes at once and the tail goes to the first
+// lanes, so an element always goes to the lane (innermost index % lanes num).
+void ProgramGenerator::emitLaneHashArray(std::shared_ptr<EmitCtx> ctx,
+                                         std::ostream &stream,
+                                         const std::shared_ptr<Array> &array) {
+    auto type = array->getType();
+    assert(type->isArrayType() && "Array should have an Array type");
+    auto array_type = std::static_pointer_cast<ArrayType>(type);
+    const auto &dims = array_type->getDimensions();
+    size_t last_idx = dims.size() - 1;
+    for (size_t idx = 0; idx < last_idx; ++idx)
+        stream << getIndent(idx + 1) << "for (size_t i_" << idx << " = 0; i_"
+               << idx << " < " << dims[idx] << "; ++i_" << idx << ") "
+               << (idx + 1 == last_idx ? "{" : "") << "\n";
+
+    size_t last_dim = dims[last_idx];
+    size_t chunks_end = last_dim - last_dim % HASH_LANES_NUM;
+    const std::string &offset = getIndent(last_idx + 1);
+    std::string iter_name = "i_" + std::to_string(last_idx);
+    auto emit_update = [&stream, &array, &ctx, &iter_name,
+                        last_idx](const std::string &lane,
+                                  const std::string &last_subs) {
+        stream << "hash_lanes[" << lane << "] = hash_lane(hash_lanes[" << lane
+               << "], " << array->getName(ctx) << " ";
+        for (size_t i = 0; i < last_idx; ++i)
+            stream << "[i_" << i << "] ";
+        stream << "[" << last_subs << "]);\n";
+    };
+
+    if (chunks_end != 0) {
+        stream << offset << "for (size_t " << iter_name << " = 0; "
+               << iter_name << " < " << chunks_end << "; " << iter_name
+               << " += " << HASH_LANES_NUM << ")\n";
+        stream << offset << "    for (size_t lane = 0; lane < "
+               << HASH_LANES_NUM << "; ++lane)\n";
+        stream << offset << "        ";
+        emit_update("lane", iter_name + " + lane");
+    }
+    if (chunks_end != last_dim) {
+        stream << offset << "for (size_t " << iter_name << " = " << chunks_end
+               << "; " << iter_name << " < " << last_dim << "; ++"
+               << iter_name << ")\n";
+        stream << offset << "    ";
+        emit_update(iter_name + " - " + std::to_string(chunks_end),
+                    iter_name);
+    }
+
+    if (last_idx != 0)
+        stream << getIndent(last_idx) << "}\n";
+}
 
 static void emitVarExtDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                           std::vector<std::shared_ptr<ScalarVar>> vars,
+                           const std::vector<std::shared_ptr<ScalarVar>> &vars,
                            bool inp_category) {
     auto emit_pol = ctx->getEmitPolicy();
     Options &options = Options::getInstance();
@@ -273,7 +584,7 @@ static void emitVarExtDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
 }
 
 static void emitArrayExtDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                             std::vector<std::shared_ptr<Array>> arrays,
+                             const std::vector<std::shared_ptr<Array>> &arrays,
                              bool inp_category) {
     auto emit_pol = ctx->getEmitPolicy();
     Options &options = Options::getInstance();
@@ -354,9 +665,10 @@ void ProgramGenerator::emitExtDecl(std::shared_ptr<EmitCtx> ctx,
 
 static std::string placeSep(bool cond) { return cond ? ", " : ""; }
 
-static bool emitVarFuncParam(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                             std::vector<std::shared_ptr<ScalarVar>> vars,
-                             bool emit_type, bool ispc_type) {
+static bool
+emitVarFuncParam(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
+                 const std::vector<std::shared_ptr<ScalarVar>> &vars,
+                 bool emit_type, bool ispc_type) {
     bool emit_any = false;
     Options &options = Options::getInstance();
     if (options.isSYCL())
@@ -378,10 +690,11 @@ static bool emitVarFuncParam(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
     return emit_any;
 }
 
-static void emitArrayFuncParam(std::shared_ptr<EmitCtx> ctx,
-                               std::ostream &stream, bool prev_category_exist,
-                               std::vector<std::shared_ptr<Array>> arrays,
-                               bool emit_type, bool ispc_type, bool emit_dims) {
+static void
+emitArrayFuncParam(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
+                   bool prev_category_exist,
+                   const std::vector<std::shared_ptr<Array>> &arrays,
+                   bool emit_type, bool ispc_type, bool emit_dims) {
     bool first = true;
     Options &options = Options::getInstance();
     for (auto &array : arrays) {
@@ -407,8 +720,8 @@ static void emitArrayFuncParam(std::shared_ptr<EmitCtx> ctx,
 }
 
 void emitSYCLBuffers(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                     std::string offset,
-                     std::vector<std::shared_ptr<ScalarVar>> vars) {
+                     const std::string &offset,
+                     const std::vector<std::shared_ptr<ScalarVar>> &vars) {
     Options &options = Options::getInstance();
     for (auto &var : vars) {
         if (!options.getAllowDeadData() && var->getIsDead())
@@ -421,8 +734,8 @@ void emitSYCLBuffers(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
 }
 
 void emitSYCLAccessors(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                       std::string offset,
-                       std::vector<std::shared_ptr<ScalarVar>> vars,
+                       const std::string &offset,
+                       const std::vector<std::shared_ptr<ScalarVar>> &vars,
                        bool is_inp) {
     Options &options = Options::getInstance();
     for (auto &var : vars) {
@@ -434,8 +747,8 @@ void emitSYCLAccessors(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
     }
 }
 
-void ProgramGenerator::emitTest(std::shared_ptr<EmitCtx> ctx,
-                                std::ostream &stream) {
+void ProgramGenerator::emitTestHeaders(std::shared_ptr<EmitCtx> ctx,
+                                       std::ostream &stream) {
     Options &options = Options::getInstance();
     stream << "#include \"init.h\"\n";
     if (options.isC()) {
@@ -450,12 +763,16 @@ void ProgramGenerator::emitTest(std::shared_ptr<EmitCtx> ctx,
         stream << "    #include <CL/sycl/intel/fpga_extensions.hpp>\n";
         stream << "#endif\n";
     }
+}
 
+void ProgramGenerator::emitTest(std::shared_ptr<EmitCtx> ctx,
+                                std::ostream &stream) {
+    Options &options = Options::getInstance();
     if (options.isISPC()) {
         ctx->setIspcTypes(true);
         stream << "export ";
     }
-    stream << "void test(";
+    stream << "void test" << func_suffix << "(";
 
     bool emit_any = emitVarFuncParam(ctx, stream, ext_inp_sym_tbl->getVars(),
                                      true, options.isISPC());
@@ -490,7 +807,8 @@ void ProgramGenerator::emitTest(std::shared_ptr<EmitCtx> ctx,
                           ext_inp_sym_tbl->getVars(), true);
         emitSYCLAccessors(ctx, stream, "            ",
                           ext_out_sym_tbl->getVars(), false);
-        stream << "            cgh.single_task<class test_func>([=] ()\n";
+        stream << "            cgh.single_task<class test_func" << func_suffix
+               << ">([=] ()\n";
     }
 
     if (options.isSYCL())
@@ -507,13 +825,13 @@ void ProgramGenerator::emitTest(std::shared_ptr<EmitCtx> ctx,
     ctx->setIspcTypes(false);
 }
 
-void ProgramGenerator::emitMain(std::shared_ptr<EmitCtx> ctx,
-                                std::ostream &stream) {
+void ProgramGenerator::emitTestProto(std::shared_ptr<EmitCtx> ctx,
+                                     std::ostream &stream) {
     Options &options = Options::getInstance();
     if (options.isISPC())
         stream << "extern \"C\" { ";
 
-    stream << "void test(";
+    stream << "void test" << func_suffix << "(";
 
     bool emit_any =
         emitVarFuncParam(ctx, stream, ext_inp_sym_tbl->getVars(), true, false);
@@ -524,20 +842,85 @@ void ProgramGenerator::emitMain(std::shared_ptr<EmitCtx> ctx,
     if (options.isISPC())
         stream << " }\n";
     stream << "\n\n";
-    stream << "int main() {\n";
-    stream << "    init();\n";
-    stream << "    test(";
+}
+
+void ProgramGenerator::emitTestCall(std::shared_ptr<EmitCtx> ctx,
+                                    std::ostream &stream) {
+    stream << "test" << func_suffix << "(";
 
-    emit_any =
+    bool emit_any =
         emitVarFuncParam(ctx, stream, ext_inp_sym_tbl->getVars(), false, false);
 
     emitArrayFuncParam(ctx, stream, emit_any, ext_inp_sym_tbl->getArrays(),
                        false, false, false);
 
     stream << ");\n";
+}
+
+void ProgramGenerator::emitMain(std::shared_ptr<EmitCtx> ctx,
+                                std::ostream &stream) {
+    Options &options = Options::getInstance();
+    emitTestProto(ctx, stream);
+    stream << "int main() {\n";
+    // Children of the fork server start with initialized data. Only timed
+    // runs initialize it once again.
+    if (options.getForkServer())
+        stream << "    init();\n    fork_server();\n";
+    size_t timing_runs = options.getTimingRuns();
+    std::string offset = getIndent(1);
+    if (options.getPerfTime() != 0)
+        stream << offset << "unsigned long long int reps = 0;\n";
+    if (timing_runs != 0) {
+        stream << offset << "static unsigned long long int times["
+               << timing_runs << "];\n";
+        stream << offset << "for (unsigned long long int run = 0; run < "
+               << timing_runs << "ULL; ++run) {\n";
+        offset = getIndent(2);
+    }
+    if (timing_runs != 0 || !options.getForkServer())
+        stream << offset << "init();\n";
+    if (timing_runs != 0)
+        stream << offset << "unsigned long long int start = get_time_ns();\n";
+    // test() only reads the inputs, so repeated calls produce the same result
+    size_t perf_reps = options.getPerfReps();
+    size_t perf_time = options.getPerfTime();
+    std::string call_offset = offset;
+    if (perf_time != 0) {
+        // The calls are repeated in groups of perf_reps until the time
+        // budget is spent
+        if (timing_runs != 0)
+            stream << offset << "reps = 0;\n";
+        stream << offset
+               << "unsigned long long int perf_start = get_time_ns();\n";
+        stream << offset << "do {\n";
+        call_offset += getIndent(1);
+    }
+    if (perf_reps > 1)
+        stream << call_offset << "for (unsigned long long rep = 0; rep < "
+               << perf_reps << "ULL; ++rep)\n"
+               << getIndent(1);
+    stream << call_offset;
+    emitTestCall(ctx, stream);
+    if (perf_time != 0) {
+        stream << call_offset << "reps += " << perf_reps << "ULL;\n";
+        stream << offset << "} while (get_time_ns() - perf_start < "
+               << perf_time * 1000000 << "ULL);\n";
+    }
+    std::string reps_str =
+        perf_time != 0 ? "reps" : std::to_string(perf_reps) + "ULL";
+    if (timing_runs != 0) {
+        stream << offset << "times[run] = (get_time_ns() - start) / "
+               << reps_str << ";\n";
+        stream << getIndent(1) << "}\n";
+    }
     stream << "    checksum();\n";
     stream << "    printf(\"%llu\\n\", seed);\n";
-    if (options.getCheckAlgo() == CheckAlgo::PRECOMPUTE) {
+    if (timing_runs != 0)
+        stream << "    report_time(times, " << timing_runs << "ULL);\n";
+    // Like the time report, it goes to stderr
+    if (options.getPerfTime() != 0)
+        stream << "    fprintf(stderr, \"reps: %llu\\n\", reps);\n";
+    if (options.isPrecomputeCheck()) {
         stream << "    if (seed != " << hash_seed << "ULL) \n";
         stream << "        printf(\"ERROR: hash mismatch\\n\");\n";
     }
@@ -548,59 +931,211 @@ void ProgramGenerator::emitMain(std::shared_ptr<EmitCtx> ctx,
     stream << "}\n";
 }
 
-void ProgramGenerator::emit() {
+static void writeBundleFile(std::ostream &stream,
+                            const std::string &file_name, OutputBuffer &buf) {
+    stream << "/*FILE " << file_name << " " << buf.getSize() << "*/\n";
+    stream.write(buf.getData(), static_cast<std::streamsize>(buf.getSize()));
+}
+
+// We need to narrow options if we were asked to do so
+static void narrowEmitOptions(std::shared_ptr<EmitCtx> ctx) {
     Options &options = Options::getInstance();
-    auto emit_ctx = std::make_shared<EmitCtx>();
-    // We need to narrow options if we were asked to do so
     if (options.getUniqueAlignSize() &&
         options.getAlignSize() == AlignmentSize::MAX_ALIGNMENT_SIZE) {
-        AlignmentSize align_size = rand_val_gen->getRandId(
-            emit_ctx->getEmitPolicy()->align_size_distr);
+        AlignmentSize align_size =
+            rand_val_gen->getRandId(ctx->getEmitPolicy()->align_size_distr);
         options.setAlignSize(align_size);
     }
+}
+
+static std::string getFuncFileExt() {
+    Options &options = Options::getInstance();
+    if (options.isC())
+        return "c";
+    return options.isISPC() ? "ispc" : "cpp";
+}
+
+static std::string getDriverFileExt() {
+    return Options::getInstance().isC() ? "c" : "cpp";
+}
 
-    std::ofstream out_file;
+void ProgramGenerator::emitFiles(const FileWriter &write_file) {
+    Options &options = Options::getInstance();
+    PhaseTimer emission_timer(GenPhase::EMISSION);
+    auto emit_ctx = std::make_shared<EmitCtx>();
+    narrowEmitOptions(emit_ctx);
 
-    // TODO: probably won't work on Windows
-    std::string out_dir = options.getOutDir() + "/";
+    // All the files are emitted to the same memory buffer one by one. It is
+    // reused by all the tests of the thread, so it grows only once.
+    static thread_local OutputBuffer out_buf;
+    out_buf.clear();
+    std::ostream out_file(&out_buf);
 
-    auto open_file = [&out_file, &out_dir](std::string file_name) {
-        out_file.open(out_dir + file_name);
-        if (!out_file)
-            ERROR(std::string("Can't open file ") + file_name);
+    auto finish_file = [&write_file](const std::string &file_name) {
+        write_file(file_name, out_buf);
+        out_buf.clear();
     };
 
-    open_file("init.h");
     emitExtDecl(emit_ctx, out_file);
-    out_file.close();
+    finish_file("init.h");
 
-    std::string func_file_ext, driver_file_ext;
-    if (options.isC()) {
-        func_file_ext = "c";
-        driver_file_ext = "c";
-    }
-    else if (options.isCXX() || options.isSYCL()) {
-        func_file_ext = "cpp";
-        driver_file_ext = "cpp";
-    }
-    else if (options.isISPC()) {
-        func_file_ext = "ispc";
-        driver_file_ext = "cpp";
-    }
-    open_file("func." + func_file_ext);
     out_file << "/*\n";
     options.dump(out_file);
     out_file << "*/\n";
+    emitTestHeaders(emit_ctx, out_file);
     emitTest(emit_ctx, out_file);
-    out_file.close();
+    finish_file("func." + getFuncFileExt());
 
-    open_file("driver." + driver_file_ext);
     emitCheckFunc(out_file);
     emitDecl(emit_ctx, out_file);
     emitInit(emit_ctx, out_file);
     emitCheck(emit_ctx, out_file);
+    emitTimingFunc(out_file);
+    emitForkServerFunc(out_file);
     emitMain(emit_ctx, out_file);
-    out_file.close();
+    finish_file("driver." + getDriverFileExt());
+
+    // Statistics is a part of the output, but it shouldn't count itself
+    emission_timer.stop();
+    if (options.getStatsFormat() == StatsFormat::JSON) {
+        Statistics::getInstance().dumpJSON(out_file, options.getSeed());
+        finish_file("stats.json");
+    }
+}
+
+// Passes the writer that matches the output mode to emit_files
+static void
+writeOutput(const std::function<void(const ProgramGenerator::FileWriter &)>
+                &emit_files) {
+    Options &options = Options::getInstance();
+    if (options.getOutMode() == OutMode::STDOUT) {
+        emit_files([](const std::string &file_name, OutputBuffer &buf) {
+            writeBundleFile(std::cout, file_name, buf);
+        });
+        std::cout.flush();
+        return;
+    }
+
+    std::string out_dir = options.getOutDir();
+    emit_files([&out_dir](const std::string &file_name, OutputBuffer &buf) {
+        buf.writeToFile(joinPath(out_dir, file_name));
+    });
+}
+
+void ProgramGenerator::emit() {
+    writeOutput([this](const FileWriter &write_file) {
+        emitFiles(write_file);
+    });
+}
+
+void ProgramGenerator::emitBundle(std::ostream &stream) {
+    emitFiles([&stream](const std::string &file_name, OutputBuffer &buf) {
+        writeBundleFile(stream, file_name, buf);
+    });
+}
+
+void ProgramGenerator::emitUnityHeaders(std::ostream &func,
+                                        std::ostream &driver) {
+    emitTestHeaders(std::make_shared<EmitCtx>(), func);
+    emitCheckFunc(driver);
+}
+
+void ProgramGenerator::emitUnityParts(std::ostream &ext_decl,
+                                      std::ostream &func,
+                                      std::ostream &driver) {
+    Options &options = Options::getInstance();
+    PhaseTimer emission_timer(GenPhase::EMISSION);
+    auto emit_ctx = std::make_shared<EmitCtx>();
+    narrowEmitOptions(emit_ctx);
+
+    // The order is the same as for a regular test, so that the random
+    // choices of the emission match it
+    emitExtDecl(emit_ctx, ext_decl);
+
+    func << "\n/*\n";
+    options.dump(func);
+    func << "*/\n";
+    emitTest(emit_ctx, func);
+
+    driver << "\n";
+    emitDecl(emit_ctx, driver);
+    emitInit(emit_ctx, driver);
+    emitCheck(emit_ctx, driver);
+    driver << "\n";
+    emitUnityRun(emit_ctx, driver);
+}
+
+// Tests of a unity build share the checksum variables, so each of them
+// starts from scratch
+void ProgramGenerator::emitUnityRun(std::shared_ptr<EmitCtx> ctx,
+                                    std::ostream &stream) {
+    Options &options = Options::getInstance();
+    std::string seed_str = std::to_string(options.getSeed());
+    emitTestProto(ctx, stream);
+    stream << "void run" << func_suffix << "() {\n";
+    stream << "    init" << func_suffix << "();\n";
+    size_t perf_reps = options.getPerfReps();
+    if (perf_reps > 1)
+        stream << "    for (unsigned long long rep = 0; rep < " << perf_reps
+               << "ULL; ++rep)\n"
+               << getIndent(1);
+    stream << "    ";
+    emitTestCall(ctx, stream);
+    stream << "    seed = 0;\n";
+    if (options.isLaneHashCheck())
+        stream << "    for (size_t lane = 0; lane < " << HASH_LANES_NUM
+               << "; ++lane)\n"
+               << "        hash_lanes[lane] = 0;\n";
+    if (options.getCheckAlgo() == CheckAlgo::ASSERTS)
+        stream << "    value_mismatch = " << (options.isC() ? "0" : "false")
+               << ";\n";
+    stream << "    checksum" << func_suffix << "();\n";
+    stream << "    printf(\"" << seed_str << ": %llu\\n\", seed);\n";
+    if (options.isPrecomputeCheck()) {
+        stream << "    if (seed != " << hash_seed << "ULL) \n";
+        stream << "        printf(\"" << seed_str
+               << ": ERROR: hash mismatch\\n\");\n";
+    }
+    if (options.getCheckAlgo() == CheckAlgo::ASSERTS) {
+        stream << "    if (value_mismatch) \n";
+        stream << "        printf(\"" << seed_str
+               << ": ERROR: value mismatch\\n\");\n";
+    }
+    stream << "}\n";
+}
+
+UnityGenerator::UnityGenerator()
+    : ext_decl(&ext_decl_buf), func(&func_buf), driver(&driver_buf),
+      stats(&stats_buf), tests_num(0) {
+    ProgramGenerator::emitUnityHeaders(func, driver);
+}
+
+void UnityGenerator::addTest() {
+    ProgramGenerator new_program(tests_num);
+    new_program.emitUnityParts(ext_decl, func, driver);
+    if (Options::getInstance().getStatsFormat() == StatsFormat::JSON) {
+        stats << (tests_num == 0 ? "[\n" : ",\n");
+        Statistics::getInstance().dumpJSON(stats,
+                                           Options::getInstance().getSeed());
+    }
+    tests_num++;
+}
+
+void UnityGenerator::emit() {
+    driver << "\nint main() {\n";
+    for (size_t i = 0; i < tests_num; ++i)
+        driver << "    run_" << i << "();\n";
+    driver << "}\n";
+
+    writeOutput([this](const ProgramGenerator::FileWriter &write_file) {
+        write_file("init.h", ext_decl_buf);
+        write_file("func." + getFuncFileExt(), func_buf);
+        write_file("driver." + getDriverFileExt(), driver_buf);
+        if (Options::getInstance().getStatsFormat() == StatsFormat::JSON) {
+            stats << "]\n";
+            write_file("stats.json", stats_buf);
+        }
+    });
 }
 
 void ProgramGenerator::hash(unsigned long long int const v) {
@@ -609,39 +1144,135 @@ void ProgramGenerator::hash(unsigned long long int const v) {
     hash_seed ^= v + 0x9e3779b9 + (hash_seed << 6) + (hash_seed >> 2);
 }
 
+void ProgramGenerator::hashLane(size_t lane, unsigned long long int const v) {
+    // This function has to be exactly the same as the emitted hash_lane().
+    // Only lane-precompute needs it, so it is the update that is affine in
+    // the lane.
+    unsigned long long int &lane_val = hash_lanes.at(lane);
+    lane_val = lane_val * LANE_HASH_MUL + mix64(v);
+}
+
+// An element of the array has the current value only if all of its indices
+// are inside the span and are multiples of the steps
+static inline bool isCurArrayElem(size_t idx, size_t span, size_t step) {
+    return idx < span && idx % step == 0;
+}
+
+// The lane-precompute hash is an affine function of the lane value, so any
+// sequence of updates of a lane is an affine function as well. Repeated
+// sequences are combined with exponentiation by squaring.
+struct LaneUpdate {
+    unsigned long long int mul;
+    unsigned long long int add;
+};
+using LanesUpdate = std::array<LaneUpdate, ProgramGenerator::HASH_LANES_NUM>;
+
+static LanesUpdate getIdentityUpdate() {
+    LanesUpdate ret;
+    ret.fill({1, 0});
+    return ret;
+}
+
+// Applies the first update and then the second one
+static LanesUpdate composeUpdates(const LanesUpdate &first,
+                                  const LanesUpdate &second) {
+    LanesUpdate ret;
+    for (size_t i = 0; i < ret.size(); ++i) {
+        ret[i].mul = first[i].mul * second[i].mul;
+        ret[i].add = first[i].add * second[i].mul + second[i].add;
+    }
+    return ret;
+}
+
+// Applies the update the given number of times
+static LanesUpdate powUpdate(LanesUpdate update, size_t num) {
+    LanesUpdate ret = getIdentityUpdate();
+    for (; num != 0; num >>= 1) {
+        if (num & 1)
+            ret = composeUpdates(ret, update);
+        update = composeUpdates(update, update);
+    }
+    return ret;
+}
+
 void ProgramGenerator::hashArray(std::shared_ptr<Array> const &arr) {
+    PhaseTimer timer(GenPhase::PRECOMPUTE);
     assert(arr->getType()->isArrayType() && "Array should have array type");
     auto arr_type = std::static_pointer_cast<ArrayType>(arr->getType());
-    std::vector<size_t> idx_vec(arr_type->getDimensions().size(), 0);
-    auto &dims = arr_type->getDimensions();
-    uint64_t init_val = arr->getInitValues().getAbsValue().value;
-    uint64_t cur_val = std::get<0>(arr->getCurrentValues()).getAbsValue().value;
-    std::vector<size_t> steps = std::get<2>(arr->getCurrentValues());
-    hashArrayStep(arr, dims, idx_vec, 0, false, init_val, cur_val, steps);
-}
-
-void ProgramGenerator::hashArrayStep(std::shared_ptr<Array> const &arr,
-                                     std::vector<size_t> &dims,
-                                     std::vector<size_t> &idx_vec,
-                                     size_t cur_idx, bool has_to_use_init_val,
-                                     uint64_t &init_val, uint64_t &cur_val,
-                                     std::vector<size_t> &steps) {
-    size_t vec_last_idx = idx_vec.size() - 1;
-    size_t cur_val_size = std::get<1>(arr->getCurrentValues())[cur_idx];
-    size_t cur_dim = dims[cur_idx];
-    size_t cur_step = steps[cur_idx];
-
-    for (size_t i = 0; i < cur_dim; ++i) {
-        has_to_use_init_val |= (i >= cur_val_size);
-        if (cur_idx != vec_last_idx) {
-            idx_vec[cur_idx] = i;
-            hashArrayStep(arr, dims, idx_vec, cur_idx + 1,
-                          has_to_use_init_val || (i % cur_step != 0), init_val,
-                          cur_val, steps);
+    const auto &dims = arr_type->getDimensions();
+    const auto &cur_vals = arr->getCurrentValues();
+    const auto &spans = std::get<1>(cur_vals);
+    const auto &steps = std::get<2>(cur_vals);
+    size_t last_idx = dims.size() - 1;
+    auto get_init_val = [&arr](size_t idx) -> uint64_t {
+        return arr->getInitValue(idx).getAbsValue().value;
+    };
+    auto get_cur_val = [&arr](size_t idx) -> uint64_t {
+        return arr->getCurrentValue(idx).getAbsValue().value;
+    };
+
+    if (!Options::getInstance().isLaneHashCheck()) {
+        // The hash can't be combined, so we visit every element. The outer
+        // indices are decoded from the number of the innermost row.
+        size_t rows_num = 1;
+        for (size_t i = 0; i < last_idx; ++i)
+            rows_num *= dims[i];
+        for (size_t row = 0; row < rows_num; ++row) {
+            bool is_init_row = false;
+            size_t rest = row;
+            for (size_t i = last_idx; i > 0; --i) {
+                is_init_row |=
+                    !isCurArrayElem(rest % dims[i - 1], spans[i - 1],
+                                    steps[i - 1]);
+                rest /= dims[i - 1];
+            }
+            for (size_t i = 0; i < dims[last_idx]; ++i)
+                hash(!is_init_row && isCurArrayElem(i, spans[last_idx],
+                                                    steps[last_idx])
+                         ? get_cur_val(i)
+                         : get_init_val(i));
         }
-        else {
-            hash(has_to_use_init_val || (i % cur_step != 0) ? init_val
-                                                            : cur_val);
+        return;
+    }
+
+    // Updates of the innermost row, when all the outer indices select
+    // the current value and when they don't
+    LanesUpdate cur_update = getIdentityUpdate();
+    LanesUpdate init_update = getIdentityUpdate();
+    for (size_t i = 0; i < dims[last_idx]; ++i) {
+        LaneUpdate &cur_lane = cur_update[i % HASH_LANES_NUM];
+        LaneUpdate &init_lane = init_update[i % HASH_LANES_NUM];
+        uint64_t init_val = get_init_val(i);
+        uint64_t val = isCurArrayElem(i, spans[last_idx], steps[last_idx])
+                           ? get_cur_val(i)
+                           : init_val;
+        cur_lane = {cur_lane.mul * LANE_HASH_MUL,
+                    cur_lane.add * LANE_HASH_MUL + mix64(val)};
+        init_lane = {init_lane.mul * LANE_HASH_MUL,
+                     init_lane.add * LANE_HASH_MUL + mix64(init_val)};
+    }
+
+    // Every outer dimension is a sequence of subarrays with the current
+    // value at each step inside the span and the initial value elsewhere
+    for (size_t i = last_idx; i > 0; --i) {
+        size_t dim = dims[i - 1];
+        size_t step = steps[i - 1];
+        size_t cur_num = (std::min(spans[i - 1], dim) + step - 1) / step;
+        LanesUpdate new_init_update = powUpdate(init_update, dim);
+        if (cur_num != 0) {
+            LanesUpdate period =
+                composeUpdates(cur_update, powUpdate(init_update, step - 1));
+            LanesUpdate tail =
+                powUpdate(init_update, dim - 1 - (cur_num - 1) * step);
+            cur_update = composeUpdates(
+                composeUpdates(powUpdate(period, cur_num - 1), cur_update),
+                tail);
         }
+        else
+            cur_update = new_init_update;
+        init_update = new_init_update;
     }
+
+    for (size_t i = 0; i < HASH_LANES_NUM; ++i)
+        hash_lanes[i] = hash_lanes[i] * cur_update[i].mul + cur_update[i].add;
 }
@@ -17,24 +17,76 @@ limitations under the License.
 #pragma once
 
 #include "stmt.h"
+#include "utils.h"
 
+#include <array>
+#include <functional>
 #include <memory>
+#include <string>
 
 namespace yarpgen {
 
+// Creates the random generator of the current thread for a new test and
+// applies the mutation options to it. Zero seed means that it is random.
+void initRandGen(uint64_t seed);
+
 class ProgramGenerator {
   public:
     ProgramGenerator();
+    // Test number idx of a unity build. Its data and functions get unique
+    // names, so that it can share the files with other tests.
+    explicit ProgramGenerator(size_t unity_idx);
+    // IR of the test is allocated in an arena that is rewound when the last
+    // node dies, so we have to drop all the references to it
+    ~ProgramGenerator();
+    // Writes the test to out-dir or to stdout, depending on the output mode
     void emit();
+    // Writes all files of the test to the stream as a single bundle.
+    // Each file is preceded by a "/*FILE <name> <size>*/" line, where size is
+    // the number of bytes of the file that follow it.
+    void emitBundle(std::ostream &stream);
+
+    // Receives the name and the contents of each generated file
+    using FileWriter = std::function<void(const std::string &, OutputBuffer &)>;
+    void emitFiles(const FileWriter &write_file);
+
+    // Appends the test to the files of a unity build. The driver gets
+    // run_<idx>() function that checks the test and prints its result.
+    void emitUnityParts(std::ostream &ext_decl, std::ostream &func,
+                        std::ostream &driver);
+    // Parts of the files that are shared by all tests of a unity build
+    static void emitUnityHeaders(std::ostream &func, std::ostream &driver);
+
+    // The value that the test is expected to print. It is known only for
+    // precompute check algorithm and only after the test has been emitted.
+    uint64_t getExpectedHash() { return hash_seed; }
+
+    // Parameters of the lane hash check
+    static const size_t HASH_LANES_NUM = 8;
+    static const unsigned long long int LANE_HASH_MUL = 0x9e3779b97f4a7c15ULL;
 
   private:
-    void emitCheckFunc(std::ostream &stream);
+    ProgramGenerator(const std::string &name_prefix, std::string _func_suffix);
+
+    static void emitCheckFunc(std::ostream &stream);
+    static void emitTestHeaders(std::shared_ptr<EmitCtx> ctx,
+                                std::ostream &stream);
+    void emitTimingFunc(std::ostream &stream);
+    void emitForkServerFunc(std::ostream &stream);
     void emitDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
     void emitInit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
     void emitCheck(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
+    void emitLaneHashArray(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
+                           const std::shared_ptr<Array> &array);
     void emitExtDecl(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
     void emitTest(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
+    void emitTestProto(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
+    void emitTestCall(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
     void emitMain(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
+    void emitUnityRun(std::shared_ptr<EmitCtx> ctx, std::ostream &stream);
+
+    // Empty for a regular test and "_<idx>" for a test of a unity build
+    std::string func_suffix;
 
     std::shared_ptr<SymbolTable> ext_inp_sym_tbl;
     std::shared_ptr<SymbolTable> ext_out_sym_tbl;
@@ -42,12 +94,36 @@ class ProgramGenerator {
 
     unsigned long long int hash_seed;
     void hash(unsigned long long int const v);
+    // Accumulators of the lane hash. Every array element goes to the lane
+    // that is selected by its innermost index.
+    std::array<unsigned long long int, HASH_LANES_NUM> hash_lanes;
+    void hashLane(size_t lane, unsigned long long int const v);
     void hashArray(std::shared_ptr<Array> const &arr);
-    void hashArrayStep(std::shared_ptr<Array> const &arr,
-                       std::vector<size_t> &dims, std::vector<size_t> &idx_vec,
-                       size_t cur_idx, bool has_to_use_init_val,
-                       uint64_t &init_val, uint64_t &cur_val,
-                       std::vector<size_t> &steps);
+};
+
+// Bundles several tests into a single set of files, so that the compiler is
+// started once for all of them. The driver calls the tests one by one and
+// prints "<seed>: <checksum>" line for each of them, so that a miscompare
+// can be traced back to the test that causes it.
+class UnityGenerator {
+  public:
+    UnityGenerator();
+    // Generates a test with the current random generator and adds it to the
+    // bundle. The test can be reproduced separately with the same seed.
+    void addTest();
+    // Writes the bundle to out-dir or to stdout, depending on the output mode
+    void emit();
+
+  private:
+    OutputBuffer ext_decl_buf;
+    OutputBuffer func_buf;
+    OutputBuffer driver_buf;
+    OutputBuffer stats_buf;
+    std::ostream ext_decl;
+    std::ostream func;
+    std::ostream driver;
+    std::ostream stats;
+    size_t tests_num;
 };
 
 } // namespace yarpgen
@@ -16,5 +16,159 @@ limitations under the License.
 //////////////////////////////////////////////////////////////////////////////
 
 #include "statistics.h"
+#include "arena.h"
+#include <cassert>
 
 using namespace yarpgen;
+
+static const char *phase_names[] = {
+    "structure",
+    "population",
+    "ub_elimination",
+    "precompute",
+    "emission",
+};
+static_assert(sizeof(phase_names) / sizeof(phase_names[0]) ==
+                  static_cast<size_t>(GenPhase::MAX_GEN_PHASE),
+              "Every generation phase needs a name");
+
+static const char *ub_names[] = {
+    "NoUB",
+    "Uninit",
+    "SignOvf",
+    "SignOvfMin",
+    "ZeroDiv",
+    "ShiftRhsNeg",
+    "ShiftRhsLarge",
+    "NegShift",
+    "NoMemeber",
+    "OutOfBounds",
+};
+static_assert(sizeof(ub_names) / sizeof(ub_names[0]) ==
+                  static_cast<size_t>(UBKind::MaxUB),
+              "Every UB kind needs a name");
+
+// MAX_EXPR_KIND and MAX_STMT_KIND stand for the base classes
+static const char *ir_node_names[] = {
+    "CONST",
+    "SCALAR_VAR_USE",
+    "ITER_USE",
+    "ARRAY_USE",
+    "SUBSCRIPT",
+    "TYPE_CAST",
+    "ASSIGN",
+    "UNARY",
+    "BINARY",
+    "TERNARY",
+    "CALL",
+    "MAX_EXPR_KIND",
+    "EXPR",
+    "DECL",
+    "BLOCK",
+    "SCOPE",
+    "LOOP_SEQ",
+    "LOOP_NEST",
+    "IF_ELSE",
+    "STUB",
+    "MAX_STMT_KIND",
+};
+static_assert(sizeof(ir_node_names) / sizeof(ir_node_names[0]) ==
+                  static_cast<size_t>(IRNodeKind::MAX_STMT_KIND) + 1,
+              "Every IR node kind needs a name");
+
+void Statistics::enterPhase(GenPhase phase) {
+    if (phase_depth.at(static_cast<size_t>(phase))++ != 0)
+        return;
+    chargeCurPhase();
+    phase_stack.push_back(phase);
+}
+
+void Statistics::exitPhase(GenPhase phase) {
+    if (--phase_depth.at(static_cast<size_t>(phase)) != 0)
+        return;
+    chargeCurPhase();
+    assert(phase_stack.back() == phase && "Phases have to be nested");
+    phase_stack.pop_back();
+}
+
+void Statistics::chargeCurPhase() {
+    auto now = std::chrono::steady_clock::now();
+    size_t allocs = Arena::getInstance().getTotalAllocs();
+    if (!phase_stack.empty()) {
+        auto idx = static_cast<size_t>(phase_stack.back());
+        phase_time.at(idx) += now - segment_start;
+        phase_ir_allocs.at(idx) += allocs - segment_allocs;
+    }
+    segment_start = now;
+    segment_allocs = allocs;
+}
+
+void Statistics::reset() {
+    stmt_num = 0;
+    ub_num.fill(0);
+    ir_node_num.fill(0);
+    ir_node_live.fill(0);
+    ir_node_peak.fill(0);
+    phase_depth.fill(0);
+    phase_time.fill(std::chrono::nanoseconds(0));
+    phase_ir_allocs.fill(0);
+    phase_stack.clear();
+    Arena &arena = Arena::getInstance();
+    ir_allocs_base = arena.getTotalAllocs();
+    arena.resetPeakLiveAllocs();
+}
+
+void Statistics::dumpJSON(std::ostream &stream, uint64_t seed) {
+    Arena &arena = Arena::getInstance();
+    stream << "{\n";
+    stream << "  \"seed\": " << seed << ",\n";
+    stream << "  \"stmt_num\": " << stmt_num << ",\n";
+
+    stream << "  \"phases\": {\n";
+    for (size_t i = 0; i < PHASE_NUM; ++i) {
+        std::chrono::duration<double, std::milli> time_ms = phase_time[i];
+        stream << "    \"" << phase_names[i] << "\": {\"self_time_ms\": "
+               << time_ms.count() << ", \"ir_allocs\": " << phase_ir_allocs[i]
+               << "}" << (i + 1 < PHASE_NUM ? "," : "") << "\n";
+    }
+    stream << "  },\n";
+
+    stream << "  \"ir_allocs\": {\"total\": "
+           << arena.getTotalAllocs() - ir_allocs_base
+           << ", \"peak_live\": " << arena.getPeakLiveAllocs() << "},\n";
+
+    // Only the nodes that are created with makeIRNode() are counted. All of
+    // the generator's IR goes through it, unlike the nodes of unit tests.
+    stream << "  \"ir_nodes\": {";
+    bool first = true;
+    for (size_t i = 0; i < ir_node_num.size(); ++i) {
+        if (ir_node_num[i] == 0)
+            continue;
+        stream << (first ? "" : ",") << "\n    \"" << ir_node_names[i]
+               << "\": {\"created\": " << ir_node_num[i]
+               << ", \"peak_live\": " << ir_node_peak[i] << "}";
+        first = false;
+    }
+    stream << "\n  },\n";
+
+    stream << "  \"ub_rewrites\": {";
+    // NoUB is never rewritten
+    for (size_t i = 1; i < ub_num.size(); ++i)
+        stream << (i > 1 ? "," : "") << "\n    \"" << ub_names[i]
+               << "\": " << ub_num[i];
+    stream << "\n  }\n";
+    stream << "}\n";
+}
+
+PhaseTimer::PhaseTimer(GenPhase _phase)
+    : phase(_phase), active(Statistics::getInstance().isEnabled()) {
+    if (active)
+        Statistics::getInstance().enterPhase(phase);
+}
+
+void PhaseTimer::stop() {
+    if (!active)
+        return;
+    active = false;
+    Statistics::getInstance().exitPhase(phase);
+}
@@ -17,14 +17,20 @@ limitations under the License.
 #pragma once
 
 #include "enums.h"
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstdlib>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace yarpgen {
 class Statistics {
   public:
     static Statistics &getInstance() {
-        static Statistics instance;
+        static thread_local Statistics instance;
         return instance;
     }
     Statistics(const Statistics &options) = delete;
@@ -35,12 +41,113 @@ class Statistics {
 
     void addUB(UBKind kind) { ub_num.at(static_cast<size_t>(kind))++; }
 
+    // Detailed statistics (time of each phase and IR node counts) is
+    // collected only on request, because it is not free
+    void setEnabled(bool val) { enabled = val; }
+    bool isEnabled() { return enabled; }
+
+    // Counts IR nodes that have a kind (expressions and statements)
+    template <typename T> void addIRNode(T *node) {
+        if (enabled)
+            addIRNodeImpl(node, HasIRNodeKind<T>());
+    }
+    void removeIRNode(IRNodeKind kind) {
+        size_t &live = ir_node_live.at(static_cast<size_t>(kind));
+        // Nodes of the previous test can die after the reset
+        if (enabled && live != 0)
+            live--;
+    }
+
+    // Phases are exclusive: a nested phase (e.g. UB elimination during the
+    // population) pauses the outer one. Only the outermost invocation of
+    // the phase is measured.
+    void enterPhase(GenPhase phase);
+    void exitPhase(GenPhase phase);
+
+    void reset();
+    void dumpJSON(std::ostream &stream, uint64_t seed);
+
   private:
-    Statistics() : stmt_num(0), ub_num({}) {}
+    template <typename T>
+    using KindType = decltype(std::declval<T &>().getKind());
+    template <typename T, typename = void>
+    struct HasIRNodeKind : std::false_type {};
+    template <typename T>
+    struct HasIRNodeKind<T, typename std::enable_if<std::is_same<
+                                KindType<T>, IRNodeKind>::value>::type>
+        : std::true_type {};
+
+  public:
+    // Nodes with a kind are created as CountedIRNode<T>, so that the death of
+    // the node is counted as well
+    template <typename T> class CountedIRNode;
+    template <typename T>
+    using IRNodeType = typename std::conditional<HasIRNodeKind<T>::value,
+                                                 CountedIRNode<T>, T>::type;
+
+  private:
+    template <typename T> void addIRNodeImpl(T *node, std::true_type) {
+        size_t idx = static_cast<size_t>(node->getKind());
+        ir_node_num.at(idx)++;
+        ir_node_peak.at(idx) =
+            std::max(ir_node_peak.at(idx), ++ir_node_live.at(idx));
+    }
+    template <typename T> void addIRNodeImpl(T *, std::false_type) {}
+
+    Statistics()
+        : stmt_num(0), ub_num({}), enabled(false), ir_node_num({}),
+          ir_node_live({}), ir_node_peak({}), phase_depth({}),
+          phase_time({}), phase_ir_allocs({}), ir_allocs_base(0),
+          segment_allocs(0) {}
+
+    // Charges the time and IR allocations since the last switch of the phase
+    // to the innermost active phase
+    void chargeCurPhase();
 
     size_t stmt_num;
-    // TODO: count undefined behavior stats
+    // Number of UB eliminations (i.e. rewrites of expressions) of each kind
     std::array<size_t, static_cast<size_t>(UBKind::MaxUB)> ub_num;
+
+    bool enabled;
+    // Number of created, live and peak live IR nodes of each kind
+    static const size_t IR_NODE_KIND_NUM =
+        static_cast<size_t>(IRNodeKind::MAX_STMT_KIND) + 1;
+    std::array<size_t, IR_NODE_KIND_NUM> ir_node_num;
+    std::array<size_t, IR_NODE_KIND_NUM> ir_node_live;
+    std::array<size_t, IR_NODE_KIND_NUM> ir_node_peak;
+
+    static const size_t PHASE_NUM =
+        static_cast<size_t>(GenPhase::MAX_GEN_PHASE);
+    std::array<size_t, PHASE_NUM> phase_depth;
+    std::array<std::chrono::nanoseconds, PHASE_NUM> phase_time;
+    std::array<size_t, PHASE_NUM> phase_ir_allocs;
+    // Arena counts allocations over the whole life of the thread
+    size_t ir_allocs_base;
+    // Active phases, the innermost one is at the back
+    std::vector<GenPhase> phase_stack;
+    std::chrono::steady_clock::time_point segment_start;
+    size_t segment_allocs;
+};
+
+template <typename T> class Statistics::CountedIRNode : public T {
+  public:
+    using T::T;
+    ~CountedIRNode() override {
+        Statistics::getInstance().removeIRNode(this->getKind());
+    }
+};
+
+// Measures the time and IR allocations of a generation phase within its scope
+class PhaseTimer {
+  public:
+    explicit PhaseTimer(GenPhase _phase);
+    ~PhaseTimer() { stop(); }
+    // Finishes the measurement before the end of the scope
+    void stop();
+
+  private:
+    GenPhase phase;
+    bool active;
 };
 
 } // namespace yarpgen
@@ -27,7 +27,7 @@ limitations under the License.
 using namespace yarpgen;
 
 void ExprStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                    std::string offset) {
+                    const std::string &offset) {
     stream << offset;
     expr->emit(ctx, stream);
     stream << ";";
@@ -37,11 +37,11 @@ std::shared_ptr<ExprStmt> ExprStmt::create(std::shared_ptr<PopulateCtx> ctx) {
     auto expr = AssignmentExpr::create(ctx);
     EvalCtx eval_ctx;
     expr->evaluate(eval_ctx);
-    return std::make_shared<ExprStmt>(expr);
+    return makeIRNode<ExprStmt>(expr);
 }
 
 void DeclStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                    std::string offset) {
+                    const std::string &offset) {
     stream << offset;
     // TODO: we need to do the right thing here
     stream << data->getType()->getName(ctx) << " ";
@@ -54,7 +54,7 @@ void DeclStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
 }
 
 void StmtBlock::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                     std::string offset) {
+                     const std::string &offset) {
     for (const auto &stmt : stmts) {
         stmt->emit(ctx, stream, offset);
         // TODO: will that work if we have suffix?
@@ -110,7 +110,7 @@ StmtBlock::generateStructure(std::shared_ptr<GenCtx> ctx) {
         stmts.push_back(new_stmt);
     }
 
-    return std::make_shared<StmtBlock>(stmts);
+    return makeIRNode<StmtBlock>(stmts);
 }
 
 void StmtBlock::populate(std::shared_ptr<PopulateCtx> ctx) {
@@ -133,30 +133,45 @@ void StmtBlock::populate(std::shared_ptr<PopulateCtx> ctx) {
     }
 }
 
+bool StmtBlock::hasLoops() {
+    for (auto &stmt : stmts) {
+        IRNodeKind kind = stmt->getKind();
+        if (kind == IRNodeKind::LOOP_SEQ || kind == IRNodeKind::LOOP_NEST)
+            return true;
+        if ((kind == IRNodeKind::BLOCK || kind == IRNodeKind::SCOPE) &&
+            std::static_pointer_cast<StmtBlock>(stmt)->hasLoops())
+            return true;
+        if (kind == IRNodeKind::IF_ELSE &&
+            std::static_pointer_cast<IfElseStmt>(stmt)->hasLoops())
+            return true;
+    }
+    return false;
+}
+
 void ScopeStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                     std::string offset) {
+                     const std::string &offset) {
     stream << offset << "{\n";
-    StmtBlock::emit(ctx, stream, offset + "    ");
+    StmtBlock::emit(ctx, stream, getNextIndent(offset));
     stream << offset << "}\n";
 }
 
 std::shared_ptr<ScopeStmt>
 ScopeStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
     // TODO: will that work?
-    auto new_scope = std::make_shared<ScopeStmt>();
+    auto new_scope = makeIRNode<ScopeStmt>();
     auto stmt_block = StmtBlock::generateStructure(std::move(ctx));
     new_scope->stmts = stmt_block->getStmts();
     return new_scope;
 }
 
 void LoopHead::emitPrefix(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                          std::string offset) {
+                          const std::string &offset) {
     if (prefix.use_count() != 0)
-        prefix->emit(ctx, stream, std::move(offset));
+        prefix->emit(ctx, stream, offset);
 }
 
 void LoopHead::emitHeader(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                          std::string offset) {
+                          const std::string &offset) {
     if (!pragmas.empty()) {
         for (auto &pragma : pragmas) {
             pragma->emit(ctx, stream, offset);
@@ -244,9 +259,9 @@ void LoopHead::emitHeader(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
 }
 
 void LoopHead::emitSuffix(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                          std::string offset) {
+                          const std::string &offset) {
     if (suffix.use_count() != 0)
-        suffix->emit(ctx, stream, std::move(offset));
+        suffix->emit(ctx, stream, offset);
 }
 
 void LoopHead::createPragmas(std::shared_ptr<PopulateCtx> ctx) {
@@ -291,7 +306,7 @@ void LoopHead::populateIterators(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 void LoopSeqStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                       std::string offset) {
+                       const std::string &offset) {
     stream << offset << "/* LoopSeq " << std::to_string(loops.size())
            << " */\n";
 
@@ -311,13 +326,13 @@ LoopSeqStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
 
     Options &options = Options::getInstance();
 
-    auto new_loop_seq = std::make_shared<LoopSeqStmt>();
+    auto new_loop_seq = makeIRNode<LoopSeqStmt>();
     auto new_ctx = std::make_shared<GenCtx>(*ctx);
     // TODO: is it the right place to do it?
     new_ctx->incLoopDepth(1);
     for (size_t i = 0; i < loop_num; ++i) {
         bool gen_foreach = false;
-        auto new_loop_head = std::make_shared<LoopHead>();
+        auto new_loop_head = makeIRNode<LoopHead>();
 
         if (options.isISPC())
             gen_foreach = !ctx->isInsideForeach() &&
@@ -366,7 +381,7 @@ void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
         new_ctx->getLocalSymTable()->addIters(loop_head->getIterators());
 
         new_ctx->incLoopDepth(1);
-        bool old_ctx_state = new_ctx->isTaken();
+        LaneMask old_ctx_state = new_ctx->getTakenLanes();
         // TODO: what if we have multiple iterators
         if (loop_head->getIterators().front()->isDegenerate())
             new_ctx->setTaken(false);
@@ -378,7 +393,7 @@ void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
         new_ctx->getLocalSymTable()->deleteLastIters();
         new_ctx->deleteLastDim();
         new_ctx->setInsideForeach(false);
-        new_ctx->setTaken(old_ctx_state);
+        new_ctx->setTakenLanes(old_ctx_state);
         new_ctx->setInsideOMPSimd(old_simd_state);
         if (loop_head->getSuffix().use_count() != 0)
             loop_head->getSuffix()->populate(new_ctx);
@@ -386,25 +401,24 @@ void LoopSeqStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 void LoopNestStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                        std::string offset) {
+                        const std::string &offset) {
     stream << offset << "/* LoopNest " << std::to_string(loops.size())
            << " */\n";
 
-    std::string new_offset = offset;
+    size_t level = offset.size() / INDENT_SIZE;
     for (const auto &loop : loops) {
+        const std::string &new_offset = getIndent(level++);
         loop->emitPrefix(ctx, stream, new_offset);
         loop->emitHeader(ctx, stream, new_offset);
         stream << "\n" << new_offset << "{\n";
-        new_offset += "    ";
     }
 
-    body->emit(ctx, stream, new_offset);
-    new_offset.erase(new_offset.size() - 4, 4);
+    body->emit(ctx, stream, getIndent(level--));
 
     for (const auto &loop : loops) {
+        const std::string &new_offset = getIndent(level--);
         stream << new_offset << "} \n";
         loop->emitSuffix(ctx, stream, new_offset);
-        new_offset.erase(new_offset.size() - 4, 4);
     }
 }
 
@@ -419,9 +433,9 @@ LoopNestStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
 
     Options &options = Options::getInstance();
 
-    auto new_loop_nest = std::make_shared<LoopNestStmt>();
+    auto new_loop_nest = makeIRNode<LoopNestStmt>();
     for (size_t i = 0; i < nest_depth; ++i) {
-        auto new_loop = std::make_shared<LoopHead>();
+        auto new_loop = makeIRNode<LoopHead>();
 
         bool gen_foreach = false;
         if (options.isISPC())
@@ -448,7 +462,7 @@ LoopNestStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
 void LoopNestStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     auto gen_pol = ctx->getGenPolicy();
     auto new_ctx = std::make_shared<PopulateCtx>(ctx);
-    bool old_ctx_state = new_ctx->isTaken();
+    LaneMask old_ctx_state = new_ctx->getTakenLanes();
     std::vector<std::shared_ptr<LoopHead>>::iterator taken_switch_id;
     auto simd_switch_id = loops.end();
     for (auto i = loops.begin(); i != loops.end(); ++i) {
@@ -487,7 +501,7 @@ void LoopNestStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
         new_ctx->getLocalSymTable()->deleteLastIters();
         new_ctx->deleteLastDim();
         if (i == taken_switch_id)
-            new_ctx->setTaken(old_ctx_state);
+            new_ctx->setTakenLanes(old_ctx_state);
         if (i == simd_switch_id)
             new_ctx->setInsideOMPSimd(false);
         if ((*i)->isForeach())
@@ -498,7 +512,7 @@ void LoopNestStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
 }
 
 void IfElseStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                      std::string offset) {
+                      const std::string &offset) {
     stream << offset << "if (";
     // We can dump test structure before populating it
     if (cond.use_count() != 0)
@@ -525,11 +539,21 @@ IfElseStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
     Statistics &stats = Statistics::getInstance();
     stats.addStmt();
 
-    return std::make_shared<IfElseStmt>(nullptr, then_br, else_br);
+    return makeIRNode<IfElseStmt>(nullptr, then_br, else_br);
+}
+
+bool IfElseStmt::hasLoops() {
+    return then_br->hasLoops() ||
+           (else_br.use_count() != 0 && else_br->hasLoops());
 }
 
 void IfElseStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
+    // Loops can't be executed only by a part of the lanes
+    bool old_lane_invariant = ctx->isLaneInvariant();
+    if (hasLoops())
+        ctx->setLaneInvariant(true);
     cond = ArithmeticExpr::create(ctx);
+    ctx->setLaneInvariant(old_lane_invariant);
 
     if (!cond->getValue()->isScalarVar()) {
         ERROR("Can perform conversion to bool only on scalar variables");
@@ -538,7 +562,7 @@ void IfElseStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     std::shared_ptr<IntegralType> int_type =
         std::static_pointer_cast<IntegralType>(cond->getValue()->getType());
     if (int_type->getIntTypeId() != IntTypeID::BOOL) {
-        cond = std::make_shared<TypeCastExpr>(
+        cond = makeIRNode<TypeCastExpr>(
             cond,
             IntegralType::init(IntTypeID::BOOL, false, CVQualifier::NONE,
                                cond->getValue()->getType()->isUniform()),
@@ -546,35 +570,40 @@ void IfElseStmt::populate(std::shared_ptr<PopulateCtx> ctx) {
     }
 
     EvalCtx eval_ctx;
-    std::shared_ptr<Data> cond_eval_res = cond->evaluate(eval_ctx);
-    IRValue cond_val =
-        std::static_pointer_cast<ScalarVar>(cond_eval_res)->getCurrentValue();
-
-    auto new_ctx = std::make_shared<PopulateCtx>(*ctx);
-    new_ctx->incIfElseDepth();
-    bool cond_taken = cond_val.getValueRef<bool>();
-    new_ctx->setTaken(ctx->isTaken() && cond_taken);
-
-    then_br->populate(new_ctx);
+    std::vector<IRValue> cond_vals = cond->evaluateLaneValues(eval_ctx);
+    LaneMask cond_taken;
+    for (size_t i = 0; i < LANES_NUM; ++i)
+        cond_taken[i] = cond_vals[i % cond_vals.size()].getValueRef<bool>();
+
+    // Branches are populated in the same context, the changes are reverted
+    // afterwards
+    LaneMask old_ctx_state = ctx->getTakenLanes();
+    ctx->incIfElseDepth();
+    ctx->setTakenLanes(old_ctx_state & cond_taken);
+
+    then_br->populate(ctx);
     if (else_br.use_count() != 0) {
-        new_ctx->setTaken(ctx->isTaken() && !cond_taken);
-        else_br->populate(new_ctx);
+        ctx->setTakenLanes(old_ctx_state & ~cond_taken);
+        else_br->populate(ctx);
     }
+
+    ctx->setTakenLanes(old_ctx_state);
+    ctx->decIfElseDepth();
 }
 
 void StubStmt::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                    std::string offset) {
+                    const std::string &offset) {
     stream << offset << text;
 }
 
 std::shared_ptr<StubStmt>
 StubStmt::generateStructure(std::shared_ptr<GenCtx> ctx) {
     NameHandler &nh = NameHandler::getInstance();
-    return std::make_shared<StubStmt>("Stub stmt #" + nh.getStubStmtIdx());
+    return makeIRNode<StubStmt>("Stub stmt #" + nh.getStubStmtIdx());
 }
 
 void Pragma::emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                  std::string offset) {
+                  const std::string &offset) {
     stream << offset << "#pragma ";
     auto clang_emit_helper = [&stream](std::string name) {
         stream << "clang loop " << name << "(enable)";
@@ -607,7 +636,7 @@ std::shared_ptr<Pragma> Pragma::create(std::shared_ptr<PopulateCtx> ctx) {
         rand_val_gen->getRandId(gen_pol->pragma_kind_distr);
     if (pragma_kind == PragmaKind::MAX_PRAGMA_KIND)
         ERROR("Bad PragmaKind");
-    return std::make_shared<Pragma>(pragma_kind);
+    return makeIRNode<Pragma>(pragma_kind);
 }
 
 std::vector<std::shared_ptr<Pragma>>
@@ -43,7 +43,7 @@ class ExprStmt : public Stmt {
     std::shared_ptr<Expr> getExpr() { return expr; }
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<ExprStmt> create(std::shared_ptr<PopulateCtx> ctx);
 
   private:
@@ -57,7 +57,7 @@ class DeclStmt : public Stmt {
         : data(std::move(_data)), init_expr(std::move(_expr)) {}
     IRNodeKind getKind() final { return IRNodeKind::DECL; }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
 
   private:
     std::shared_ptr<Data> data;
@@ -78,10 +78,12 @@ class StmtBlock : public Stmt {
     std::vector<std::shared_ptr<Stmt>> getStmts() { return stmts; }
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") override;
+              const std::string &offset = "") override;
     static std::shared_ptr<StmtBlock>
     generateStructure(std::shared_ptr<GenCtx> ctx);
     void populate(std::shared_ptr<PopulateCtx> ctx) override;
+    // Checks if the block contains loops at any depth
+    bool hasLoops();
 
   protected:
     std::vector<std::shared_ptr<Stmt>> stmts;
@@ -91,7 +93,7 @@ class ScopeStmt : public StmtBlock {
   public:
     IRNodeKind getKind() final { return IRNodeKind::SCOPE; }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<ScopeStmt>
     generateStructure(std::shared_ptr<GenCtx> ctx);
 };
@@ -103,7 +105,7 @@ class Pragma {
     explicit Pragma(PragmaKind _kind) : kind(_kind) {}
     PragmaKind getKind() { return kind; }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "");
+              const std::string &offset = "");
     static std::shared_ptr<Pragma> create(std::shared_ptr<PopulateCtx> ctx);
     static std::vector<std::shared_ptr<Pragma>>
     create(size_t num, std::shared_ptr<PopulateCtx> ctx);
@@ -127,11 +129,11 @@ class LoopHead {
         suffix = std::move(_suffix);
     }
     void emitPrefix(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                    std::string offset = "");
+                    const std::string &offset = "");
     void emitHeader(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                    std::string offset = "");
+                    const std::string &offset = "");
     void emitSuffix(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-                    std::string offset = "");
+                    const std::string &offset = "");
 
     void setIsForeach() { is_foreach = true; }
     bool isForeach() { return is_foreach; }
@@ -166,7 +168,7 @@ class LoopSeqStmt : public LoopStmt {
         loops.push_back(std::move(_loop));
     }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<LoopSeqStmt>
     generateStructure(std::shared_ptr<GenCtx> ctx);
     void populate(std::shared_ptr<PopulateCtx> ctx) override;
@@ -185,7 +187,7 @@ class LoopNestStmt : public LoopStmt {
     }
     void addBody(std::shared_ptr<ScopeStmt> _body) { body = std::move(_body); }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<LoopNestStmt>
     generateStructure(std::shared_ptr<GenCtx> ctx);
     void populate(std::shared_ptr<PopulateCtx> ctx) override;
@@ -203,10 +205,11 @@ class IfElseStmt : public Stmt {
           else_br(std::move(_else_br)) {}
     IRNodeKind getKind() final { return IRNodeKind::IF_ELSE; }
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<IfElseStmt>
     generateStructure(std::shared_ptr<GenCtx> ctx);
     void populate(std::shared_ptr<PopulateCtx> ctx) final;
+    bool hasLoops();
 
   private:
     std::shared_ptr<Expr> cond;
@@ -220,7 +223,7 @@ class StubStmt : public Stmt {
     IRNodeKind getKind() final { return IRNodeKind::STUB; }
 
     void emit(std::shared_ptr<EmitCtx> ctx, std::ostream &stream,
-              std::string offset = "") final;
+              const std::string &offset = "") final;
     static std::shared_ptr<StubStmt>
     generateStructure(std::shared_ptr<GenCtx> ctx);
 
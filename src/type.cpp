@@ -29,12 +29,14 @@ limitations under the License.
 
 using namespace yarpgen;
 
-std::unordered_map<IntTypeKey, std::shared_ptr<IntegralType>, IntTypeKeyHasher>
+thread_local std::unordered_map<IntTypeKey, std::shared_ptr<IntegralType>,
+                                IntTypeKeyHasher>
     yarpgen::IntegralType::int_type_set;
 
-std::unordered_map<ArrayTypeKey, std::shared_ptr<ArrayType>, ArrayTypeKeyHasher>
+thread_local std::unordered_map<ArrayTypeKey, std::shared_ptr<ArrayType>,
+                                ArrayTypeKeyHasher>
     yarpgen::ArrayType::array_type_set;
-size_t yarpgen::ArrayType::uid_counter = 0;
+thread_local size_t yarpgen::ArrayType::uid_counter = 0;
 
 std::shared_ptr<IntegralType> yarpgen::IntegralType::init(IntTypeID _type_id) {
     return init(_type_id, false, CVQualifier::NONE);
@@ -138,8 +138,8 @@ class IntegralType : public ArithmeticType {
   private:
     // There is a fixed small number of possible integral types,
     // so we use a folding set in order to save memory
-    static std::unordered_map<IntTypeKey, std::shared_ptr<IntegralType>,
-                              IntTypeKeyHasher>
+    static thread_local std::unordered_map<
+        IntTypeKey, std::shared_ptr<IntegralType>, IntTypeKeyHasher>
         int_type_set;
 };
 
@@ -329,12 +329,12 @@ class ArrayType : public Type {
 
   private:
     // Folding set for all of the array types.
-    static std::unordered_map<ArrayTypeKey, std::shared_ptr<ArrayType>,
-                              ArrayTypeKeyHasher>
+    static thread_local std::unordered_map<
+        ArrayTypeKey, std::shared_ptr<ArrayType>, ArrayTypeKeyHasher>
         array_type_set;
     // The easiest way to compare array types is to assign a unique identifier
     // to each of them and then compare it.
-    static size_t uid_counter;
+    static thread_local size_t uid_counter;
 
     std::shared_ptr<Type> base_type;
     // Number of elements in each dimension
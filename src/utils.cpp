@@ -19,24 +19,30 @@ limitations under the License.
 
 #include "utils.h"
 #include "type.h"
+#include <cstdio>
+#include <limits>
 #include <memory>
 
 using namespace yarpgen;
 
-std::shared_ptr<RandValGen> yarpgen::rand_val_gen;
+thread_local std::shared_ptr<RandValGen> yarpgen::rand_val_gen;
 
 RandValGen::RandValGen(uint64_t _seed) {
     if (_seed != 0) {
         seed = _seed;
     }
-    else {
-        std::random_device rd;
-        seed = rd();
-    }
-    std::cout << "/*SEED " << seed << "*/" << std::endl;
+    else
+        seed = getRandomSeed();
     rand_gen = std::mt19937_64(seed);
 }
 
+uint64_t RandValGen::getRandomSeed() {
+    // random_device returns 32-bit values
+    std::random_device rd;
+    uint64_t high = rd();
+    return (high << 32) | rd();
+}
+
 #define RandValueCase(__type_id__, gen_name, type_name)                        \
     case __type_id__:                                                          \
         do {                                                                   \
@@ -81,3 +87,48 @@ void RandValGen::setSeed(uint64_t new_seed) {
     seed = new_seed;
     rand_gen = std::mt19937_64(seed);
 }
+
+OutputBuffer::int_type OutputBuffer::overflow(int_type ch) {
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+        return traits_type::not_eof(ch);
+
+    size_t size = getSize();
+    capacity *= 2;
+    std::unique_ptr<char[]> new_buf(new char[capacity]);
+    std::copy(buf.get(), buf.get() + size, new_buf.get());
+    buf = std::move(new_buf);
+    setp(buf.get(), buf.get() + capacity);
+    // pbump accepts only int, so we have to advance in several steps
+    while (size > 0) {
+        int step = static_cast<int>(
+            std::min<size_t>(size, std::numeric_limits<int>::max()));
+        pbump(step);
+        size -= step;
+    }
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+}
+
+void OutputBuffer::writeToFile(const std::string &file_name) {
+    FILE *out_file = std::fopen(file_name.c_str(), "wb");
+    if (!out_file)
+        ERROR(std::string("Can't open file ") + file_name);
+    // The data is already buffered, so we write it with a single call
+    std::setvbuf(out_file, nullptr, _IONBF, 0);
+    size_t size = getSize();
+    if (std::fwrite(getData(), 1, size, out_file) != size)
+        ERROR(std::string("Can't write file ") + file_name);
+    std::fclose(out_file);
+}
+
+std::string yarpgen::joinPath(const std::string &dir, const std::string &name) {
+#ifdef _WIN32
+    const char separator = '\\';
+#else
+    const char separator = '/';
+#endif
+    if (dir.empty() || dir.back() == '/' || dir.back() == separator)
+        return dir + name;
+    return dir + separator + name;
+}
@@ -22,11 +22,15 @@ limitations under the License.
 #include "enums.h"
 
 #include <algorithm>
+#include <initializer_list>
 #include <iostream>
 #include <memory>
 #include <random>
 #include <sstream>
+#include <streambuf>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace yarpgen {
 
@@ -42,7 +46,7 @@ class IRValue;
     } while (false)
 
 // This class links together id (for example, type of unary operator) and its
-// probability. Usually it is used in the form of std::vector<Probability<id>>
+// probability. Usually it is used in the form of ProbDistr<id> (see below)
 // and defines all possible variants for random decision (probability itself
 // measured in parts, similarly to std::discrete_distribution). Preferably, sum
 // of all probabilities in vector should be 100 (so we can treat 1 part as 1
@@ -50,8 +54,8 @@ class IRValue;
 template <typename T> class Probability {
   public:
     Probability(T _id, uint64_t _prob) : id(_id), prob(_prob) {}
-    T getId() { return id; }
-    uint64_t getProb() { return prob; }
+    T getId() const { return id; }
+    uint64_t getProb() const { return prob; }
 
     void increaseProb(uint64_t add_prob) { prob += add_prob; }
     void zeroProb() { prob = 0; }
@@ -67,6 +71,82 @@ template <typename T> class Probability {
     uint64_t prob;
 };
 
+// Set of all possible variants for a random decision. Building a sampler out of
+// the probabilities is expensive, so it is done once and cached until the
+// probabilities change. Generation policies are copied for almost every
+// expression, so the copies share both the probabilities and the sampler, and
+// the probabilities are cloned only on modification.
+// Any non-const access drops the sampler, so references to the elements must
+// not be kept across the sampling.
+template <typename T> class ProbDistr {
+  public:
+    using Container = std::vector<Probability<T>>;
+
+    ProbDistr() = default;
+    ProbDistr(std::initializer_list<Probability<T>> init)
+        : probs(std::make_shared<Container>(init)) {}
+
+    typename Container::const_iterator begin() const {
+        return getProbs().begin();
+    }
+    typename Container::const_iterator end() const { return getProbs().end(); }
+    const Probability<T> &at(size_t idx) const { return getProbs().at(idx); }
+    size_t size() const { return getProbs().size(); }
+    bool empty() const { return getProbs().empty(); }
+
+    typename Container::iterator begin() { return modifyProbs().begin(); }
+    typename Container::iterator end() { return modifyProbs().end(); }
+    Probability<T> &at(size_t idx) { return modifyProbs().at(idx); }
+    template <typename... Args> void emplace_back(Args &&... args) {
+        modifyProbs().emplace_back(std::forward<Args>(args)...);
+    }
+    void push_back(const Probability<T> &prob) {
+        modifyProbs().push_back(prob);
+    }
+    typename Container::iterator
+    erase(typename Container::const_iterator pos) {
+        return modifyProbs().erase(pos);
+    }
+    typename Container::iterator
+    erase(typename Container::const_iterator first,
+          typename Container::const_iterator last) {
+        return modifyProbs().erase(first, last);
+    }
+    void clear() { modifyProbs().clear(); }
+    void reserve(size_t size) { modifyProbs().reserve(size); }
+
+    // Returns the index of the chosen element
+    template <typename G> size_t sample(G &gen) const {
+        if (!sampler) {
+            std::vector<double> weights;
+            weights.reserve(size());
+            for (auto &prob : getProbs())
+                weights.push_back(prob.getProb());
+            sampler = std::make_shared<std::discrete_distribution<size_t>>(
+                weights.begin(), weights.end());
+        }
+        return (*sampler)(gen);
+    }
+
+  private:
+    const Container &getProbs() const {
+        static const Container empty_probs;
+        return probs ? *probs : empty_probs;
+    }
+
+    Container &modifyProbs() {
+        sampler.reset();
+        if (!probs)
+            probs = std::make_shared<Container>();
+        else if (probs.use_count() > 1)
+            probs = std::make_shared<Container>(*probs);
+        return *probs;
+    }
+
+    std::shared_ptr<Container> probs;
+    mutable std::shared_ptr<std::discrete_distribution<size_t>> sampler;
+};
+
 // According to the agreement, Random Value Generator is the only way to get any
 // random value in YARPGen. It is used for different random decisions all over
 // the source code.
@@ -76,6 +156,9 @@ class RandValGen {
     // Zero value is reserved (it notifies RandValGen that it can choose any)
     RandValGen(uint64_t _seed);
 
+    // Non-deterministic seed that is used when the user hasn't passed any
+    static uint64_t getRandomSeed();
+
     template <typename T> T getRandValue(T from, T to) {
         // Using long long instead of T is a hack.
         // getRandValue is used with all kind of integer types, including chars.
@@ -105,16 +188,9 @@ class RandValGen {
 
     IRValue getRandValue(IntTypeID type_id);
 
-    // Randomly chooses one of IDs, basing on std::vector<Probability<id>>.
-    template <typename T> T getRandId(std::vector<Probability<T>> vec) {
-        std::vector<double> discrete_dis_init;
-        for (auto i : vec)
-            discrete_dis_init.push_back(i.getProb());
-
-        std::discrete_distribution<size_t> discrete_dis(
-            discrete_dis_init.begin(), discrete_dis_init.end());
-        size_t idx = discrete_dis(rand_gen);
-        return vec.at(idx).getId();
+    // Randomly chooses one of IDs, basing on ProbDistr<id>.
+    template <typename T> T getRandId(const ProbDistr<T> &distr) {
+        return distr.at(distr.sample(rand_gen)).getId();
     }
 
     // Randomly choose element from a vector
@@ -123,16 +199,21 @@ class RandValGen {
         size_t idx = distr(rand_gen);
         return vec.at(idx);
     }
+    template <typename T> const T &getRandElem(const std::vector<T> &vec) {
+        std::uniform_int_distribution<size_t> distr(0, vec.size() - 1);
+        size_t idx = distr(rand_gen);
+        return vec.at(idx);
+    }
 
     // To improve variety of generated tests, we implement shuffling of
     // input probabilities (they are stored in GenPolicy).
     // TODO: sometimes this action increases test complexity, and tests becomes
     // non-generatable.
     template <typename T>
-    void shuffleProb(std::vector<Probability<T>> &prob_vec) {
+    void shuffleProb(ProbDistr<T> &prob_vec) {
         int total_prob = 0;
         std::vector<double> discrete_dis_init;
-        std::vector<Probability<T>> new_prob;
+        ProbDistr<T> new_prob;
         for (auto i : prob_vec) {
             total_prob += i.getProb();
             discrete_dis_init.push_back(i.getProb());
@@ -166,22 +247,40 @@ template <> inline bool RandValGen::getRandValue<bool>(bool from, bool to) {
     return (bool)dis(rand_gen);
 }
 
-extern std::shared_ptr<RandValGen> rand_val_gen;
+// Each generation thread has its own generator, so tests that are generated
+// in parallel don't affect each other.
+extern thread_local std::shared_ptr<RandValGen> rand_val_gen;
 
 class NameHandler {
   public:
     static NameHandler &getInstance() {
-        static NameHandler instance;
+        static thread_local NameHandler instance;
         return instance;
     }
     NameHandler(const NameHandler &root) = delete;
     NameHandler &operator=(const NameHandler &) = delete;
 
     std::string getStubStmtIdx() { return std::to_string(stub_stmt_idx++); }
-    std::string getVarName() { return "var_" + std::to_string(var_idx++); }
-    std::string getArrayName() { return "arr_" + std::to_string(arr_idx++); }
+    std::string getVarName() {
+        return prefix + "var_" + std::to_string(var_idx++);
+    }
+    std::string getArrayName() {
+        return prefix + "arr_" + std::to_string(arr_idx++);
+    }
+    // Tests of a unity build share the global namespace, so their data needs
+    // unique names
+    void setPrefix(std::string _prefix) { prefix = std::move(_prefix); }
     std::string getIterName() { return "i_" + std::to_string(iter_idx++); }
 
+    // We need to start from scratch for every new test in batch mode
+    void reset() {
+        var_idx = 0;
+        arr_idx = 0;
+        iter_idx = 0;
+        stub_stmt_idx = 0;
+        prefix.clear();
+    }
+
   private:
     NameHandler() : var_idx(0), arr_idx(0), iter_idx(0), stub_stmt_idx(0) {}
 
@@ -189,5 +288,33 @@ class NameHandler {
     uint32_t arr_idx;
     uint32_t iter_idx;
     uint32_t stub_stmt_idx;
+    std::string prefix;
+};
+
+// Joins a directory and a file name with the separator of the platform
+std::string joinPath(const std::string &dir, const std::string &name);
+
+// Stream buffer that accumulates the whole output file in memory. Emission of
+// a test consists of a huge number of small writes, so it is much cheaper to
+// put them into a single growing buffer and flush it with one call.
+// Most of the files are a few dozen kilobytes, so the buffer starts small and
+// its memory isn't zero-filled.
+class OutputBuffer : public std::streambuf {
+  public:
+    OutputBuffer() : buf(new char[INIT_SIZE]), capacity(INIT_SIZE) { clear(); }
+
+    const char *getData() { return pbase(); }
+    size_t getSize() { return static_cast<size_t>(pptr() - pbase()); }
+    void clear() { setp(buf.get(), buf.get() + capacity); }
+
+    void writeToFile(const std::string &file_name);
+
+  protected:
+    int_type overflow(int_type ch) override;
+
+  private:
+    static const size_t INIT_SIZE = 1 << 16;
+    std::unique_ptr<char[]> buf;
+    size_t capacity;
 };
 } // namespace yarpgen
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2019-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include "yarpgen.h"
+#include "options.h"
+#include "program.h"
+#include "utils.h"
+
+using namespace yarpgen;
+
+// Options are kept in a thread-local object that is used by the whole
+// generator, so we have to set all of them from scratch for every test
+static void setOptions(const GenConfig &config) {
+    OptionParser::initOptions();
+    Options &options = Options::getInstance();
+    options.setLangStd(config.std);
+    options.setCheckAlgo(config.check_algo);
+    options.setInpAsArgs(config.inp_as_args);
+    options.setEmitAlignAttr(config.emit_align_attr);
+    options.setUniqueAlignSize(config.unique_align_size ||
+                               config.align_size !=
+                                   AlignmentSize::MAX_ALIGNMENT_SIZE);
+    options.setAlignSize(config.align_size);
+    options.setAllowDeadData(config.allow_dead_data);
+    options.setEmitPragmas(config.emit_pragmas);
+    options.setUseParamShuffle(config.use_param_shuffle);
+    options.setExplLoopParams(config.expl_loop_params);
+    options.setFoldExprs(config.fold_exprs);
+    options.setArrClusters(config.arr_clusters);
+    options.setMutate(config.mutate);
+    options.setMutationSeed(config.mutation_seed);
+    options.setStatsFormat(config.collect_stats ? StatsFormat::JSON
+                                                : StatsFormat::NONE);
+    options.setPerfTripCount(config.perf_trip_count);
+    options.setPerfReps(config.perf_reps);
+    options.setPerfTime(config.perf_time);
+    options.setTimingRuns(config.timing_runs);
+    options.setForkServer(config.fork_server);
+}
+
+GeneratedProgram yarpgen::generate(const GenConfig &config, uint64_t seed) {
+    setOptions(config);
+    Options &options = Options::getInstance();
+    GeneratedProgram ret;
+    ret.error = options.getConflict();
+    if (!ret.error.empty())
+        return ret;
+
+    initRandGen(seed);
+    ret.seed = options.getSeed();
+    ret.mutation_seed = options.getMutationSeed();
+
+    ProgramGenerator new_program;
+    new_program.emitFiles(
+        [&ret](const std::string &file_name, OutputBuffer &buf) {
+            std::string text(buf.getData(), buf.getSize());
+            if (file_name == "init.h")
+                ret.init_h = std::move(text);
+            else if (file_name == "stats.json")
+                ret.stats_json = std::move(text);
+            else if (file_name.compare(0, 5, "func.") == 0) {
+                ret.func_file_name = file_name;
+                ret.func = std::move(text);
+            }
+            else {
+                ret.driver_file_name = file_name;
+                ret.driver = std::move(text);
+            }
+        });
+
+    if (options.isPrecomputeCheck()) {
+        ret.has_expected_hash = true;
+        ret.expected_hash = new_program.getExpectedHash();
+    }
+    return ret;
+}
@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2019-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "enums.h"
+
+#include <cstdint>
+#include <string>
+
+// Public interface that allows to embed the generator into other tools.
+// It doesn't touch the filesystem and doesn't print anything.
+
+namespace yarpgen {
+
+// Options of the generated test. They match command line options of yarpgen
+// and have the same default values.
+struct GenConfig {
+    LangStd std = LangStd::CXX;
+    CheckAlgo check_algo = CheckAlgo::HASH;
+    OptionLevel inp_as_args = OptionLevel::SOME;
+    OptionLevel emit_align_attr = OptionLevel::SOME;
+    bool unique_align_size = false;
+    // MAX_ALIGNMENT_SIZE stands for a random choice
+    AlignmentSize align_size = AlignmentSize::MAX_ALIGNMENT_SIZE;
+    bool allow_dead_data = false;
+    OptionLevel emit_pragmas = OptionLevel::SOME;
+    bool use_param_shuffle = true;
+    bool expl_loop_params = false;
+    // Share identical immutable expression subtrees
+    bool fold_exprs = false;
+    // Arrays have clusters of different values (ignored for ISPC)
+    bool arr_clusters = false;
+    bool mutate = false;
+    // Zero is reserved for random
+    uint64_t mutation_seed = 0;
+    // Report generation statistics in JSON format
+    bool collect_stats = false;
+    // Zero trip count stands for a regular test
+    size_t perf_trip_count = 0;
+    size_t perf_reps = 1;
+    // Time budget of the test function calls in milliseconds (zero disables)
+    size_t perf_time = 0;
+    // Zero disables the timing harness in the driver
+    size_t timing_runs = 0;
+    // Emit a driver that can work as a fork server
+    bool fork_server = false;
+};
+
+struct GeneratedProgram {
+    // Options of GenConfig that can't be used together. The test isn't
+    // generated if it isn't empty.
+    std::string error;
+
+    // The actual seed of the test (it is random if zero seed was requested)
+    uint64_t seed = 0;
+    uint64_t mutation_seed = 0;
+
+    // Names of the files depend on the language standard of the test
+    std::string func_file_name;
+    std::string driver_file_name;
+
+    std::string init_h;
+    std::string func;
+    std::string driver;
+
+    // The value that the test prints if it is compiled correctly.
+    // It is available only for CheckAlgo::PRECOMPUTE and LANE_PRECOMPUTE.
+    bool has_expected_hash = false;
+    uint64_t expected_hash = 0;
+
+    // Empty unless GenConfig::collect_stats is set
+    std::string stats_json;
+};
+
+// Generates a single test. Zero seed is reserved for random.
+// Conflicting options are reported in GeneratedProgram::error.
+// The generator state is thread-local and it is reset for every test, so the
+// function can be called from several threads at once.
+GeneratedProgram generate(const GenConfig &config, uint64_t seed);
+
+} // namespace yarpgen
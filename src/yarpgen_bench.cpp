@@ -0,0 +1,455 @@
+/*
+Copyright (c) 2015-2020, Intel Corporation
+Copyright (c) 2019-2020, University of Utah
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Micro-benchmarks for the hot paths of the generator. The harness is
+// self-contained: every benchmark is run several times and the minimum and
+// the median time per operation are reported.
+// Usage: yarpgen_bench [-r <repetitions>] [<name filter>]
+
+#include "context.h"
+#include "expr.h"
+#include "hash.h"
+#include "options.h"
+#include "program.h"
+#include "yarpgen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace yarpgen;
+
+// Results are accumulated here, so the compiler can't throw the work away
+static volatile uint64_t sink = 0;
+
+static size_t repetitions = 10;
+static std::string name_filter;
+
+// Runs the body the given number of times and reports time per operation.
+// Each run of the body is expected to perform ops_num operations. The setup
+// isn't timed and prepares the input of each run, if the body changes it.
+static void runBench(const std::string &name, size_t ops_num,
+                     const std::function<void()> &body, size_t reps = 0,
+                     const std::function<void()> &setup = nullptr) {
+    if (name.find(name_filter) == std::string::npos)
+        return;
+    if (reps == 0)
+        reps = repetitions;
+
+    std::vector<double> times;
+    for (size_t i = 0; i < reps; ++i) {
+        if (setup)
+            setup();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double, std::nano> elapsed = end - start;
+        times.push_back(elapsed.count() / static_cast<double>(ops_num));
+    }
+    std::sort(times.begin(), times.end());
+
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::fixed << std::setprecision(1) << " min "
+              << std::setw(12) << times.front() << " ns/op, median "
+              << std::setw(12) << times.at(times.size() / 2) << " ns/op"
+              << std::endl;
+}
+
+// Every benchmark starts with the same generator state
+static void initGenerator(uint64_t seed) {
+    OptionParser::initOptions();
+    initRandGen(seed);
+}
+
+static const char *getTypeName(IntTypeID type_id) {
+    static const char *names[] = {"bool", "schar", "uchar", "short", "ushort",
+                                  "int",  "uint",  "llong", "ullong"};
+    return names[static_cast<size_t>(type_id)];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static const size_t VAL_POOL_SIZE = 1024;
+
+static std::vector<IRValue> getValPool(IntTypeID type_id) {
+    std::vector<IRValue> ret;
+    for (size_t i = 0; i < VAL_POOL_SIZE; ++i)
+        ret.push_back(rand_val_gen->getRandValue(type_id));
+    return ret;
+}
+
+using BinaryOpFunc = IRValue (*)(IRValue, IRValue);
+using UnaryOpFunc = IRValue (*)(IRValue &);
+
+static void benchBinaryOp(const std::string &name, std::vector<IRValue> &vals,
+                          BinaryOpFunc op) {
+    runBench(name, VAL_POOL_SIZE, [&vals, op]() {
+        uint64_t res = 0;
+        for (size_t i = 0; i < VAL_POOL_SIZE; ++i) {
+            IRValue val = op(vals[i], vals[(i + 1) % VAL_POOL_SIZE]);
+            res += static_cast<uint64_t>(val.getUBCode());
+        }
+        sink += res;
+    });
+}
+
+static void benchUnaryOp(const std::string &name, std::vector<IRValue> &vals,
+                         UnaryOpFunc op) {
+    runBench(name, VAL_POOL_SIZE, [&vals, op]() {
+        uint64_t res = 0;
+        for (size_t i = 0; i < VAL_POOL_SIZE; ++i)
+            res += static_cast<uint64_t>(op(vals[i]).getUBCode());
+        sink += res;
+    });
+}
+
+// Arithmetic operators are defined only for the types after the integral
+// promotion, so the smaller types are benchmarked through the cast and bool
+// has only logical operators.
+static void benchIRValue() {
+    initGenerator(1);
+
+    std::vector<std::pair<std::string, BinaryOpFunc>> arith_ops = {
+        {"add", operator+},     {"sub", operator-},      {"mul", operator*},
+        {"div", operator/},     {"mod", operator%},      {"lt", operator<},
+        {"gt", operator>},      {"le", operator<=},      {"ge", operator>=},
+        {"eq", operator==},     {"ne", operator!=},      {"bit_and", operator&},
+        {"bit_or", operator|},  {"bit_xor", operator^},  {"shl", operator<<},
+        {"shr", operator>>}};
+    std::vector<std::pair<std::string, UnaryOpFunc>> unary_ops = {
+        {"plus", [](IRValue &val) { return +val; }},
+        {"negate", [](IRValue &val) { return -val; }},
+        {"bit_not", [](IRValue &val) { return ~val; }}};
+
+    for (size_t i = 0; i < static_cast<size_t>(IntTypeID::MAX_INT_TYPE_ID);
+         ++i) {
+        auto type_id = static_cast<IntTypeID>(i);
+        std::string prefix = std::string("irvalue/") + getTypeName(type_id);
+        std::vector<IRValue> vals = getValPool(type_id);
+
+        runBench(prefix + "/cast_to_int", VAL_POOL_SIZE, [&vals]() {
+            uint64_t res = 0;
+            for (auto &val : vals)
+                res += static_cast<uint64_t>(
+                    val.castToType(IntTypeID::INT).getUBCode());
+            sink += res;
+        });
+
+        if (type_id == IntTypeID::BOOL) {
+            benchBinaryOp(prefix + "/log_and", vals, operator&&);
+            benchBinaryOp(prefix + "/log_or", vals, operator||);
+            benchUnaryOp(prefix + "/log_not", vals,
+                         [](IRValue &val) { return !val; });
+            continue;
+        }
+
+        if (type_id < IntTypeID::INT)
+            continue;
+
+        for (auto &op : arith_ops)
+            benchBinaryOp(prefix + "/" + op.first, vals, op.second);
+        for (auto &op : unary_ops)
+            benchUnaryOp(prefix + "/" + op.first, vals, op.second);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static const size_t TREES_NUM = 64;
+
+// Creates a forest of trees that consist mostly of binary operators. They may
+// contain UB, so rebuild has something to fix.
+static std::vector<std::shared_ptr<Expr>> createTrees(size_t depth) {
+    auto pop_ctx = std::make_shared<PopulateCtx>();
+    auto gen_pol = std::make_shared<GenPolicy>(*pop_ctx->getGenPolicy());
+    gen_pol->max_arith_depth = depth;
+    gen_pol->arith_node_distr = {
+        Probability<IRNodeKind>(IRNodeKind::CONST, 5),
+        Probability<IRNodeKind>(IRNodeKind::SCALAR_VAR_USE, 5),
+        Probability<IRNodeKind>(IRNodeKind::BINARY, 90)};
+    gen_pol->apply_similar_op_distr = {Probability<bool>(false, 1)};
+    gen_pol->apply_const_use_distr = {Probability<bool>(false, 1)};
+    pop_ctx->setGenPolicy(gen_pol);
+
+    auto sym_tbl = std::make_shared<SymbolTable>();
+    for (size_t i = 0; i < 16; ++i) {
+        auto new_var = ScalarVar::create(pop_ctx);
+        sym_tbl->addVar(new_var);
+        sym_tbl->addVarExpr(makeIRNode<ScalarVarUseExpr>(new_var));
+    }
+    pop_ctx->setExtInpSymTable(sym_tbl);
+    pop_ctx->setExtOutSymTable(std::make_shared<SymbolTable>());
+
+    std::vector<std::shared_ptr<Expr>> ret;
+    for (size_t i = 0; i < TREES_NUM; ++i)
+        ret.push_back(ArithmeticExpr::create(pop_ctx));
+    return ret;
+}
+
+static uint64_t getUBCode(const Expr::EvalResType &res) {
+    IRValue val = std::static_pointer_cast<ScalarVar>(res)->getCurrentValue();
+    return static_cast<uint64_t>(val.getUBCode());
+}
+
+static void benchExprTrees() {
+    for (size_t depth : {4, 6, 8}) {
+        initGenerator(2);
+        std::string prefix = "expr/depth_" + std::to_string(depth);
+
+        runBench(prefix + "/create", TREES_NUM,
+                 [depth]() { sink += createTrees(depth).size(); });
+
+        std::vector<std::shared_ptr<Expr>> trees = createTrees(depth);
+        runBench(prefix + "/evaluate", TREES_NUM, [&trees]() {
+            uint64_t res = 0;
+            for (auto &tree : trees) {
+                EvalCtx eval_ctx;
+                res += getUBCode(tree->evaluate(eval_ctx));
+            }
+            sink += res;
+        });
+        // Rebuild fixes the trees in place, so every run gets the same fresh
+        // trees
+        runBench(
+            prefix + "/rebuild", TREES_NUM,
+            [&trees]() {
+                uint64_t res = 0;
+                for (auto &tree : trees) {
+                    EvalCtx eval_ctx;
+                    res += getUBCode(tree->rebuild(eval_ctx));
+                }
+                sink += res;
+            },
+            0,
+            [&trees, depth]() {
+                initGenerator(2);
+                trees = createTrees(depth);
+            });
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static const size_t RAND_ID_CALLS = 10000;
+
+template <typename T>
+static void benchRandIdDistr(const std::string &name,
+                             const ProbDistr<T> &distr) {
+    runBench("rand_id/" + name, RAND_ID_CALLS, [&distr]() {
+        uint64_t res = 0;
+        for (size_t i = 0; i < RAND_ID_CALLS; ++i)
+            res += static_cast<uint64_t>(rand_val_gen->getRandId(distr));
+        sink += res;
+    });
+}
+
+static void benchRandId() {
+    initGenerator(3);
+    GenPolicy gen_pol;
+    benchRandIdDistr("else_br", gen_pol.else_br_distr);
+    benchRandIdDistr("int_type", gen_pol.int_type_distr);
+    benchRandIdDistr("arith_node", gen_pol.arith_node_distr);
+    benchRandIdDistr("unary_op", gen_pol.unary_op_distr);
+    benchRandIdDistr("binary_op", gen_pol.binary_op_distr);
+    benchRandIdDistr("stmt_kind_pop", gen_pol.stmt_kind_pop_distr);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+// The boost-style combiner that Hash used before. It is kept only as a
+// reference for the quality of the folding set hashes.
+class LegacyHash {
+  public:
+    template <typename T> void operator()(T value) {
+        hashCombine(static_cast<size_t>(value));
+    }
+    void operator()(const std::vector<size_t> &value) {
+        LegacyHash hash;
+        for (size_t elem : value)
+            hash(elem);
+        hashCombine(hash.seed);
+    }
+    size_t getSeed() { return seed; }
+
+  private:
+    void hashCombine(size_t value) {
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+
+    size_t seed = HASH_SEED;
+};
+
+static size_t getLegacyHash(const IntTypeKey &key) {
+    LegacyHash hash;
+    hash(key.int_type_id);
+    hash(key.is_static);
+    hash(key.cv_qualifier);
+    hash(key.is_uniform);
+    return hash.getSeed();
+}
+
+static size_t getLegacyHash(const ArrayTypeKey &key) {
+    auto base_type = std::static_pointer_cast<IntegralType>(key.base_type);
+    LegacyHash hash;
+    hash(getLegacyHash(IntTypeKey(base_type)));
+    hash(key.dims);
+    hash(key.kind);
+    hash(key.is_static);
+    hash(key.cv_qualifier);
+    hash(key.is_uniform);
+    return hash.getSeed();
+}
+
+// Reports the number of equal hashes and the longest chain in a table with
+// a power of two buckets, which uses only the low bits of the hash
+static void reportCollisions(const std::string &name,
+                             const std::vector<size_t> &hashes) {
+    if (name.find(name_filter) == std::string::npos)
+        return;
+
+    std::unordered_set<size_t> distinct(hashes.begin(), hashes.end());
+    size_t buckets_num = 1;
+    while (buckets_num < hashes.size())
+        buckets_num <<= 1;
+    std::vector<size_t> buckets(buckets_num, 0);
+    for (size_t hash : hashes)
+        buckets.at(hash & (buckets_num - 1))++;
+
+    std::cout << std::left << std::setw(40) << name << std::right << " keys "
+              << std::setw(8) << hashes.size() << ", equal hashes "
+              << std::setw(8) << hashes.size() - distinct.size()
+              << ", longest chain " << std::setw(4)
+              << *std::max_element(buckets.begin(), buckets.end())
+              << std::endl;
+}
+
+template <typename Key, typename Hasher>
+static void benchKeyHash(const std::string &name,
+                         const std::vector<Key> &keys) {
+    std::vector<size_t> hashes;
+    std::vector<size_t> legacy_hashes;
+    for (const auto &key : keys) {
+        hashes.push_back(Hasher()(key));
+        legacy_hashes.push_back(getLegacyHash(key));
+    }
+    reportCollisions("hash/" + name + "/collisions", hashes);
+    reportCollisions("hash/" + name + "/legacy_collisions", legacy_hashes);
+
+    runBench("hash/" + name, keys.size(), [&keys]() {
+        size_t res = 0;
+        for (const auto &key : keys)
+            res += Hasher()(key);
+        sink += res;
+    });
+}
+
+// All integral types and a realistic range of array dimensions
+static void benchHash() {
+    initGenerator(4);
+    std::vector<IntTypeKey> int_keys;
+    for (size_t i = 0; i < static_cast<size_t>(IntTypeID::MAX_INT_TYPE_ID);
+         ++i)
+        for (bool is_static : {false, true})
+            for (size_t cv = 0;
+                 cv <= static_cast<size_t>(CVQualifier::CONST_VOLAT); ++cv)
+                for (bool is_uniform : {false, true})
+                    int_keys.emplace_back(static_cast<IntTypeID>(i),
+                                          is_static,
+                                          static_cast<CVQualifier>(cv),
+                                          is_uniform);
+    benchKeyHash<IntTypeKey, IntTypeKeyHasher>("int_type_key", int_keys);
+
+    std::vector<std::vector<size_t>> dims_set;
+    for (size_t i = 1; i <= 1024; ++i)
+        dims_set.push_back({i});
+    for (size_t i = 1; i <= 32; ++i)
+        for (size_t j = 1; j <= 32; ++j)
+            dims_set.push_back({i, j});
+    for (size_t i = 1; i <= 10; ++i)
+        for (size_t j = 1; j <= 10; ++j)
+            for (size_t k = 1; k <= 10; ++k)
+                dims_set.push_back({i, j, k});
+
+    std::vector<ArrayTypeKey> arr_keys;
+    for (size_t i = 0; i < static_cast<size_t>(IntTypeID::MAX_INT_TYPE_ID);
+         ++i) {
+        std::shared_ptr<Type> base_type =
+            IntegralType::init(static_cast<IntTypeID>(i));
+        for (size_t kind = 0;
+             kind < static_cast<size_t>(ArrayKind::MAX_ARRAY_KIND); ++kind)
+            for (const auto &dims : dims_set)
+                arr_keys.emplace_back(base_type, dims,
+                                      static_cast<ArrayKind>(kind), false,
+                                      CVQualifier::NONE, false);
+    }
+    benchKeyHash<ArrayTypeKey, ArrayTypeKeyHasher>("array_type_key", arr_keys);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static const uint64_t SEED_CORPUS[] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+static void benchEndToEnd() {
+    const size_t corpus_size = sizeof(SEED_CORPUS) / sizeof(SEED_CORPUS[0]);
+    std::vector<std::pair<std::string, CheckAlgo>> algos = {
+        {"hash", CheckAlgo::HASH},
+        {"asserts", CheckAlgo::ASSERTS},
+        {"precompute", CheckAlgo::PRECOMPUTE},
+        {"lane_precompute", CheckAlgo::LANE_PRECOMPUTE}};
+
+    for (auto &algo : algos) {
+        GenConfig config;
+        config.check_algo = algo.second;
+        // The whole corpus is slow, so it is repeated fewer times
+        runBench(
+            "generate/" + algo.first, corpus_size,
+            [&config]() {
+                uint64_t res = 0;
+                for (uint64_t seed : SEED_CORPUS)
+                    res += generate(config, seed).func.size();
+                sink += res;
+            },
+            std::min<size_t>(repetitions, 3));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            repetitions = std::max(std::strtoul(argv[++i], nullptr, 10), 1UL);
+        else
+            name_filter = argv[i];
+    }
+
+    benchIRValue();
+    benchExprTrees();
+    benchRandId();
+    benchHash();
+    benchEndToEnd();
+    return 0;
+}